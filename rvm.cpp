@@ -4,14 +4,80 @@
 #include <fstream>
 #include <cstring>
 #include <cassert>
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <mutex>
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+static std::mutex g_rvm_instances_mutex;
+static std::unordered_map<std::string, Rvm*> g_rvm_instances;
+static RvmTransactionTable g_trans_table;
+static std::atomic<trans_t> g_trans_id (0);
+// RVM_RECORD_TRACE names one file, so only the first instance records to it
+static std::atomic<bool> g_recording_from_env (false);
+
+///////////////////////////////////////////////////////////////////////////////
+// Segment memory helpers
+///////////////////////////////////////////////////////////////////////////////
+static size_t round_to_page(size_t size) {
+  size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+  return (size + page_size - 1) & ~(page_size - 1);
+}
+
+static char* allocate_segment_memory(size_t size, bool* mmapped) {
+  if (size >= RVM_MMAP_THRESHOLD) {
+    // Anonymous mappings are already zero-filled
+    void* base = mmap(nullptr, round_to_page(size), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base != MAP_FAILED) {
+      *mmapped = true;
+      return (char*) base;
+    }
+  }
+  *mmapped = false;
+  return new char[size]();
+}
+
+static char* map_fixed_segment_memory(void* addr, size_t size) {
+  void* base = mmap(addr, round_to_page(size), PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+  if (base == MAP_FAILED) {
+    return nullptr;
+  }
+
+  if (base != addr) {
+    // Kernels older than 4.17 treat the flag as a hint only
+    munmap(base, round_to_page(size));
+    errno = EEXIST;
+    return nullptr;
+  }
+  return (char*) base;
+}
+
+static void free_segment_memory(char* base, size_t size, bool mmapped) {
+  if (mmapped) {
+    munmap(base, round_to_page(size));
+  } else {
+    delete[] base;
+  }
+}
 
 ///////////////////////////////////////////////////////////////////////////////
 // UndoRecord functions
 ///////////////////////////////////////////////////////////////////////////////
-UndoRecord::UndoRecord(RvmSegment* segment, size_t offset, size_t size)
-        : segment_(segment), offset_(offset), size_(size) {
-  undo_copy_ = new char[size]();
-  memcpy(undo_copy_, &(segment_->get_base_ptr()[offset_]), size_ * sizeof(char));
+UndoRecord::UndoRecord(RvmSegment* segment, size_t offset, size_t size, bool capture)
+        : segment_(segment), offset_(offset), size_(size), undo_copy_(nullptr), logical_(false) {
+  if (capture) {
+    undo_copy_ = new char[size];
+    memcpy(undo_copy_, &(segment_->get_base_ptr()[offset_]), size_ * sizeof(char));
+  }
 }
 
 UndoRecord::~UndoRecord() {
@@ -26,70 +92,197 @@ void UndoRecord::Rollback() {
 // RedoRecord functions
 ///////////////////////////////////////////////////////////////////////////////
 RedoRecord::RedoRecord(std::string segname, size_t offset, size_t size)
-        : segment_name_(segname), offset_(offset), size_(size) {
+        : segment_name_(segname), offset_(offset), size_(size), arg_(0) {
   type_ = REDO_RECORD;
   data_ = new char[size_]();
 }
 
 RedoRecord::RedoRecord(const UndoRecord* record)
-        : segment_name_(record->get_segment_name()) {
+        : RedoRecord(record, 0, record->get_size()) {
+}
+
+RedoRecord::RedoRecord(const UndoRecord* record, size_t offset, size_t size)
+        : segment_name_(record->get_segment_name()), arg_(0) {
   type_ = REDO_RECORD;
-  size_ = record->get_size();
-  offset_ = record->get_offset();
-  data_ = new char[size_]();
-  memcpy(data_, record->get_segment_base_ptr() + record->get_offset(), size_);
+  size_ = size;
+  offset_ = record->get_offset() + offset;
+  data_ = new char[size_];
+  memcpy(data_, record->get_segment_base_ptr() + offset_, size_);
 }
 
 RedoRecord::RedoRecord(RecordType type, std::string segname)
-        : type_(type), segment_name_(segname) {
+        : type_(type), segment_name_(segname), arg_(0) {
   size_ = 0;
   offset_ = 0;
   data_ = 0;
 }
 
+RedoRecord::RedoRecord(RecordType type, std::string segname, size_t size)
+        : type_(type), segment_name_(segname), size_(size), arg_(0) {
+  offset_ = 0;
+  data_ = 0;
+}
+
+RedoRecord::RedoRecord(RecordType type, std::string segname, size_t offset, size_t size, uint64_t arg,
+                       const char* data)
+        : type_(type), segment_name_(segname), offset_(offset), size_(size), arg_(arg) {
+  data_ = 0;
+  if (data != nullptr) {
+    data_ = new char[size_];
+    memcpy(data_, data, size_);
+  }
+}
+
 RedoRecord::~RedoRecord() {
   if (data_ != nullptr)
     delete[] data_;
 }
 
+void rvm_apply_redo_records(char* base, size_t size, const std::list<RedoRecord*>& records,
+                            std::vector<std::pair<size_t, size_t>>* logical_ranges) {
+  for (RedoRecord* record : records) {
+    size_t offset = record->get_offset();
+    switch (record->get_type()) {
+      case RedoRecord::RESIZE_SEGMENT: {
+        // Anything past a shrunk end of the segment must read back as zeros
+        if (record->get_size() < size) {
+          memset(base + record->get_size(), 0, size - record->get_size());
+        }
+        break;
+      }
+      case RedoRecord::REDO_RECORD:
+      case RedoRecord::ZERO_RANGE: {
+        if (offset >= size) {
+          break;
+        }
+        // Records ending past the end of the segment are cut short
+        size_t copy_size = std::min(record->get_size(), size - offset);
+        if (record->get_type() == RedoRecord::ZERO_RANGE) {
+          memset(base + offset, 0, copy_size);
+        } else {
+          memcpy(base + offset, record->get_data_ptr(), copy_size);
+        }
+        break;
+      }
+      case RedoRecord::ADD_RECORD: {
+        if (offset + sizeof(int64_t) > size) {
+          break;
+        }
+        int64_t value;
+        memcpy(&value, base + offset, sizeof(int64_t));
+        value = (int64_t) ((uint64_t) value + record->get_arg());
+        memcpy(base + offset, &value, sizeof(int64_t));
+        if (logical_ranges != nullptr) {
+          logical_ranges->push_back(std::make_pair(offset, sizeof(int64_t)));
+        }
+        break;
+      }
+      case RedoRecord::SET_BIT_RECORD: {
+        if (offset >= size) {
+          break;
+        }
+        unsigned char mask = (unsigned char) (1 << (record->get_arg() & 0x7));
+        if (record->get_arg() >> 8) {
+          base[offset] |= mask;
+        } else {
+          base[offset] &= ~mask;
+        }
+        if (logical_ranges != nullptr) {
+          logical_ranges->push_back(std::make_pair(offset, (size_t) 1));
+        }
+        break;
+      }
+      case RedoRecord::APPEND_RECORD: {
+        if (offset + RVM_APPEND_HEADER_SIZE > size) {
+          break;
+        }
+        // The used length decides where the data goes, so an append that
+        // did not fit when it was made does not fit now either
+        uint64_t used;
+        memcpy(&used, base + offset, RVM_APPEND_HEADER_SIZE);
+        if (used > record->get_arg() || record->get_size() > record->get_arg() - used) {
+          break;
+        }
+        size_t data_offset = offset + RVM_APPEND_HEADER_SIZE + used;
+        if (data_offset < size) {
+          memcpy(base + data_offset, record->get_data_ptr(), std::min(record->get_size(), size - data_offset));
+        }
+        used += record->get_size();
+        memcpy(base + offset, &used, RVM_APPEND_HEADER_SIZE);
+        if (logical_ranges != nullptr) {
+          logical_ranges->push_back(std::make_pair(offset, (size_t) RVM_APPEND_HEADER_SIZE));
+          logical_ranges->push_back(std::make_pair(data_offset, record->get_size()));
+        }
+        break;
+      }
+      default:
+        break;
+    }
+  }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // RvmSegment functions
 ///////////////////////////////////////////////////////////////////////////////
-RvmSegment::RvmSegment(Rvm* rvm, std::string segname, size_t segsize)
-        : rvm_(rvm), name_(segname), size_(segsize), owned_by_(nullptr) {
+RvmSegment::RvmSegment(Rvm* rvm, std::string segname, size_t segsize, char* fixed_base, bool load)
+        : rvm_(rvm), id_(0), name_(segname), size_(segsize), owned_by_(nullptr), num_sharers_(0), num_readers_(0) {
   path_ = rvm_->construct_segment_path(segname);
-  base_ = new char[size_]();
+  fixed_ = (fixed_base != nullptr);
+  if (fixed_) {
+    // Take over memory already mapped at the recorded address
+    base_ = fixed_base;
+    mmapped_ = true;
+  } else {
+    base_ = allocate_segment_memory(size_, &mmapped_);
+  }
+  if (!load) {
+    return;
+  }
 
   // Map the segment from the disk
-  std::ifstream backing_file(path_, std::ifstream::binary);
-
-  if (backing_file.good()) {
-    // Backing file exists, so read it in
-    backing_file.read(base_, segsize);
-  }
+  RVM_TRACE_BEGIN(rvm_->get_tracer(), map_read);
+  rvm_->ReadBackingStore(name_, base_, size_);
+  RVM_TRACE_END(rvm_->get_tracer(), map_read);
 
   // Apply any changes stored in the redo log
-  std::list<RedoRecord*> redo_records = rvm->GetRedoRecordsForSegment(this);
-  // Go through redo records from oldest to newest
-  // and apply redo records
-  for (RedoRecord* record : redo_records) {
-    size_t offset = record->get_offset();
-    size_t copy_size = record->get_size();
+  // Go through redo records from oldest to newest and apply them
+  RVM_TRACE_BEGIN(rvm_->get_tracer(), map_replay);
+  rvm_apply_redo_records(base_, size_, rvm->GetRedoRecordsForSegment(this));
+  RVM_TRACE_END(rvm_->get_tracer(), map_replay);
+}
+
+RvmSegment::~RvmSegment() {
+  free_segment_memory(base_, size_, mmapped_);
+}
 
-    if ((offset + copy_size) <= size_) {
-      // If redo record end occurs before end of segment
-      memcpy(base_ + offset, record->get_data_ptr(), copy_size);
-    } else if (offset < size_) {
-      // If redo record end occurs after end of segment,
-      // but redo record offset occurs before end of segment
-      memcpy(base_ + offset, record->get_data_ptr(), size_ - offset);
+bool RvmSegment::Resize(size_t new_size) {
+  if (mmapped_ && (fixed_ || new_size >= RVM_MMAP_THRESHOLD)) {
+    // Let the kernel move the pages instead of copying the data,
+    // segments at a fixed address may only grow or shrink in place
+    size_t old_len = round_to_page(size_);
+    size_t new_len = round_to_page(new_size);
+    if (new_len != old_len) {
+      void* base = mremap(base_, old_len, new_len, fixed_ ? 0 : MREMAP_MAYMOVE);
+      if (base == MAP_FAILED) {
+        return false;
+      }
+      base_ = (char*) base;
     }
 
+    if (new_size < size_) {
+      // Clear the old data left in the last page so a later grow sees zeros
+      memset(base_ + new_size, 0, std::min(size_, new_len) - new_size);
+    }
+  } else {
+    bool mmapped;
+    char* base = allocate_segment_memory(new_size, &mmapped);
+    memcpy(base, base_, std::min(size_, new_size));
+    free_segment_memory(base_, size_, mmapped_);
+    base_ = base;
+    mmapped_ = mmapped;
   }
-}
-
-RvmSegment::~RvmSegment() {
-  delete[] base_;
+  size_ = new_size;
+  return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -105,9 +298,15 @@ RvmTransaction::~RvmTransaction() {
     delete record;
   }
   redo_records_.clear();
+
+  for (RedoRecord* record : logical_records_) {
+    delete record;
+  }
+  logical_records_.clear();
 }
 
-void RvmTransaction::AboutToModify(void* segbase, size_t offset, size_t size) {
+bool RvmTransaction::AboutToModify(void* segbase, size_t offset, size_t size, bool wait, bool logical) {
+  rvm_->get_stats().Add(RvmStats::ABOUT_TO_MODIFY_CALLS);
   std::unordered_map<void*, RvmSegment*>::iterator iterator = base_to_segment_map_.find(segbase);
   if (iterator == base_to_segment_map_.end()) {
 #if DEBUG
@@ -124,257 +323,2052 @@ void RvmTransaction::AboutToModify(void* segbase, size_t offset, size_t size) {
     exit(EXIT_FAILURE);
   }
 
-  for (UndoRecord* record : undo_records_) {
+  // Only records taken since the latest savepoint can be reused, since
+  // rolling back to it must restore the bytes as they are now
+  size_t num_since_savepoint = undo_records_.size() - (savepoints_.empty() ? 0 : savepoints_.back().first);
+  std::list<UndoRecord*>::reverse_iterator it = undo_records_.rbegin();
+  for (size_t i = 0; i < num_since_savepoint; i++, ++it) {
+    UndoRecord* record = *it;
     if ((record->get_segment_base_ptr() == (const char*) segbase) &&
         (record->get_offset() == offset) &&
         (record->get_size() == size)) {
       // If we find a matching UndoRecord already, then no need to
-      // create another undo record
-      return;
+      // create another undo record. Bytes the caller changes directly
+      // must be logged, even if logical records changed them before.
+      if (!logical) {
+        record->set_logical(false);
+      }
+      return true;
     }
   }
 
-  UndoRecord* undo_record = new UndoRecord(segment, offset, size);
+  if (is_shared() && !segment->get_range_lock().Lock(id_, offset, size, wait)) {
+    return false;
+  }
+
+  UndoRecord* undo_record = new UndoRecord(segment, offset, size, can_restore() || is_versioned());
+  if (undo_record->get_copy() != nullptr) {
+    rvm_->get_stats().Add(RvmStats::UNDO_BYTES, size);
+  }
+  undo_record->set_logical(logical);
   undo_records_.push_back(undo_record);
+  if (is_versioned()) {
+    // Readers must see the undo copy before the bytes are changed
+    segment->get_versions().Register(undo_record);
+  }
+  return true;
+}
+
+bool RvmTransaction::OverlapsPhysical(void* segbase, size_t offset, size_t size) const {
+  for (UndoRecord* record : undo_records_) {
+    if (!record->is_logical() && (record->get_segment_base_ptr() == (const char*) segbase) &&
+        (record->get_offset() < offset + size) && (offset < record->get_offset() + record->get_size())) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool RvmTransaction::AddInt64(void* segbase, size_t offset, int64_t delta) {
+  // Bytes the caller also changes directly are logged physically, since
+  // replaying the addition on top of them would not give the same sum
+  bool logical = !OverlapsPhysical(segbase, offset, sizeof(int64_t));
+  if (!AboutToModify(segbase, offset, sizeof(int64_t), true, logical)) {
+    return false;
+  }
+
+  char* base = (char*) segbase;
+  int64_t value;
+  memcpy(&value, base + offset, sizeof(int64_t));
+  value = (int64_t) ((uint64_t) value + (uint64_t) delta);
+  memcpy(base + offset, &value, sizeof(int64_t));
+
+  if (!logical) {
+    return true;
+  }
+
+  // Fold the amount into an earlier addition to the same counter, as long
+  // as no other record since the latest savepoint touches it
+  const std::string& segname = base_to_segment_map_[segbase]->get_name();
+  size_t num_since_savepoint = logical_records_.size() - (savepoints_.empty() ? 0 : savepoints_.back().second);
+  std::list<RedoRecord*>::reverse_iterator it = logical_records_.rbegin();
+  for (size_t i = 0; i < num_since_savepoint; i++, ++it) {
+    RedoRecord* record = *it;
+    if (record->get_segment_name() != segname) {
+      continue;
+    }
+    if (record->get_type() == RedoRecord::ADD_RECORD && record->get_offset() == offset) {
+      record->add_to_arg((uint64_t) delta);
+      return true;
+    }
+    size_t start = record->get_offset();
+    size_t end = start + (record->get_type() == RedoRecord::APPEND_RECORD ?
+                          RVM_APPEND_HEADER_SIZE + record->get_arg() : record->get_size());
+    if (start < offset + sizeof(int64_t) && offset < end) {
+      break;
+    }
+  }
+  logical_records_.push_back(new RedoRecord(RedoRecord::ADD_RECORD, segname, offset, sizeof(int64_t),
+                                            (uint64_t) delta));
+  return true;
+}
+
+bool RvmTransaction::SetBit(void* segbase, size_t offset, int bit, bool value) {
+  bool logical = !OverlapsPhysical(segbase, offset, 1);
+  if (!AboutToModify(segbase, offset, 1, true, logical)) {
+    return false;
+  }
+
+  char* base = (char*) segbase;
+  unsigned char mask = (unsigned char) (1 << bit);
+  if (value) {
+    base[offset] |= mask;
+  } else {
+    base[offset] &= ~mask;
+  }
+
+  if (logical) {
+    uint64_t arg = (uint64_t) bit | ((value ? 1ULL : 0ULL) << 8);
+    logical_records_.push_back(new RedoRecord(RedoRecord::SET_BIT_RECORD, base_to_segment_map_[segbase]->get_name(),
+                                              offset, 1, arg));
+  }
+  return true;
+}
+
+long RvmTransaction::Append(void* segbase, size_t offset, size_t capacity, const void* data, size_t size) {
+  std::unordered_map<void*, RvmSegment*>::iterator iterator = base_to_segment_map_.find(segbase);
+  if (iterator == base_to_segment_map_.end()) {
+#if DEBUG
+    std::cerr << "RvmTransaction::Append(): Invalid Segment Base" << std::endl;
+#endif
+    exit(EXIT_FAILURE);
+  }
+  if (iterator->second->get_size() < offset + RVM_APPEND_HEADER_SIZE + capacity) {
+#if DEBUG
+    std::cerr << "RvmTransaction::Append(): Append region outside of segment region" << std::endl;
+#endif
+    exit(EXIT_FAILURE);
+  }
+
+  // The used length may only be read once its range is locked
+  bool logical = !OverlapsPhysical(segbase, offset, RVM_APPEND_HEADER_SIZE);
+  if (!AboutToModify(segbase, offset, RVM_APPEND_HEADER_SIZE, true, logical)) {
+    return -1;
+  }
+
+  char* base = (char*) segbase;
+  uint64_t used;
+  memcpy(&used, base + offset, RVM_APPEND_HEADER_SIZE);
+  if (used > capacity || size > capacity - used) {
+    return -1;
+  }
+
+  size_t data_offset = offset + RVM_APPEND_HEADER_SIZE + used;
+  if (logical && OverlapsPhysical(segbase, data_offset, size)) {
+    // Log the whole append physically, including the new length
+    logical = false;
+    if (!AboutToModify(segbase, offset, RVM_APPEND_HEADER_SIZE)) {
+      return -1;
+    }
+  }
+  if (!AboutToModify(segbase, data_offset, size, true, logical)) {
+    return -1;
+  }
+
+  memcpy(base + data_offset, data, size);
+  used += size;
+  memcpy(base + offset, &used, RVM_APPEND_HEADER_SIZE);
+
+  if (logical) {
+    logical_records_.push_back(new RedoRecord(RedoRecord::APPEND_RECORD, base_to_segment_map_[segbase]->get_name(),
+                                              offset, size, capacity, (const char*) data));
+  }
+  return (long) data_offset;
+}
+
+bool RvmTransaction::AboutToModifyMany(const rvm_range_t* ranges, int count) {
+  // Sort the ranges by segment and offset so that overlapping and
+  // adjacent ranges can be declared as one
+  std::vector<rvm_range_t> sorted(ranges, ranges + count);
+  std::sort(sorted.begin(), sorted.end(), [](const rvm_range_t& a, const rvm_range_t& b) {
+    return (a.segbase != b.segbase) ? (a.segbase < b.segbase) : (a.offset < b.offset);
+  });
+
+  size_t i = 0;
+  while (i < sorted.size()) {
+    void* segbase = sorted[i].segbase;
+    size_t offset = (size_t) sorted[i].offset;
+    size_t end = offset + (size_t) sorted[i].size;
+    for (i++; i < sorted.size() && sorted[i].segbase == segbase && (size_t) sorted[i].offset <= end; i++) {
+      end = std::max(end, (size_t) sorted[i].offset + (size_t) sorted[i].size);
+    }
+    if (!AboutToModify(segbase, offset, end - offset)) {
+      return false;
+    }
+  }
+  return true;
 }
 
 void RvmTransaction::Commit() {
-  // Create a redo record for each undo record and delete
-  // now unneeded undo record
+  // Logical records go first. The physical records that follow hold the
+  // final bytes of their ranges, so replaying them last gives the same
+  // result wherever the two overlap.
+  redo_records_.splice(redo_records_.end(), logical_records_);
+
+  // Create redo records for the bytes of each undo record that changed
+  // since its copy was taken. Equal gaps shorter than a record header are
+  // logged with the bytes around them. Ranges without a copy are logged
+  // whole. Ranges only changed by logical records are not logged again.
+  std::vector<std::pair<size_t, size_t>> ranges;
+  for (UndoRecord* record : undo_records_) {
+    if (record->is_logical()) {
+      continue;
+    }
+    if (record->get_copy() == nullptr) {
+      AddRedoRecords(record, 0, record->get_size());
+      continue;
+    }
+
+    ranges.clear();
+    size_t min_gap = RVM_REDO_HEADER_SIZE + record->get_segment_name().size();
+    rvm_diff_ranges(record->get_copy(), record->get_segment_base_ptr() + record->get_offset(),
+                    record->get_size(), min_gap, ranges);
+    for (const std::pair<size_t, size_t>& range : ranges) {
+      AddRedoRecords(record, range.first, range.second);
+    }
+  }
+
+  // Snapshot readers keep using the undo copies of a versioned
+  // transaction until it is published with its commit sequence number
+  if (!is_versioned()) {
+    for (UndoRecord* record : undo_records_) {
+      delete record;
+    }
+    undo_records_.clear();
+  }
+}
+
+void RvmTransaction::AddRedoRecords(const UndoRecord* record, size_t offset, size_t size) {
+  // Zero runs long enough to pay for splitting the record around them
+  // become ZERO_RANGE records that carry no data
+  std::vector<std::pair<size_t, size_t>> runs;
+  size_t min_run = 2 * (RVM_REDO_HEADER_SIZE + record->get_segment_name().size());
+  rvm_zero_runs(record->get_segment_base_ptr() + record->get_offset() + offset, size, min_run, runs);
+
+  size_t pos = offset;
+  for (const std::pair<size_t, size_t>& run : runs) {
+    size_t run_offset = offset + run.first;
+    if (run_offset > pos) {
+      redo_records_.push_back(new RedoRecord(record, pos, run_offset - pos));
+    }
+    redo_records_.push_back(new RedoRecord(RedoRecord::ZERO_RANGE, record->get_segment_name(),
+                                           record->get_offset() + run_offset, run.second));
+    pos = run_offset + run.second;
+  }
+  if (pos < offset + size) {
+    redo_records_.push_back(new RedoRecord(record, pos, offset + size - pos));
+  }
+}
+
+void RvmTransaction::PublishVersions(uint64_t seq, bool retain) {
   for (UndoRecord* record : undo_records_) {
-    redo_records_.push_back(new RedoRecord(record));
+    RvmSegment* segment = record->get_segment();
+    segment->get_versions().Publish(record, retain ? record->release_copy() : nullptr, seq);
     delete record;
   }
   undo_records_.clear();
-  RemoveSegments();
 }
 
 void RvmTransaction::Abort() {
-  while (!undo_records_.empty()) {
+  RollbackRecords(0, 0);
+  savepoints_.clear();
+}
+
+int RvmTransaction::Savepoint() {
+  savepoints_.push_back(std::make_pair(undo_records_.size(), logical_records_.size()));
+  return (int) savepoints_.size() - 1;
+}
+
+bool RvmTransaction::RollbackTo(int savepoint) {
+  if (savepoint < 0 || (size_t) savepoint >= savepoints_.size()) {
+    return false;
+  }
+
+  // The savepoint stays so it can be rolled back to again
+  RollbackRecords(savepoints_[savepoint].first, savepoints_[savepoint].second);
+  savepoints_.resize(savepoint + 1);
+  return true;
+}
+
+void RvmTransaction::RollbackRecords(size_t keep, size_t keep_logical) {
+  while (logical_records_.size() > keep_logical) {
+    delete logical_records_.back();
+    logical_records_.pop_back();
+  }
+
+  while (undo_records_.size() > keep) {
     UndoRecord* record = undo_records_.back();
     record->Rollback();
+    if (is_versioned()) {
+      record->get_segment()->get_versions().Unregister(record);
+    }
     undo_records_.pop_back();
     delete record;
   }
-  RemoveSegments();
 }
 
 void RvmTransaction::AddSegment(RvmSegment* segment) {
   base_to_segment_map_[segment->get_base_ptr()] = segment;
-  segment->set_owner(this);
+  if (is_read_only()) {
+    segment->add_reader();
+  } else if (is_shared()) {
+    segment->add_sharer();
+  } else {
+    segment->set_owner(this);
+  }
 }
 
 void RvmTransaction::RemoveSegments() {
   for (auto const entry : base_to_segment_map_) {
     RvmSegment* segment = entry.second;
-    assert(segment->get_owner() == this);
-    segment->set_owner(nullptr);
+    if (is_read_only()) {
+      segment->remove_reader();
+    } else if (is_shared()) {
+      segment->get_range_lock().UnlockAll(id_);
+      segment->remove_sharer();
+    } else {
+      assert(segment->get_owner() == this);
+      segment->set_owner(nullptr);
+    }
   }
 }
 
 
-
 ///////////////////////////////////////////////////////////////////////////////
-// Rvm class functions
+// RvmVersionStore functions
 ///////////////////////////////////////////////////////////////////////////////
-Rvm::Rvm(std::string directory) : directory_(directory) {
-  struct stat st;
-  if (stat(directory_.c_str(), &st) == -1) {
-
-    mkdir(directory_.c_str(), 0700);
+RvmVersionStore::~RvmVersionStore() {
+  for (Version& version : committed_) {
+    delete[] version.data;
   }
+}
 
-  // Map the segment from the disk
-  log_path_ = construct_log_path();
-  tmp_log_path_ = construct_tmp_path(log_path_);
+void RvmVersionStore::Register(const UndoRecord* record) {
+  Version version = { record, 0, record->get_offset(), record->get_size(), record->get_copy() };
+  std::lock_guard<std::mutex> lock(mutex_);
+  in_flight_.push_back(version);
+}
 
-  if (!file_exists(log_path_) && file_exists(tmp_log_path_)) {
-    // If log file doesn't exist, but tmp log file does, then move
-    // tmp file over to log file
-    std::rename(tmp_log_path_.c_str(), log_path_.c_str());
+void RvmVersionStore::Unregister(const UndoRecord* record) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (std::list<Version>::iterator it = in_flight_.begin(); it != in_flight_.end(); ++it) {
+    if (it->record == record) {
+      in_flight_.erase(it);
+      return;
+    }
   }
+}
 
-  if (file_exists(log_path_)) {
-    std::ifstream log_file;
-    log_file.open(log_path_, std::ifstream::binary);
-
-    // Parse the log file
-    log_file.seekg(0, log_file.end);
-    long file_size = log_file.tellg();
-    log_file.seekg(0, log_file.beg);
-    while (log_file.good()) {
-
-      if (log_file.tellg() == file_size) {
-        // Reached end of file
-        break;
+void RvmVersionStore::Publish(const UndoRecord* record, char* data, uint64_t seq) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (std::list<Version>::iterator it = in_flight_.begin(); it != in_flight_.end(); ++it) {
+    if (it->record == record) {
+      if (data != nullptr) {
+        Version version = { nullptr, seq, it->offset, it->size, data };
+        committed_.push_back(version);
       }
+      in_flight_.erase(it);
+      return;
+    }
+  }
+  delete[] data;
+}
 
-      RvmTransaction* rvm_trans = ParseTransaction(log_file);
-      if (rvm_trans != nullptr) {
-        committed_transactions_.push_back(rvm_trans);
-      } else {
-        // Failure in parsing log file, re-write the log file
-        // with only transactions that were parsed correctly
-        log_file.close();
+void RvmVersionStore::Prune(uint64_t min_snapshot) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  while (!committed_.empty() && committed_.front().seq <= min_snapshot) {
+    delete[] committed_.front().data;
+    committed_.pop_front();
+  }
+}
 
-        std::ofstream::openmode flags = std::ofstream::out | std::ofstream::binary | std::ofstream::trunc;
-        std::ofstream tmp_log_file(tmp_log_path_, flags);
-        for (RvmTransaction* committed_rvm_trans : committed_transactions_) {
-          WriteTransactionToLog(tmp_log_file, committed_rvm_trans);
-        }
-        tmp_log_file.flush();
+void RvmVersionStore::Read(uint64_t snapshot, const char* base, size_t offset, size_t size, char* dest) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  memcpy(dest, base + offset, size);
+
+  // Overlay pre-images from the newest change back to the oldest, so the
+  // bytes end up as the first change after the snapshot found them.
+  // Uncommitted changes are newer than any commit.
+  size_t end = offset + size;
+  for (std::list<Version>::reverse_iterator it = in_flight_.rbegin(); it != in_flight_.rend(); ++it) {
+    size_t start = std::max(offset, it->offset);
+    size_t stop = std::min(end, it->offset + it->size);
+    if (start < stop) {
+      memcpy(dest + (start - offset), it->data + (start - it->offset), stop - start);
+    }
+  }
+  for (std::list<Version>::reverse_iterator it = committed_.rbegin(); it != committed_.rend() && it->seq > snapshot; ++it) {
+    size_t start = std::max(offset, it->offset);
+    size_t stop = std::min(end, it->offset + it->size);
+    if (start < stop) {
+      memcpy(dest + (start - offset), it->data + (start - it->offset), stop - start);
+    }
+  }
+}
 
-        // Make the temporary log file as the new log file
-        std::remove(log_path_.c_str());
-        std::rename(tmp_log_path_.c_str(), log_path_.c_str());
-        return;
+
+///////////////////////////////////////////////////////////////////////////////
+// RvmRangeLock functions
+///////////////////////////////////////////////////////////////////////////////
+std::mutex RvmRangeLock::waits_mutex_;
+std::unordered_map<trans_t, std::vector<trans_t>> RvmRangeLock::waits_for_;
+
+bool RvmRangeLock::Conflicts(trans_t owner, size_t offset, size_t size, std::vector<trans_t>* holders) const {
+  size_t end = offset + size;
+  // Only ranges starting before the end of the request can overlap it, and
+  // none of those starting max_size_ or more bytes before it reach it
+  std::multimap<size_t, std::pair<size_t, trans_t>>::const_iterator first =
+          (offset < max_size_) ? ranges_.begin() : ranges_.upper_bound(offset - max_size_);
+  std::multimap<size_t, std::pair<size_t, trans_t>>::const_iterator last = ranges_.lower_bound(end);
+  bool conflicts = false;
+  for (std::multimap<size_t, std::pair<size_t, trans_t>>::const_iterator it = first; it != last; ++it) {
+    if (it->second.first > offset && it->second.second != owner) {
+      if (holders == nullptr) {
+        return true;
       }
+      holders->push_back(it->second.second);
+      conflicts = true;
     }
-    log_file.close();
   }
+  return conflicts;
 }
 
-Rvm::~Rvm() {
-  for (RvmTransaction* rvm_trans : committed_transactions_) {
-    delete rvm_trans;
+// Records that owner waits for the holders, unless one of them already
+// waits, directly or through other transactions, for owner
+bool RvmRangeLock::WaitFor(trans_t owner, const std::vector<trans_t>& holders) {
+  std::lock_guard<std::mutex> lock(waits_mutex_);
+  std::unordered_set<trans_t> visited;
+  std::vector<trans_t> stack(holders);
+  while (!stack.empty()) {
+    trans_t tid = stack.back();
+    stack.pop_back();
+    if (tid == owner) {
+      waits_for_.erase(owner);
+      return false;
+    }
+    if (!visited.insert(tid).second) {
+      continue;
+    }
+    std::unordered_map<trans_t, std::vector<trans_t>>::const_iterator it = waits_for_.find(tid);
+    if (it != waits_for_.end()) {
+      stack.insert(stack.end(), it->second.begin(), it->second.end());
+    }
   }
+  waits_for_[owner] = holders;
+  return true;
 }
 
-void* Rvm::MapSegment(std::string segname, size_t segsize) {
-  // Search for a segment with the given name
-  std::unordered_map<std::string, RvmSegment*>::iterator segment = name_to_segment_map_.find(segname);
-  if (segment == name_to_segment_map_.end()) {
-    // Create RvmSegment from backing store
-    RvmSegment* rvm_segment = new RvmSegment(this, segname, segsize);
+void RvmRangeLock::StopWaiting(trans_t owner) {
+  std::lock_guard<std::mutex> lock(waits_mutex_);
+  waits_for_.erase(owner);
+}
 
-    // Insert mappings for the segment
-    name_to_segment_map_[rvm_segment->get_name()] = rvm_segment;
-    base_to_segment_map_[rvm_segment->get_base_ptr()] = rvm_segment;
+bool RvmRangeLock::Lock(trans_t owner, size_t offset, size_t size, bool wait) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (Conflicts(owner, offset, size, nullptr)) {
+    if (!wait) {
+      return false;
+    }
+    // The holders are looked up again after every release, so that the
+    // wait-for edges always name the transactions currently in the way
+    std::vector<trans_t> holders;
+    while (Conflicts(owner, offset, size, &holders)) {
+      if (!WaitFor(owner, holders)) {
+        return false;
+      }
+      released_.wait(lock);
+      holders.clear();
+    }
+    StopWaiting(owner);
+  }
+  ranges_.insert(std::make_pair(offset, std::make_pair(offset + size, owner)));
+  max_size_ = std::max(max_size_, size);
+  return true;
+}
+
+void RvmRangeLock::UnlockAll(trans_t owner) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  bool released = false;
+  for (std::multimap<size_t, std::pair<size_t, trans_t>>::iterator it = ranges_.begin(); it != ranges_.end();) {
+    if (it->second.second == owner) {
+      it = ranges_.erase(it);
+      released = true;
+    } else {
+      ++it;
+    }
+  }
+  if (ranges_.empty()) {
+    max_size_ = 0;
+  }
+  if (released) {
+    released_.notify_all();
+  }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// RvmTransactionTable functions
+///////////////////////////////////////////////////////////////////////////////
+RvmTransactionTable::RvmTransactionTable() : next_slot_(0), free_head_(0) {
+  for (size_t i = 0; i < RVM_TRANS_MAX_SLOTS / RVM_TRANS_SLOT_CHUNK; i++) {
+    chunks_[i].store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+RvmTransactionTable::~RvmTransactionTable() {
+  for (size_t i = 0; i < RVM_TRANS_MAX_SLOTS / RVM_TRANS_SLOT_CHUNK; i++) {
+    delete[] chunks_[i].load(std::memory_order_relaxed);
+  }
+}
+
+uint32_t RvmTransactionTable::AllocateSlot() {
+  // Reuse a released slot first
+  uint64_t head = free_head_.load(std::memory_order_acquire);
+  while ((uint32_t) head != 0) {
+    uint32_t index = (uint32_t) head - 1;
+    uint64_t next = ((head >> 32) + 1) << 32 | get_slot(index)->next_free.load(std::memory_order_relaxed);
+    if (free_head_.compare_exchange_weak(head, next, std::memory_order_acquire)) {
+      return index;
+    }
+  }
+
+  // Otherwise take a slot that was never used
+  uint32_t index = next_slot_.fetch_add(1, std::memory_order_relaxed);
+  if (index >= RVM_TRANS_MAX_SLOTS) {
+    next_slot_.store(RVM_TRANS_MAX_SLOTS, std::memory_order_relaxed);
+    return RVM_TRANS_MAX_SLOTS;
+  }
+
+  std::atomic<Slot*>& chunk = chunks_[index / RVM_TRANS_SLOT_CHUNK];
+  if (chunk.load(std::memory_order_acquire) == nullptr) {
+    Slot* new_chunk = new Slot[RVM_TRANS_SLOT_CHUNK];
+    for (size_t i = 0; i < RVM_TRANS_SLOT_CHUNK; i++) {
+      new_chunk[i].generation.store(1, std::memory_order_relaxed);
+      new_chunk[i].rvm_trans.store(nullptr, std::memory_order_relaxed);
+      new_chunk[i].next_free.store(0, std::memory_order_relaxed);
+    }
+    Slot* expected = nullptr;
+    if (!chunk.compare_exchange_strong(expected, new_chunk, std::memory_order_acq_rel)) {
+      // Another thread installed the chunk first
+      delete[] new_chunk;
+    }
+  }
+  return index;
+}
+
+trans_t RvmTransactionTable::Insert(RvmTransaction* rvm_trans) {
+  uint32_t index = AllocateSlot();
+  if (index >= RVM_TRANS_MAX_SLOTS) {
+    return (trans_t) -1;
+  }
+
+  Slot* slot = get_slot(index);
+  slot->rvm_trans.store(rvm_trans, std::memory_order_release);
+  uint32_t generation = slot->generation.load(std::memory_order_relaxed);
+  return (trans_t) ((generation << RVM_TRANS_SLOT_BITS) | index);
+}
+
+RvmTransaction* RvmTransactionTable::Find(trans_t tid) const {
+  uint32_t handle = (uint32_t) tid;
+  uint32_t generation = handle >> RVM_TRANS_SLOT_BITS;
+  if (tid <= 0 || generation == 0 || generation > RVM_TRANS_MAX_GENERATION) {
+    return nullptr;
+  }
+
+  Slot* slot = get_slot(handle & (RVM_TRANS_MAX_SLOTS - 1));
+  if (slot == nullptr || slot->generation.load(std::memory_order_acquire) != generation) {
+    return nullptr;
+  }
+  RvmTransaction* rvm_trans = slot->rvm_trans.load(std::memory_order_acquire);
+
+  // The slot may have been released and reused since the first check
+  if (slot->generation.load(std::memory_order_acquire) != generation) {
+    return nullptr;
+  }
+  return rvm_trans;
+}
+
+bool RvmTransactionTable::Erase(trans_t tid) {
+  uint32_t handle = (uint32_t) tid;
+  uint32_t index = handle & (RVM_TRANS_MAX_SLOTS - 1);
+  uint32_t generation = handle >> RVM_TRANS_SLOT_BITS;
+  Slot* slot = get_slot(index);
+  if (slot == nullptr) {
+    return false;
+  }
+
+  // Invalidate outstanding handles before the slot can be reused
+  uint32_t next_generation = (generation >= RVM_TRANS_MAX_GENERATION) ? 1 : generation + 1;
+  if (!slot->generation.compare_exchange_strong(generation, next_generation, std::memory_order_acq_rel)) {
+    return false;
+  }
+  slot->rvm_trans.store(nullptr, std::memory_order_release);
+
+  // Push the slot onto the free list
+  uint64_t head = free_head_.load(std::memory_order_relaxed);
+  uint64_t next;
+  do {
+    slot->next_free.store((uint32_t) head, std::memory_order_relaxed);
+    next = ((head >> 32) + 1) << 32 | (index + 1);
+  } while (!free_head_.compare_exchange_weak(head, next, std::memory_order_release, std::memory_order_relaxed));
+  return true;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// RvmHeap functions
+///////////////////////////////////////////////////////////////////////////////
+bool RvmHeap::Modify(const void* field, size_t size) {
+  char* base = segment_->get_base_ptr();
+  return rvm_trans_->AboutToModify(base, (const char*) field - base, size);
+}
+
+RvmHeap::Header* RvmHeap::get_header() {
+  if (segment_->get_size() < sizeof(Header)) {
+    return nullptr;
+  }
+
+  Header* header = (Header*) segment_->get_base_ptr();
+  if (header->magic != RVM_HEAP_MAGIC) {
+    // First allocation from this segment, so lay out an empty heap
+    if (!Modify(header, sizeof(Header))) {
+      return nullptr;
+    }
+    memset(header, 0, sizeof(Header));
+    header->magic = RVM_HEAP_MAGIC;
+    header->top = sizeof(Header);
+  }
+  return header;
+}
+
+void* RvmHeap::Allocate(size_t size) {
+  // Find the smallest size class that fits the request
+  uint64_t size_class = 0;
+  while (((size_t) RVM_HEAP_MIN_BLOCK << size_class) < size) {
+    size_class++;
+    if (size_class == RVM_HEAP_NUM_CLASSES) {
+      return nullptr;
+    }
+  }
+
+  Header* header = get_header();
+  if (header == nullptr) {
+    return nullptr;
+  }
+
+  char* base = segment_->get_base_ptr();
+  BlockHeader* block;
+  if (header->free_lists[size_class] != 0) {
+    // Reuse the first free block of this class
+    block = (BlockHeader*) (base + header->free_lists[size_class]);
+    if (!Modify(&header->free_lists[size_class], sizeof(uint64_t))) {
+      return nullptr;
+    }
+    header->free_lists[size_class] = block->next_free;
+  } else {
+    // Carve a new block off the top of the heap
+    size_t block_size = sizeof(BlockHeader) + ((size_t) RVM_HEAP_MIN_BLOCK << size_class);
+    if (header->top + block_size > segment_->get_size()) {
+      return nullptr;
+    }
+    block = (BlockHeader*) (base + header->top);
+    if (!Modify(&header->top, sizeof(uint64_t))) {
+      return nullptr;
+    }
+    header->top += block_size;
+  }
+
+  // The caller is about to fill in the new object, so declare it as well
+  if (!Modify(block, sizeof(BlockHeader) + size)) {
+    return nullptr;
+  }
+  block->size_class = size_class | RVM_HEAP_ALLOCATED;
+  block->next_free = 0;
+  return block + 1;
+}
+
+bool RvmHeap::IsAllocated(void* ptr) {
+  char* base = segment_->get_base_ptr();
+  Header* header = (Header*) base;
+  if (segment_->get_size() < sizeof(Header) || header->magic != RVM_HEAP_MAGIC) {
+    return false;
+  }
+
+  // Make sure the pointer is the start of a block handed out by Allocate()
+  size_t offset = (char*) ptr - base;
+  if ((char*) ptr < base || offset < sizeof(Header) + sizeof(BlockHeader) || offset >= header->top) {
+    return false;
+  }
+
+  BlockHeader* block = ((BlockHeader*) ptr) - 1;
+  if (!(block->size_class & RVM_HEAP_ALLOCATED)) {
+    return false;
+  }
+  return (block->size_class & ~RVM_HEAP_ALLOCATED) < RVM_HEAP_NUM_CLASSES;
+}
+
+bool RvmHeap::Free(void* ptr) {
+  char* base = segment_->get_base_ptr();
+  Header* header = (Header*) base;
+  BlockHeader* block = ((BlockHeader*) ptr) - 1;
+  uint64_t size_class = block->size_class & ~RVM_HEAP_ALLOCATED;
+
+  // Push the block onto the free list of its class
+  if (!Modify(block, sizeof(BlockHeader)) || !Modify(&header->free_lists[size_class], sizeof(uint64_t))) {
+    return false;
+  }
+  block->size_class = size_class;
+  block->next_free = header->free_lists[size_class];
+  header->free_lists[size_class] = (char*) block - base;
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Rvm class functions
+///////////////////////////////////////////////////////////////////////////////
+Rvm::Rvm(std::string directory)
+        : directory_(directory), log_fd_(-1), log_end_(0), log_alloc_end_(0),
+          direct_log_(false), direct_buf_(nullptr), direct_buf_size_(0), container_(nullptr), snapshots_enabled_(false), commit_seq_(0),
+          log_buffer_limit_(RVM_DEFAULT_LOG_BUFFER_SIZE), compression_(RVM_COMPRESSION_NONE), durable_seq_(0), failed_seq_(0), durable_callback_(nullptr),
+          durable_callback_arg_(nullptr), log_writing_(false), flush_requested_(false), flusher_stop_(false),
+          io_engine_kind_(RVM_IO_ENGINE_AUTO), sync_writes_(false), next_segment_id_(1) {
+  log_io_ = RvmIoEngine::Create(io_engine_kind_);
+  backing_io_ = RvmIoEngine::Create(io_engine_kind_);
+  for (size_t i = 0; i < RVM_MAX_SEGMENT_ID / RVM_SEGMENT_TABLE_CHUNK; i++) {
+    segment_bases_[i].store(nullptr, std::memory_order_relaxed);
+  }
+
+  struct stat st;
+  if (stat(directory_.c_str(), &st) == -1) {
+
+    mkdir(directory_.c_str(), 0700);
+  }
+
+  if (RvmContainer::Exists(directory_)) {
+    // Segments were packed into a container before, keep using it
+    SetOption(RVM_OPT_CONTAINER, 1);
+  }
+
+  segment_meta_path_ = construct_segment_meta_path();
+  LoadSegmentMetadata();
+
+  // Map the segment from the disk
+  log_path_ = construct_log_path();
+  tmp_log_path_ = construct_tmp_path(log_path_);
+
+  if (!file_exists(log_path_) && file_exists(tmp_log_path_)) {
+    // If log file doesn't exist, but tmp log file does, then move
+    // tmp file over to log file
+    std::rename(tmp_log_path_.c_str(), log_path_.c_str());
+  }
+
+  const char* trace_events = getenv(RVM_TRACE_ENV);
+  if (trace_events != nullptr && atol(trace_events) > 0) {
+    tracer_.SetCapacity((size_t) atol(trace_events));
+  }
+
+  uint64_t start = rvm_now_ns();
+  RVM_TRACE_BEGIN(tracer_, recovery);
+  if (file_exists(log_path_)) {
+    std::ifstream log_file;
+    log_file.open(log_path_, std::ifstream::binary);
+
+    // Parse the log file
+    log_file.seekg(0, log_file.end);
+    long file_size = log_file.tellg();
+    log_file.seekg(0, log_file.beg);
+    while (log_file.good()) {
+
+      if (log_file.tellg() == file_size || SkipLogPadding(log_file, file_size)) {
+        // Reached end of file or the unused tail of a preallocated log
+        break;
+      }
+
+      RvmTransaction* rvm_trans = ParseTransaction(log_file);
+      if (rvm_trans != nullptr) {
+        committed_transactions_.push_back(rvm_trans);
+        log_end_ = (uint64_t) log_file.tellg();
+      } else {
+        // Failure in parsing log file, re-write the log file
+        // with only transactions that were parsed correctly
+        log_file.close();
+
+        std::ofstream::openmode flags = std::ofstream::out | std::ofstream::binary | std::ofstream::trunc;
+        std::ofstream tmp_log_file(tmp_log_path_, flags);
+        for (RvmTransaction* committed_rvm_trans : committed_transactions_) {
+          WriteTransactionToLog(tmp_log_file, committed_rvm_trans);
+        }
+        tmp_log_file.flush();
+        log_end_ = (uint64_t) tmp_log_file.tellp();
+
+        // Make the temporary log file as the new log file
+        std::remove(log_path_.c_str());
+        std::rename(tmp_log_path_.c_str(), log_path_.c_str());
+        break;
+      }
+    }
+    log_file.close();
+  }
+  RVM_TRACE_END(tracer_, recovery);
+  stats_.Record(RvmStats::RECOVERY_LATENCY, rvm_now_ns() - start);
+
+  const char* record_path = getenv(RVM_RECORD_ENV);
+  if (record_path != nullptr && record_path[0] != 0 && !g_recording_from_env.exchange(true)) {
+    StartRecording(std::string(record_path));
+  }
+}
+
+Rvm::~Rvm() {
+  if (flusher_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(log_mutex_);
+      flusher_stop_ = true;
+    }
+    flush_cv_.notify_one();
+    flusher_.join();
+  }
+  {
+    std::lock_guard<std::mutex> lock(log_mutex_);
+    FlushLogLocked();
+  }
+  for (RvmTransaction* rvm_trans : committed_transactions_) {
+    delete rvm_trans;
+  }
+  for (size_t i = 0; i < RVM_MAX_SEGMENT_ID / RVM_SEGMENT_TABLE_CHUNK; i++) {
+    delete[] segment_bases_[i].load(std::memory_order_relaxed);
+  }
+  if (log_fd_ != -1) {
+    close(log_fd_);
+  }
+  free(direct_buf_);
+  delete log_io_;
+  delete backing_io_;
+  delete container_;
+}
+
+trans_t Rvm::get_next_transaction_id() {
+  return g_trans_id.fetch_add(1);
+}
+
+void Rvm::GetStats(rvm_stats_t* stats) {
+  stats_.Collect(stats);
+
+  // Memory held by the committed transactions waiting for truncation
+  std::lock_guard<std::mutex> lock(log_mutex_);
+  uint64_t resident = 0;
+  for (RvmTransaction* rvm_trans : committed_transactions_) {
+    resident += sizeof(RvmTransaction);
+    for (RedoRecord* record : rvm_trans->get_redo_records()) {
+      resident += sizeof(RedoRecord) + record->get_segment_name().size();
+      if (record->get_data_ptr() != nullptr) {
+        resident += record->get_size();
+      }
+    }
+  }
+  stats->resident_log_bytes = resident;
+}
+
+int Rvm::SetOption(int option, long value) {
+  std::lock_guard<std::mutex> segment_lock(segment_mutex_);
+  std::lock_guard<std::mutex> log_lock(log_mutex_);
+  switch (option) {
+    case RVM_OPT_CONTAINER: {
+      if (value == 0) {
+        if (container_ != nullptr) {
+#if DEBUG
+          std::cerr << "Rvm::SetOption(): Segments already packed into a container" << std::endl;
+#endif
+          return -1;
+        }
+        return 0;
+      }
+
+      if (container_ == nullptr) {
+        RvmContainer* container = new RvmContainer(directory_);
+        if (!container->Open()) {
+          delete container;
+          return -1;
+        }
+        container_ = container;
+      }
+      return 0;
+    }
+    case RVM_OPT_LOG_BUFFER_SIZE: {
+      if (value <= 0) {
+#if DEBUG
+        std::cerr << "Rvm::SetOption(): Invalid log buffer size " << value << std::endl;
+#endif
+        return -1;
+      }
+      log_buffer_limit_ = (size_t) value;
+      return 0;
+    }
+    case RVM_OPT_IO_ENGINE: {
+      RvmIoEngine* log_io = RvmIoEngine::Create((int) value);
+      RvmIoEngine* backing_io = (log_io != nullptr) ? RvmIoEngine::Create((int) value) : nullptr;
+      if (backing_io == nullptr) {
+        delete log_io;
+        return -1;
+      }
+
+      // The flusher may be writing through the old log engine
+      std::lock_guard<std::mutex> write_lock(log_write_mutex_);
+      delete log_io_;
+      delete backing_io_;
+      log_io_ = log_io;
+      backing_io_ = backing_io;
+      io_engine_kind_ = (int) value;
+      return 0;
+    }
+    case RVM_OPT_COMPRESSION: {
+      // Compressed and plain transactions can be mixed in one log
+      if (value != RVM_COMPRESSION_NONE && value != RVM_COMPRESSION_LZ) {
+#if DEBUG
+        std::cerr << "Rvm::SetOption(): Invalid compression " << value << std::endl;
+#endif
+        return -1;
+      }
+      compression_ = (int) value;
+      return 0;
+    }
+    case RVM_OPT_DIRECT_LOG: {
+      // The log is reopened with the new flags by the next append
+      std::lock_guard<std::mutex> write_lock(log_write_mutex_);
+      if (log_fd_ != -1) {
+        close(log_fd_);
+        log_fd_ = -1;
+      }
+      direct_log_ = (value != 0);
+      return 0;
+    }
+    case RVM_OPT_SYNC: {
+      std::lock_guard<std::mutex> write_lock(log_write_mutex_);
+      sync_writes_ = (value != 0);
+      return 0;
+    }
+    case RVM_OPT_TRACE: {
+      if (value < 0) {
+#if DEBUG
+        std::cerr << "Rvm::SetOption(): Invalid trace capacity " << value << std::endl;
+#endif
+        return -1;
+      }
+      tracer_.SetCapacity((size_t) value);
+      return 0;
+    }
+    case RVM_OPT_SNAPSHOTS: {
+      // Transactions decide whether to keep versions when they begin, so
+      // the mode can only change while none are open
+      for (auto const entry : base_to_segment_map_) {
+        if (entry.second->has_owner()) {
+#if DEBUG
+          std::cerr << "Rvm::SetOption(): Segment " << entry.second->get_name() << " being used by a transaction" << std::endl;
+#endif
+          return -1;
+        }
+      }
+      if (!snapshots_.empty()) {
+#if DEBUG
+        std::cerr << "Rvm::SetOption(): Read-only transactions are still open" << std::endl;
+#endif
+        return -1;
+      }
+      snapshots_enabled_ = (value != 0);
+      return 0;
+    }
+    default: {
+#if DEBUG
+      std::cerr << "Rvm::SetOption(): Invalid option " << option << std::endl;
+#endif
+      return -1;
+    }
+  }
+}
+
+void Rvm::ReadBackingStore(const std::string& segname, char* base, size_t size) {
+  if (container_ != nullptr) {
+    container_->ReadSegment(segname, base, size);
+    return;
+  }
+
+  std::ifstream backing_file(construct_segment_path(segname), std::ifstream::binary);
+  if (backing_file.good()) {
+    // Backing file exists, so read it in
+    backing_file.read(base, size);
+  }
+}
+
+void* Rvm::MapSegment(std::string segname, size_t segsize) {
+  uint64_t start = rvm_now_ns();
+  RVM_TRACE_BEGIN(tracer_, map);
+  void* base;
+  {
+    std::lock_guard<std::mutex> lock(segment_mutex_);
+    base = MapSegmentLocked(segname, segsize, nullptr);
+  }
+  RVM_TRACE_END(tracer_, map);
+  stats_.Record(RvmStats::MAP_LATENCY, rvm_now_ns() - start);
+  return base;
+}
+
+void* Rvm::MapSegmentLocked(std::string segname, size_t segsize, char* fixed_base) {
+  // Search for a segment with the given name
+  std::unordered_map<std::string, RvmSegment*>::iterator segment = name_to_segment_map_.find(segname);
+  if (segment == name_to_segment_map_.end()) {
+    // Create RvmSegment from backing store, the log must not be
+    // truncated while the segment replays it
+    RvmSegment* rvm_segment;
+    {
+      std::lock_guard<std::mutex> lock(log_mutex_);
+      rvm_segment = new RvmSegment(this, segname, segsize, fixed_base);
+    }
+    AddSegmentLocked(rvm_segment);
     return rvm_segment->get_base_ptr();
   } else {
     // Trying to re-map a segment that has already been mapped
 #if DEBUG
-    std::cout << "Rvm::MapSegment(): Segment " << segname << " already mapped." << std::endl;
+    std::cout << "Rvm::MapSegment(): Segment " << segname << " already mapped." << std::endl;
+#endif
+    return (void*) -1;
+  }
+}
+
+void Rvm::AddSegmentLocked(RvmSegment* rvm_segment) {
+  // Insert mappings for the segment
+  name_to_segment_map_[rvm_segment->get_name()] = rvm_segment;
+  base_to_segment_map_[rvm_segment->get_base_ptr()] = rvm_segment;
+
+  // Publish the base of segments that already have a persistent id
+  std::unordered_map<std::string, uint32_t>::iterator id = segment_ids_.find(rvm_segment->get_name());
+  if (id != segment_ids_.end()) {
+    rvm_segment->set_id(id->second);
+    set_segment_base(id->second, rvm_segment->get_base_ptr());
+  }
+}
+
+int Rvm::MapSegments(int count, const char** segnames, const int* sizes, void** segbases) {
+  uint64_t start = rvm_now_ns();
+  std::lock_guard<std::mutex> lock(segment_mutex_);
+  std::unordered_map<std::string, std::list<RedoRecord*>> records;
+  for (int i = 0; i < count; i++) {
+    std::string segname(segnames[i]);
+    if (name_to_segment_map_.find(segname) != name_to_segment_map_.end() || records.count(segname) != 0) {
+      // Trying to re-map a segment that has already been mapped
+#if DEBUG
+      std::cout << "Rvm::MapSegments(): Segment " << segname << " already mapped." << std::endl;
+#endif
+      return -1;
+    }
+    records[segname];
+  }
+
+  // The log must not be truncated while the segments replay it
+  std::lock_guard<std::mutex> log_lock(log_mutex_);
+  std::vector<RvmSegment*> segments;
+  for (int i = 0; i < count; i++) {
+    segments.push_back(new RvmSegment(this, std::string(segnames[i]), (size_t) sizes[i], nullptr, false));
+  }
+
+  // Read all backing files in one submission
+  RVM_TRACE_BEGIN(tracer_, map_read);
+  if (container_ != nullptr) {
+    for (RvmSegment* rvm_segment : segments) {
+      container_->ReadSegment(rvm_segment->get_name(), rvm_segment->get_base_ptr(), rvm_segment->get_size());
+    }
+  } else {
+    std::vector<int> fds;
+    for (RvmSegment* rvm_segment : segments) {
+      int fd = open(rvm_segment->get_path().c_str(), O_RDONLY);
+      if (fd != -1) {
+        backing_io_->QueueRead(fd, rvm_segment->get_base_ptr(), rvm_segment->get_size(), 0);
+        fds.push_back(fd);
+      }
+    }
+    bool success = backing_io_->Submit();
+    for (int fd : fds) {
+      close(fd);
+    }
+    if (!success) {
+#if DEBUG
+      std::cerr << "Rvm::MapSegments(): Error reading backing files" << std::endl;
+#endif
+      for (RvmSegment* rvm_segment : segments) {
+        ReadBackingStore(rvm_segment->get_name(), rvm_segment->get_base_ptr(), rvm_segment->get_size());
+      }
+    }
+  }
+
+  RVM_TRACE_END(tracer_, map_read);
+
+  // Collect the redo records of all segments in one pass over the log
+  RVM_TRACE_BEGIN(tracer_, map_replay);
+  for (RvmTransaction* rvm_trans : committed_transactions_) {
+    for (RedoRecord* record : rvm_trans->get_redo_records()) {
+      std::unordered_map<std::string, std::list<RedoRecord*>>::iterator entry = records.find(record->get_segment_name());
+      if (entry == records.end()) {
+        continue;
+      }
+      if (record->get_type() == RedoRecord::RecordType::DESTROY_SEGMENT) {
+        entry->second.clear();
+      } else {
+        entry->second.push_back(record);
+      }
+    }
+  }
+
+  for (int i = 0; i < count; i++) {
+    RvmSegment* rvm_segment = segments[i];
+    rvm_apply_redo_records(rvm_segment->get_base_ptr(), rvm_segment->get_size(), records[rvm_segment->get_name()]);
+    AddSegmentLocked(rvm_segment);
+    segbases[i] = rvm_segment->get_base_ptr();
+  }
+  RVM_TRACE_END(tracer_, map_replay);
+  stats_.Record(RvmStats::MAP_LATENCY, rvm_now_ns() - start);
+  return 0;
+}
+
+void* Rvm::MapFixedSegment(std::string segname, size_t segsize, void* addr) {
+  uint64_t start = rvm_now_ns();
+  std::lock_guard<std::mutex> lock(segment_mutex_);
+  if (name_to_segment_map_.find(segname) != name_to_segment_map_.end()) {
+    // Trying to re-map a segment that has already been mapped
+#if DEBUG
+    std::cout << "Rvm::MapFixedSegment(): Segment " << segname << " already mapped." << std::endl;
+#endif
+    return (void*) -1;
+  }
+
+  // A segment that was mapped at a fixed address before must return there
+  std::unordered_map<std::string, uint64_t>::iterator recorded = segment_addresses_.find(segname);
+  if (recorded != segment_addresses_.end()) {
+    if (addr != nullptr && addr != (void*) recorded->second) {
+#if DEBUG
+      std::cerr << "Rvm::MapFixedSegment(): Segment " << segname << " is recorded at "
+                << (void*) recorded->second << " not " << addr << std::endl;
+#endif
+      errno = EINVAL;
+      return (void*) -1;
+    }
+    addr = (void*) recorded->second;
+  }
+
+  if (((uintptr_t) addr) % sysconf(_SC_PAGESIZE) != 0) {
+#if DEBUG
+    std::cerr << "Rvm::MapFixedSegment(): Address " << addr << " is not page aligned" << std::endl;
+#endif
+    errno = EINVAL;
+    return (void*) -1;
+  }
+
+  char* base;
+  if (addr == nullptr) {
+    // No address requested yet, so take whatever the kernel hands out
+    base = (char*) mmap(nullptr, round_to_page(segsize), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+      base = nullptr;
+    }
+  } else {
+    base = map_fixed_segment_memory(addr, segsize);
+  }
+
+  if (base == nullptr) {
+#if DEBUG
+    std::cerr << "Rvm::MapFixedSegment(): Address range " << addr << " for segment "
+              << segname << " is not available: " << strerror(errno) << std::endl;
+#endif
+    return (void*) -1;
+  }
+
+  if (recorded == segment_addresses_.end()) {
+    // Record the address before handing it out so pointers to it stay valid
+    uint64_t address = (uint64_t) base;
+    if (!AppendSegmentMetadata(RVM_META_SEGMENT_ADDRESS, segname, &address, sizeof(uint64_t))) {
+      munmap(base, round_to_page(segsize));
+      errno = EIO;
+      return (void*) -1;
+    }
+    segment_addresses_[segname] = address;
+  }
+
+  void* segbase = MapSegmentLocked(segname, segsize, base);
+  stats_.Record(RvmStats::MAP_LATENCY, rvm_now_ns() - start);
+  return segbase;
+}
+
+void Rvm::UnmapSegment(void* segbase) {
+  std::lock_guard<std::mutex> lock(segment_mutex_);
+  // Search for a segment with the given base
+  std::unordered_map<void*, RvmSegment*>::iterator iterator = base_to_segment_map_.find(segbase);
+  if (iterator != base_to_segment_map_.end()) {
+    RvmSegment* rvm_segment = iterator->second;
+    assert(segbase == rvm_segment->get_base_ptr());
+
+    if (rvm_segment->has_owner() || rvm_segment->has_readers()) {
+#if DEBUG
+      if (rvm_segment->get_owner() != nullptr) {
+        std::cerr << "Rvm::UnmapSegment(): Segment " << segbase << " being used by Transaction " << rvm_segment->get_owner()->get_id() << std::endl;
+      } else if (rvm_segment->has_owner()) {
+        std::cerr << "Rvm::UnmapSegment(): Segment " << segbase << " being used by shared transactions" << std::endl;
+      } else {
+        std::cerr << "Rvm::UnmapSegment(): Segment " << segbase << " being read by read-only transactions" << std::endl;
+      }
+#endif
+      exit(EXIT_FAILURE);
+    }
+
+    // Erase the segment from the mapping structures
+    base_to_segment_map_.erase(iterator);
+    name_to_segment_map_.erase(rvm_segment->get_name());
+    if (rvm_segment->get_id() != 0) {
+      set_segment_base(rvm_segment->get_id(), nullptr);
+    }
+    delete rvm_segment;
+  } else {
+    // Error: Segment does not exist
+#if DEBUG
+    std::cerr << "Rvm::UnmapSegment(): Segment " << segbase << " does not exist" << std::endl;
+#endif
+    exit(EXIT_FAILURE);
+  }
+}
+
+void Rvm::DestroySegment(std::string segname) {
+  std::lock_guard<std::mutex> lock(segment_mutex_);
+  // Search for a segment with the given name
+  std::unordered_map<std::string, RvmSegment*>::iterator segment = name_to_segment_map_.find(segname);
+  if (segment == name_to_segment_map_.end()) {
+    // Create a one-off transaction that indicates the segment was destroyed
+    trans_t tid = get_next_transaction_id();
+    // Write to redo log that the segment was destroyed
+    RedoRecord* record = new RedoRecord(RedoRecord::DESTROY_SEGMENT, segname);
+    std::list<RedoRecord*> records;
+    records.push_back(record);
+    RvmTransaction* rvm_trans = new RvmTransaction(tid, this, records);
+    LogTransaction(rvm_trans); // Commit the transaction
+
+    if (segment_addresses_.erase(segname) != 0) {
+      // Forget the fixed address so a new segment can pick its own
+      uint64_t address = 0;
+      AppendSegmentMetadata(RVM_META_SEGMENT_ADDRESS, segname, &address, sizeof(uint64_t));
+    }
+
+    std::lock_guard<std::mutex> log_lock(log_mutex_);
+    std::string segpath = construct_segment_path(segname);
+    if (container_ != nullptr) {
+      // Drop the segment's extent from the container
+      if (!container_->RemoveSegment(segname, sync_writes_)) {
+#if DEBUG
+        std::cerr << "Rvm::DestroySegment(): Error removing segment from container" << std::endl;
+#endif
+      }
+    } else if (file_exists(segpath)) {
+      // Delete the file if it exists
+      if (remove(segpath.c_str()) != 0) {
+#if DEBUG
+        std::cerr << "Rvm::DestroySegment(): Error deleting file" << std::endl;
+#endif
+      }
+    }
+  } else {
+#if DEBUG
+    std::cout << "Rvm::DestroySegment(): Segment " << segname << " already mapped." << std::endl;
+#endif
+    // Trying to destroy a segment that is currently mapped
+    return;
+  }
+}
+
+void* Rvm::ResizeSegment(void* segbase, size_t new_size) {
+  std::lock_guard<std::mutex> lock(segment_mutex_);
+  // Search for a segment with the given base
+  std::unordered_map<void*, RvmSegment*>::iterator iterator = base_to_segment_map_.find(segbase);
+  if (iterator == base_to_segment_map_.end()) {
+#if DEBUG
+    std::cerr << "Rvm::ResizeSegment(): Segment " << segbase << " does not exist" << std::endl;
+#endif
+    return (void*) -1;
+  }
+
+  RvmSegment* rvm_segment = iterator->second;
+  if (rvm_segment->has_owner() || rvm_segment->has_readers()) {
+#if DEBUG
+    std::cerr << "Rvm::ResizeSegment(): Segment " << rvm_segment->get_name() << " being used by another transaction" << std::endl;
+#endif
+    return (void*) -1;
+  }
+
+  if (rvm_segment->get_size() == new_size) {
+    return segbase;
+  }
+
+  if (!rvm_segment->Resize(new_size)) {
+#if DEBUG
+    std::cerr << "Rvm::ResizeSegment(): Failed to resize segment " << rvm_segment->get_name() << std::endl;
+#endif
+    return (void*) -1;
+  }
+
+  // Create a one-off transaction that records the new segment size
+  trans_t tid = get_next_transaction_id();
+  RedoRecord* record = new RedoRecord(RedoRecord::RESIZE_SEGMENT, rvm_segment->get_name(), new_size);
+  std::list<RedoRecord*> records;
+  records.push_back(record);
+  RvmTransaction* rvm_trans = new RvmTransaction(tid, this, records);
+  LogTransaction(rvm_trans); // Commit the transaction
+
+  if (rvm_segment->get_base_ptr() != segbase) {
+    // Segment memory moved, so update the base mapping
+    base_to_segment_map_.erase(iterator);
+    base_to_segment_map_[rvm_segment->get_base_ptr()] = rvm_segment;
+    if (rvm_segment->get_id() != 0) {
+      set_segment_base(rvm_segment->get_id(), rvm_segment->get_base_ptr());
+    }
+  }
+  return rvm_segment->get_base_ptr();
+}
+
+// Locks the merged ranges of writes in ascending order. It never waits
+// while holding a range: on a conflict it releases everything, waits for
+// the busy range alone and starts over. Atomic writes therefore can not
+// deadlock with each other or with shared transactions, whatever order
+// those lock their ranges in.
+static void lock_write_ranges(RvmRangeLock& range_lock, trans_t tid, const rvm_write_t* writes, int count) {
+  std::vector<std::pair<size_t, size_t>> ranges;
+  for (int i = 0; i < count; i++) {
+    ranges.push_back(std::make_pair((size_t) writes[i].offset, (size_t) writes[i].offset + (size_t) writes[i].size));
+  }
+  std::sort(ranges.begin(), ranges.end());
+  std::vector<std::pair<size_t, size_t>> merged;
+  for (const std::pair<size_t, size_t>& range : ranges) {
+    if (!merged.empty() && range.first <= merged.back().second) {
+      merged.back().second = std::max(merged.back().second, range.second);
+    } else {
+      merged.push_back(range);
+    }
+  }
+
+  while (true) {
+    size_t locked = 0;
+    while (locked < merged.size() &&
+           range_lock.Lock(tid, merged[locked].first, merged[locked].second - merged[locked].first, false)) {
+      locked++;
+    }
+    if (locked == merged.size()) {
+      return;
+    }
+    range_lock.UnlockAll(tid);
+    range_lock.Lock(tid, merged[locked].first, merged[locked].second - merged[locked].first, true);
+    range_lock.UnlockAll(tid);
+  }
+}
+
+int Rvm::AtomicWrite(void* segbase, const rvm_write_t* writes, int count) {
+  uint64_t start = rvm_now_ns();
+  trans_t tid = get_next_transaction_id();
+  RvmSegment* rvm_segment;
+  RvmTransaction* rvm_trans = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(segment_mutex_);
+    std::unordered_map<void*, RvmSegment*>::iterator iterator = base_to_segment_map_.find(segbase);
+    if (iterator == base_to_segment_map_.end()) {
+#if DEBUG
+      std::cerr << "Rvm::AtomicWrite(): Segment " << segbase << " does not exist" << std::endl;
+#endif
+      return -1;
+    }
+
+    rvm_segment = iterator->second;
+    if (rvm_segment->get_owner() != nullptr) {
+#if DEBUG
+      std::cerr << "Rvm::AtomicWrite(): Segment " << rvm_segment->get_name() << " being modified by another transaction" << std::endl;
+#endif
+      return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+      if (writes[i].offset < 0 || writes[i].size <= 0 ||
+          rvm_segment->get_size() < (size_t) writes[i].offset + (size_t) writes[i].size) {
+#if DEBUG
+        std::cerr << "Rvm::AtomicWrite(): offset and size outside of segment region" << std::endl;
+#endif
+        return -1;
+      }
+    }
+
+    // The write holds the segment like a shared transaction, so it only
+    // waits for transactions that lock the same ranges
+    if (snapshots_enabled_) {
+      // Snapshot readers need the old bytes, which only a versioned
+      // transaction registers
+      rvm_trans = new RvmTransaction(tid, this, RVM_TRANS_SHARED | RVM_TRANS_NO_RESTORE | RVM_TRANS_VERSIONED);
+      rvm_trans->AddSegment(rvm_segment);
+    } else {
+      rvm_segment->add_sharer();
+    }
+  }
+
+  // All ranges are locked before any byte is copied
+  lock_write_ranges(rvm_segment->get_range_lock(), tid, writes, count);
+  if (rvm_trans != nullptr) {
+    // The ranges are locked by tid already, so these do not wait
+    for (int i = 0; i < count; i++) {
+      rvm_trans->AboutToModify(segbase, (size_t) writes[i].offset, (size_t) writes[i].size);
+      memcpy((char*) segbase + writes[i].offset, writes[i].src, writes[i].size);
+    }
+    rvm_trans->Commit();
+  } else {
+    // Log the new bytes directly, without undo records
+    std::list<RedoRecord*> records;
+    for (int i = 0; i < count; i++) {
+      memcpy((char*) segbase + writes[i].offset, writes[i].src, writes[i].size);
+      records.push_back(new RedoRecord(RedoRecord::REDO_RECORD, rvm_segment->get_name(), (size_t) writes[i].offset,
+                                       (size_t) writes[i].size, 0, (const char*) writes[i].src));
+    }
+    rvm_trans = new RvmTransaction(tid, this, records);
+  }
+  uint64_t ticket = LogTransaction(rvm_trans); // Commit the transaction
+  // Durable on return unless the log write failed, like rvm_commit_trans()
+  bool durable = (ticket == 0 || IsDurable(ticket));
+
+  std::lock_guard<std::mutex> lock(segment_mutex_);
+  rvm_segment->get_range_lock().UnlockAll(tid);
+  rvm_segment->remove_sharer();
+  stats_.Add(RvmStats::COMMITS);
+  stats_.Record(RvmStats::COMMIT_LATENCY, rvm_now_ns() - start);
+  return durable ? 0 : -1;
+}
+
+trans_t Rvm::BeginTransaction(int numsegs, void** segbases, int flags) {
+  if ((flags & ~(RVM_TRANS_SHARED | RVM_TRANS_NO_RESTORE)) != 0) {
+#if DEBUG
+    std::cerr << "Rvm::BeginTransaction(): Invalid flags " << flags << std::endl;
+#endif
+    return (trans_t)-1;
+  }
+
+  std::lock_guard<std::mutex> lock(segment_mutex_);
+  // Check to see that input segment bases are valid
+  for (int i = 0; i < numsegs; i++) {
+    std::unordered_map<void*, RvmSegment*>::iterator iterator = base_to_segment_map_.find(segbases[i]);
+    // Make sure segment exists
+    if (iterator != base_to_segment_map_.end()) {
+      RvmSegment* rvm_segment = iterator->second;
+      // Check if segment is already owned by another transaction. Shared
+      // transactions only exclude transactions that own the whole segment.
+      bool in_use = (flags & RVM_TRANS_SHARED) ? (rvm_segment->get_owner() != nullptr) : rvm_segment->has_owner();
+      if (in_use) {
+#if DEBUG
+        std::cerr << "Rvm::BeginTransaction(): Segment " << rvm_segment->get_name() << " being modified by another transaction" << std::endl;
+#endif
+        return (trans_t)-1;
+      }
+    } else {
+#if DEBUG
+      std::cerr << "Rvm::BeginTransaction(): Segment " << segbases[i] << " does not exist" << std::endl;
+#endif
+      return (trans_t)-1;
+    }
+  }
+
+  // Create the transaction
+  if (snapshots_enabled_) {
+    flags |= RVM_TRANS_VERSIONED;
+  }
+  trans_t tid = get_next_transaction_id();
+  RvmTransaction* rvm_trans = new RvmTransaction(tid, this, flags);
+  trans_t handle = g_trans_table.Insert(rvm_trans);
+  if (handle == (trans_t) -1) {
+#if DEBUG
+    std::cerr << "Rvm::BeginTransaction(): Too many open transactions" << std::endl;
+#endif
+    delete rvm_trans;
+    return (trans_t) -1;
+  }
+  rvm_trans->set_handle(handle);
+  for (int i = 0; i < numsegs; i++) {
+    RvmSegment* rvm_segment = base_to_segment_map_[segbases[i]];
+    rvm_trans->AddSegment(rvm_segment);
+  }
+  return handle;
+}
+
+trans_t Rvm::BeginReadTransaction() {
+  std::lock_guard<std::mutex> segment_lock(segment_mutex_);
+  if (!snapshots_enabled_) {
+#if DEBUG
+    std::cerr << "Rvm::BeginReadTransaction(): Snapshots are not enabled" << std::endl;
+#endif
+    return (trans_t)-1;
+  }
+
+  RvmTransaction* rvm_trans = new RvmTransaction(get_next_transaction_id(), this, RVM_TRANS_READ_ONLY);
+  trans_t handle = g_trans_table.Insert(rvm_trans);
+  if (handle == (trans_t) -1) {
+#if DEBUG
+    std::cerr << "Rvm::BeginReadTransaction(): Too many open transactions" << std::endl;
+#endif
+    delete rvm_trans;
+    return (trans_t) -1;
+  }
+  rvm_trans->set_handle(handle);
+
+  // Read at the last logged commit, which can not publish concurrently
+  std::lock_guard<std::mutex> log_lock(log_mutex_);
+  rvm_trans->set_snapshot(commit_seq_);
+  snapshots_.insert(commit_seq_);
+  return handle;
+}
+
+int Rvm::Read(RvmTransaction* rvm_trans, void* segbase, size_t offset, void* dest, size_t size) {
+  RvmSegment* segment;
+  {
+    std::lock_guard<std::mutex> lock(segment_mutex_);
+    std::unordered_map<void*, RvmSegment*>::iterator iterator = base_to_segment_map_.find(segbase);
+    if (iterator == base_to_segment_map_.end()) {
+#if DEBUG
+      std::cerr << "Rvm::Read(): Segment " << segbase << " does not exist" << std::endl;
+#endif
+      return -1;
+    }
+    segment = iterator->second;
+    // The segment can not be unmapped or moved while the transaction reads it
+    if (rvm_trans->find_segment(segbase) == nullptr) {
+      rvm_trans->AddSegment(segment);
+    }
+  }
+
+  if (segment->get_size() < offset + size) {
+#if DEBUG
+    std::cerr << "Rvm::Read(): offset and size outside of segment region" << std::endl;
 #endif
-    return (void*) -1;
+    return -1;
   }
+
+  segment->get_versions().Read(rvm_trans->get_snapshot(), segment->get_base_ptr(), offset, size, (char*) dest);
+  return 0;
 }
 
-void Rvm::UnmapSegment(void* segbase) {
-  // Search for a segment with the given base
-  std::unordered_map<void*, RvmSegment*>::iterator iterator = base_to_segment_map_.find(segbase);
-  if (iterator != base_to_segment_map_.end()) {
-    RvmSegment* rvm_segment = iterator->second;
-    assert(segbase == rvm_segment->get_base_ptr());
+void Rvm::EndReadTransaction(RvmTransaction* rvm_trans) {
+  g_trans_table.Erase(rvm_trans->get_handle());
+  {
+    std::lock_guard<std::mutex> segment_lock(segment_mutex_);
+    rvm_trans->RemoveSegments();
+    std::lock_guard<std::mutex> log_lock(log_mutex_);
+    snapshots_.erase(snapshots_.find(rvm_trans->get_snapshot()));
+
+    // Versions no remaining reader reads before are not needed anymore
+    uint64_t min_snapshot = snapshots_.empty() ? UINT64_MAX : *snapshots_.begin();
+    for (auto const entry : base_to_segment_map_) {
+      entry.second->get_versions().Prune(min_snapshot);
+    }
+  }
+  delete rvm_trans;
+}
+
+uint64_t Rvm::CommitTransaction(RvmTransaction* rvm_trans, bool flush) {
+  if (rvm_trans->is_read_only()) {
+    EndReadTransaction(rvm_trans);
+    return 0;
+  }
+
+  uint64_t start = rvm_now_ns();
+  RVM_TRACE_BEGIN(tracer_, commit);
+  RVM_TRACE_BEGIN(tracer_, commit_diff);
+  rvm_trans->Commit(); // Commit the rvm_trans
+  RVM_TRACE_END(tracer_, commit_diff);
+
+  // Remove rvm_trans from global table
+  g_trans_table.Erase(rvm_trans->get_handle());
+  trans_t id = rvm_trans->get_id();
+  bool shared = rvm_trans->is_shared();
+
+  // Segments are released only after the log write so that the next
+  // transaction on them is always logged after this one. Once logged,
+  // rvm_trans belongs to the log and may be freed by a truncation.
+  std::vector<RvmSegment*> segments = rvm_trans->get_segments();
+  uint64_t ticket = 0;
+  if (!rvm_trans->get_redo_records().empty()) {
+    ticket = LogTransaction(rvm_trans, flush);
+  } else {
+    delete rvm_trans;
+  }
+
+  RVM_TRACE_BEGIN(tracer_, commit_release);
+  {
+    std::lock_guard<std::mutex> lock(segment_mutex_);
+    for (RvmSegment* segment : segments) {
+      if (shared) {
+        segment->get_range_lock().UnlockAll(id);
+        segment->remove_sharer();
+      } else {
+        segment->set_owner(nullptr);
+      }
+    }
+  }
+  RVM_TRACE_END(tracer_, commit_release);
+  RVM_TRACE_END(tracer_, commit);
+  stats_.Add(RvmStats::COMMITS);
+  stats_.Record(RvmStats::COMMIT_LATENCY, rvm_now_ns() - start);
+  return ticket;
+}
+
+uint64_t Rvm::LogTransaction(RvmTransaction* rvm_trans, bool flush) {
+  std::unique_lock<std::mutex> lock(log_mutex_);
+  uint64_t old_durable_seq = durable_seq_;
+  RVM_TRACE_BEGIN(tracer_, commit_serialize);
+  WriteTransactionToLog(pending_log_, rvm_trans);
+  RVM_TRACE_END(tracer_, commit_serialize);
+  uint64_t redo_bytes = 0;
+  for (RedoRecord* record : rvm_trans->get_redo_records()) {
+    if (record->get_data_ptr() != nullptr) {
+      redo_bytes += record->get_size();
+    }
+  }
+  stats_.Add(RvmStats::REDO_BYTES, redo_bytes);
+
+  // The transaction becomes visible to readers that start from here on.
+  // Open readers still need its undo copies to see the bytes before it.
+  commit_seq_++;
+  if (rvm_trans->is_versioned()) {
+    rvm_trans->PublishVersions(commit_seq_, !snapshots_.empty());
+    if (!snapshots_.empty()) {
+      for (RvmSegment* segment : rvm_trans->get_segments()) {
+        segment->get_versions().Prune(*snapshots_.begin());
+      }
+    }
+  }
+
+  // Add rvm_trans to list of committed transactions
+  committed_transactions_.push_back(rvm_trans);
+  uint64_t ticket = commit_seq_;
+
+  if (flush || (size_t) pending_log_.tellp() >= log_buffer_limit_) {
+    // Group commit: a commit that finds no write in progress writes all of
+    // the buffered entries with one sync, and commits arriving meanwhile
+    // wait for it and then go out together in the next write
+    RVM_TRACE_BEGIN(tracer_, commit_flush);
+    while (ticket > durable_seq_ && ticket > failed_seq_) {
+      if (log_writing_) {
+        durable_cv_.wait(lock);
+        continue;
+      }
+      log_writing_ = true;
+      WritePendingLocked(lock);
+      log_writing_ = false;
+      durable_cv_.notify_all();
+    }
+    RVM_TRACE_END(tracer_, commit_flush);
+  }
+  lock.unlock();
+  NotifyDurable(old_durable_seq);
+  return ticket;
+}
+
+bool Rvm::FlushLogLocked() {
+  bool success = true;
+  {
+    // Waits for a write the flusher has in flight, which comes first
+    std::lock_guard<std::mutex> write_lock(log_write_mutex_);
+    if (pending_log_.tellp() > 0 || !unwritten_log_.empty()) {
+      const std::string& pending = pending_log_.str();
+      RVM_TRACE_BEGIN(tracer_, log_write);
+      success = WriteLog(pending);
+      RVM_TRACE_END(tracer_, log_write);
+      pending_log_.str(std::string());
+    }
+  }
+  if (!success) {
+    // The entries stay in unwritten_log_ for the next flush to retry
+    failed_seq_ = commit_seq_;
+    durable_cv_.notify_all();
+    return false;
+  }
+  PublishDurableLocked(commit_seq_);
+  return true;
+}
+
+// Caller holds log_mutex_ through lock, which is dropped during the write.
+// Taking log_write_mutex_ before dropping it keeps writes in order.
+bool Rvm::WritePendingLocked(std::unique_lock<std::mutex>& lock) {
+  std::string pending = pending_log_.str();
+  pending_log_.str(std::string());
+  uint64_t seq = commit_seq_;
+  std::unique_lock<std::mutex> write_lock(log_write_mutex_);
+  lock.unlock();
+
+  RVM_TRACE_BEGIN(tracer_, log_write);
+  bool success = WriteLog(pending);
+  RVM_TRACE_END(tracer_, log_write);
+  write_lock.unlock();
+
+  lock.lock();
+  if (success) {
+    PublishDurableLocked(seq);
+  } else {
+    // The entries stay in unwritten_log_ for the next write to retry
+    failed_seq_ = std::max(failed_seq_, seq);
+    durable_cv_.notify_all();
+  }
+  return success;
+}
+
+// Caller holds log_write_mutex_
+bool Rvm::WriteLog(const std::string& pending) {
+  if (unwritten_log_.empty()) {
+    if (pending.empty() || AppendToLog(pending.data(), pending.size())) {
+      return true;
+    }
+    unwritten_log_ = pending;
+    return false;
+  }
+  // Appends start at log_end_, which a failed write does not move, so the
+  // retry overwrites whatever part of the entries reached the file
+  unwritten_log_ += pending;
+  if (!AppendToLog(unwritten_log_.data(), unwritten_log_.size())) {
+    return false;
+  }
+  unwritten_log_.clear();
+  return true;
+}
+
+bool Rvm::AppendToLog(const char* data, size_t size) {
+  if (log_fd_ == -1 && !OpenLog()) {
+    return false;
+  }
 
-    if (rvm_segment->has_owner()) {
+  if (direct_log_) {
+    // O_DSYNC makes the write durable on its own
+    uint64_t start;
+    size_t length;
+    if (!StageDirectLogWrite(data, size, &start, &length)) {
+      return false;
+    }
+    log_io_->QueueWrite(log_fd_, direct_buf_, length, start);
+    if (!log_io_->Submit()) {
 #if DEBUG
-      std::cerr << "Rvm::UnmapSegment(): Segment " << segbase << " being used by Transaction " << rvm_segment->get_owner()->get_id() << std::endl;
+      std::cerr << "Rvm::AppendToLog(): Error writing log file" << std::endl;
 #endif
-      exit(EXIT_FAILURE);
+      return false;
     }
+    log_end_ = start + length;
+    stats_.Add(RvmStats::LOG_BYTES_WRITTEN, length);
+    return true;
+  }
 
-    // Erase the segment from the mapping structures
-    base_to_segment_map_.erase(iterator);
-    name_to_segment_map_.erase(rvm_segment->get_name());
-    delete rvm_segment;
+  log_io_->QueueWrite(log_fd_, data, size, log_end_);
+  if (sync_writes_) {
+    log_io_->QueueSync(log_fd_);
+    stats_.Add(RvmStats::SYNCS);
+  }
+  if (!log_io_->Submit()) {
+#if DEBUG
+    std::cerr << "Rvm::AppendToLog(): Error writing log file" << std::endl;
+#endif
+    return false;
+  }
+  log_end_ += size;
+  stats_.Add(RvmStats::LOG_BYTES_WRITTEN, size);
+  return true;
+}
+
+bool Rvm::OpenLog() {
+  // Appends start at log_end_ rather than the end of the file, which may
+  // hold the unused tail of a preallocated log
+  int flags = O_WRONLY | O_CREAT;
+  if (direct_log_) {
+    // The tail block is read back when an append starts inside it
+    flags = O_RDWR | O_CREAT | O_DSYNC;
+    log_fd_ = open(log_path_.c_str(), flags | O_DIRECT, 0666);
+    if (log_fd_ == -1 && errno == EINVAL) {
+      // The file system has no direct I/O, so write through the page cache
+      log_fd_ = open(log_path_.c_str(), flags, 0666);
+    }
   } else {
-    // Error: Segment does not exist
+    log_fd_ = open(log_path_.c_str(), flags, 0666);
+  }
+  if (log_fd_ == -1) {
 #if DEBUG
-    std::cerr << "Rvm::UnmapSegment(): Segment " << segbase << " does not exist" << std::endl;
+    std::cerr << "Rvm::OpenLog(): Error opening log file: " << strerror(errno) << std::endl;
 #endif
-    exit(EXIT_FAILURE);
+    return false;
   }
+
+  struct stat st;
+  log_alloc_end_ = (fstat(log_fd_, &st) == 0) ? (uint64_t) st.st_size : 0;
+  return true;
 }
 
-void Rvm::DestroySegment(std::string segname) {
-  // Search for a segment with the given name
-  std::unordered_map<std::string, RvmSegment*>::iterator segment = name_to_segment_map_.find(segname);
-  if (segment == name_to_segment_map_.end()) {
-    // Create a one-off transaction that indicates the segment was destroyed
-    trans_t tid = get_next_transaction_id();
-    // Write to redo log that the segment was destroyed
-    RedoRecord* record = new RedoRecord(RedoRecord::DESTROY_SEGMENT, segname);
-    std::list<RedoRecord*> records;
-    records.push_back(record);
-    RvmTransaction* rvm_trans = new RvmTransaction(tid, this, records);
-    CommitTransaction(rvm_trans); // Commit the transaction
+bool Rvm::StageDirectLogWrite(const char* data, size_t size, uint64_t* start, size_t* length) {
+  // Start at the block holding log_end_, which is only partly filled
+  // after a truncation or a buffered append
+  uint64_t block_start = log_end_ & ~((uint64_t) RVM_LOG_BLOCK_SIZE - 1);
+  size_t head = (size_t) (log_end_ - block_start);
+
+  // Pad the write out to a block boundary with a padding entry
+  size_t pad_header = sizeof(trans_t) + sizeof(size_t);
+  size_t used = head + size;
+  size_t pad = (RVM_LOG_BLOCK_SIZE - used % RVM_LOG_BLOCK_SIZE) % RVM_LOG_BLOCK_SIZE;
+  if (pad > 0 && pad < pad_header) {
+    pad += RVM_LOG_BLOCK_SIZE;
+  }
+  size_t total = used + pad;
 
-    std::string segpath = construct_segment_path(segname);
-    if (file_exists(segpath)) {
-      // Delete the file if it exists
-      if (remove(segpath.c_str()) != 0) {
+  if (total > direct_buf_size_) {
+    void* buf;
+    if (posix_memalign(&buf, RVM_LOG_BLOCK_SIZE, total) != 0) {
+      return false;
+    }
+    free(direct_buf_);
+    direct_buf_ = (char*) buf;
+    direct_buf_size_ = total;
+  }
+
+  if (head > 0) {
+    memset(direct_buf_, 0, RVM_LOG_BLOCK_SIZE);
+    if (pread(log_fd_, direct_buf_, RVM_LOG_BLOCK_SIZE, block_start) < (ssize_t) head) {
 #if DEBUG
-        std::cerr << "Rvm::DestroySegment(): Error deleting file" << std::endl;
+      std::cerr << "Rvm::StageDirectLogWrite(): Error reading log tail: " << strerror(errno) << std::endl;
 #endif
-      }
+      return false;
     }
-  } else {
+  }
+  memcpy(direct_buf_ + head, data, size);
+  if (pad > 0) {
+    trans_t pad_id = RVM_LOG_PAD_ID;
+    size_t pad_size = pad - pad_header;
+    memcpy(direct_buf_ + used, &pad_id, sizeof(trans_t));
+    memcpy(direct_buf_ + used + sizeof(trans_t), &pad_size, sizeof(size_t));
+    memset(direct_buf_ + used + pad_header, 0, pad_size);
+  }
+
+  if (block_start + total > log_alloc_end_) {
+    // Allocate ahead so that appends do not change the file size. Without
+    // fallocate() support the writes extend the file instead.
+    uint64_t alloc_end = (block_start + total + RVM_LOG_PREALLOC_SIZE - 1) / RVM_LOG_PREALLOC_SIZE * RVM_LOG_PREALLOC_SIZE;
+    if (fallocate(log_fd_, 0, log_alloc_end_, alloc_end - log_alloc_end_) == 0) {
+      log_alloc_end_ = alloc_end;
+    }
+  }
+
+  *start = block_start;
+  *length = total;
+  return true;
+}
+
+void Rvm::PublishDurableLocked(uint64_t seq) {
+  if (seq <= durable_seq_) {
+    return;
+  }
+  durable_seq_ = seq;
+  durable_cv_.notify_all();
+
+  std::list<RvmCommitHandle*>::iterator it = waiting_commits_.begin();
+  while (it != waiting_commits_.end()) {
+    if ((*it)->ticket <= durable_seq_) {
+      CompleteCommitLocked(*it);
+      it = waiting_commits_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void Rvm::CompleteCommitLocked(RvmCommitHandle* handle) {
+  if (handle->event_fd != -1) {
+    uint64_t one = 1;
+    if (write(handle->event_fd, &one, sizeof(uint64_t)) != sizeof(uint64_t)) {
 #if DEBUG
-    std::cout << "Rvm::DestroySegment(): Segment " << segname << " already mapped." << std::endl;
+      std::cerr << "Rvm::CompleteCommitLocked(): Error signaling eventfd" << std::endl;
 #endif
-    // Trying to destroy a segment that is currently mapped
-    return;
+    }
+  }
+  if (handle->callback != nullptr) {
+    handle->callback(handle, handle->callback_arg);
   }
 }
 
-trans_t Rvm::BeginTransaction(int numsegs, void** segbases) {
-  // Check to see that input segment bases are valid
-  for (int i = 0; i < numsegs; i++) {
-    std::unordered_map<void*, RvmSegment*>::iterator iterator = base_to_segment_map_.find(segbases[i]);
-    // Make sure segment exists
-    if (iterator != base_to_segment_map_.end()) {
-      RvmSegment* rvm_segment = iterator->second;
-      // Check if segment is already owned by another transaction
-      if (rvm_segment->has_owner()) {
+void Rvm::FlusherMain() {
+  std::unique_lock<std::mutex> lock(log_mutex_);
+  while (true) {
+    flush_cv_.wait(lock, [this] { return flush_requested_ || flusher_stop_; });
+    if (!flush_requested_) {
+      break;
+    }
+    flush_requested_ = false;
+
+    // Write the buffered entries with only the write lock held
+    uint64_t old_durable_seq = durable_seq_;
+    WritePendingLocked(lock);
+    lock.unlock();
+    NotifyDurable(old_durable_seq);
+    lock.lock();
+  }
+}
+
+RvmCommitHandle* Rvm::CommitTransactionAsync(RvmTransaction* rvm_trans) {
+  uint64_t ticket = CommitTransaction(rvm_trans, false);
+
+  RvmCommitHandle* handle = new RvmCommitHandle();
+  handle->rvm = this;
+  handle->ticket = ticket;
+  handle->callback = nullptr;
+  handle->callback_arg = nullptr;
+  handle->event_fd = -1;
+
+  std::lock_guard<std::mutex> lock(log_mutex_);
+  if (ticket <= durable_seq_) {
+    return handle;
+  }
+
+  if (!flusher_.joinable()) {
+    flusher_ = std::thread(&Rvm::FlusherMain, this);
+  }
+  flush_requested_ = true;
+  flush_cv_.notify_one();
+  return handle;
+}
+
+int Rvm::PollCommit(RvmCommitHandle* handle) {
+  std::lock_guard<std::mutex> lock(log_mutex_);
+  if (handle->ticket <= durable_seq_) {
+    return 1;
+  }
+  return (handle->ticket <= failed_seq_) ? -1 : 0;
+}
+
+// False if the write of the commit's log entry failed. A later flush may
+// still make it durable.
+bool Rvm::WaitCommit(RvmCommitHandle* handle) {
+  std::unique_lock<std::mutex> lock(log_mutex_);
+  durable_cv_.wait(lock, [this, handle] {
+    return handle->ticket <= durable_seq_ || handle->ticket <= failed_seq_;
+  });
+  return handle->ticket <= durable_seq_;
+}
+
+void Rvm::SetCommitCallback(RvmCommitHandle* handle, rvm_commit_callback_t callback, void* arg) {
+  std::lock_guard<std::mutex> lock(log_mutex_);
+  handle->callback = callback;
+  handle->callback_arg = arg;
+  if (handle->ticket <= durable_seq_) {
+    callback(handle, arg);
+  } else if (std::find(waiting_commits_.begin(), waiting_commits_.end(), handle) == waiting_commits_.end()) {
+    waiting_commits_.push_back(handle);
+  }
+}
+
+int Rvm::GetCommitEventFd(RvmCommitHandle* handle) {
+  std::lock_guard<std::mutex> lock(log_mutex_);
+  if (handle->event_fd != -1) {
+    return handle->event_fd;
+  }
+
+  handle->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (handle->event_fd == -1) {
 #if DEBUG
-        std::cerr << "Rvm::BeginTransaction(): Segment " << rvm_segment->get_name() << " being modified by another transaction" << std::endl;
+    std::cerr << "Rvm::GetCommitEventFd(): Error creating eventfd: " << strerror(errno) << std::endl;
 #endif
-        return (trans_t)-1;
-      }
-    } else {
+    return -1;
+  }
+
+  if (handle->ticket <= durable_seq_) {
+    uint64_t one = 1;
+    if (write(handle->event_fd, &one, sizeof(uint64_t)) != sizeof(uint64_t)) {
 #if DEBUG
-      std::cerr << "Rvm::BeginTransaction(): Segment " << segbases[i] << " does not exist" << std::endl;
+      std::cerr << "Rvm::GetCommitEventFd(): Error signaling eventfd" << std::endl;
 #endif
-      return (trans_t)-1;
     }
+  } else if (std::find(waiting_commits_.begin(), waiting_commits_.end(), handle) == waiting_commits_.end()) {
+    waiting_commits_.push_back(handle);
   }
+  return handle->event_fd;
+}
 
-  // Create the transaction
-  trans_t tid = get_next_transaction_id();
-  RvmTransaction* rvm_trans = new RvmTransaction(tid, this);
-  g_trans_map[tid] = rvm_trans;
-  for (int i = 0; i < numsegs; i++) {
-    RvmSegment* rvm_segment = base_to_segment_map_[segbases[i]];
-    rvm_trans->AddSegment(rvm_segment);
+void Rvm::ReleaseCommit(RvmCommitHandle* handle) {
+  {
+    std::lock_guard<std::mutex> lock(log_mutex_);
+    waiting_commits_.remove(handle);
   }
-  return tid;
+  if (handle->event_fd != -1) {
+    close(handle->event_fd);
+  }
+  delete handle;
 }
 
-void Rvm::CommitTransaction(RvmTransaction* rvm_trans) {
-  rvm_trans->Commit(); // Commit the rvm_trans
-  if (!rvm_trans->get_redo_records().empty()) {
-    // Write transactions to file if it has anything to commit
-    std::ofstream::openmode flags = std::ofstream::out | std::ofstream::binary | std::ofstream::app;
-    std::ofstream log_file(log_path_, flags);
-    WriteTransactionToLog(log_file, rvm_trans);
-    log_file.flush();
-    // Add rvm_trans to list of committed transactions
-    committed_transactions_.push_back(rvm_trans);
+void Rvm::NotifyDurable(uint64_t old_durable_seq) {
+  rvm_durable_callback_t callback;
+  void* arg;
+  uint64_t durable_seq;
+  {
+    std::lock_guard<std::mutex> lock(log_mutex_);
+    callback = durable_callback_;
+    arg = durable_callback_arg_;
+    durable_seq = durable_seq_;
+  }
+  if (callback != nullptr && durable_seq > old_durable_seq) {
+    callback(this, (long) durable_seq, arg);
+  }
+}
+
+bool Rvm::Flush() {
+  uint64_t old_durable_seq;
+  bool success;
+  {
+    std::lock_guard<std::mutex> lock(log_mutex_);
+    old_durable_seq = durable_seq_;
+    success = FlushLogLocked();
   }
+  NotifyDurable(old_durable_seq);
+  return success;
+}
+
+bool Rvm::IsDurable(uint64_t ticket) {
+  std::lock_guard<std::mutex> lock(log_mutex_);
+  return ticket <= durable_seq_;
+}
 
-  // Remove rvm_trans from global map
-  g_trans_map.erase(rvm_trans->get_id());
+void Rvm::SetDurableCallback(rvm_durable_callback_t callback, void* arg) {
+  std::lock_guard<std::mutex> lock(log_mutex_);
+  durable_callback_ = callback;
+  durable_callback_arg_ = arg;
 }
 
 void Rvm::AbortTransaction(RvmTransaction* rvm_trans) {
+  if (rvm_trans->is_read_only()) {
+    EndReadTransaction(rvm_trans);
+    return;
+  }
+
   rvm_trans->Abort();
-  // Remove transaction from list and delete
-  g_trans_map.erase(rvm_trans->get_id());
+  stats_.Add(RvmStats::ABORTS);
+  // Remove transaction from table and delete
+  g_trans_table.Erase(rvm_trans->get_handle());
+  {
+    std::lock_guard<std::mutex> lock(segment_mutex_);
+    rvm_trans->RemoveSegments();
+  }
   delete rvm_trans;
 }
 
 void Rvm::TruncateLog() {
+  uint64_t start = rvm_now_ns();
+  RVM_TRACE_BEGIN(tracer_, truncate);
+  std::lock_guard<std::mutex> lock(log_mutex_);
+  // Buffered commits are applied below, so the log must not get them later
+  RVM_TRACE_BEGIN(tracer_, truncate_flush);
+  FlushLogLocked();
+  RVM_TRACE_END(tracer_, truncate_flush);
   std::unordered_map<std::string, std::list<RedoRecord*>> commit_map;
 
   std::list<RedoRecord*> unbacked_records;
@@ -396,10 +2390,40 @@ void Rvm::TruncateLog() {
   }
   committed_transactions_.clear();
 
+  // Logical records change the bytes they are replayed on, so they must
+  // not be replayed on backing files that already hold them. Before any
+  // backing file is written, the log is replaced by one holding the bytes
+  // they fold into, which can be replayed any number of times.
+  bool folded = false;
+  for (auto& pair : commit_map) {
+    if (!pair.second.empty()) {
+      RVM_TRACE_BEGIN(tracer_, apply);
+      folded |= FoldLogicalRecords(pair.first, pair.second);
+      RVM_TRACE_END(tracer_, apply);
+    }
+  }
+  // Appends go to the new log file from here on
+  std::lock_guard<std::mutex> write_lock(log_write_mutex_);
+  if (folded) {
+    RVM_TRACE_BEGIN(tracer_, truncate_rewrite);
+    std::list<RedoRecord*> folded_records;
+    for (auto& pair : commit_map) {
+      folded_records.insert(folded_records.end(), pair.second.begin(), pair.second.end());
+    }
+    RvmTransaction* rvm_trans = new RvmTransaction(get_next_transaction_id(), this, folded_records);
+    ReplaceLog(rvm_trans);
+    // The records stay owned by commit_map
+    rvm_trans->clear_redo_records();
+    delete rvm_trans;
+    RVM_TRACE_END(tracer_, truncate_rewrite);
+  }
+
   // Loop through map and commit logs to backing file
   for (auto& pair : commit_map) {
     if (!pair.second.empty()) {
+      RVM_TRACE_BEGIN(tracer_, apply);
       bool success = ApplyRecordsToBackingFile(pair.first, pair.second);
+      RVM_TRACE_END(tracer_, apply);
       if (!success) {
         // Logs not successfully applied, so save them
         for (RedoRecord* record : pair.second) {
@@ -407,6 +2431,7 @@ void Rvm::TruncateLog() {
         }
       } else {
         // Successfully applied records, so delete them
+        stats_.Add(RvmStats::RECORDS_APPLIED, pair.second.size());
         for (RedoRecord* record : pair.second) {
           delete record;
         }
@@ -414,36 +2439,253 @@ void Rvm::TruncateLog() {
     }
   }
 
-  std::ofstream::openmode flags = std::ofstream::out | std::ofstream::binary | std::ofstream::trunc;
-  std::ofstream log_file(tmp_log_path_, flags);
-  if (!unbacked_records.empty()) {
-    RvmTransaction* rvm_trans = new RvmTransaction(get_next_transaction_id(), this, unbacked_records);
-    WriteTransactionToLog(log_file, rvm_trans);
-    log_file.flush();
-    committed_transactions_.push_back(rvm_trans);
+  RVM_TRACE_BEGIN(tracer_, truncate_rewrite);
+  RvmTransaction* rvm_trans = nullptr;
+  if (!unbacked_records.empty()) {
+    rvm_trans = new RvmTransaction(get_next_transaction_id(), this, unbacked_records);
+    committed_transactions_.push_back(rvm_trans);
+  }
+  ReplaceLog(rvm_trans);
+  // Entries a failed flush left behind are now in the backing files or
+  // the new log, so they must not be appended to it
+  unwritten_log_.clear();
+  PublishDurableLocked(commit_seq_);
+  RVM_TRACE_END(tracer_, truncate_rewrite);
+  RVM_TRACE_END(tracer_, truncate);
+  stats_.Add(RvmStats::TRUNCATIONS);
+  stats_.Record(RvmStats::TRUNCATE_LATENCY, rvm_now_ns() - start);
+}
+
+void Rvm::ReplaceLog(RvmTransaction* rvm_trans) {
+  if (log_fd_ != -1) {
+    close(log_fd_);
+    log_fd_ = -1;
+  }
+
+  std::ofstream::openmode flags = std::ofstream::out | std::ofstream::binary | std::ofstream::trunc;
+  std::ofstream log_file(tmp_log_path_, flags);
+  if (rvm_trans != nullptr) {
+    WriteTransactionToLog(log_file, rvm_trans);
+    log_file.flush();
+  }
+  log_end_ = (uint64_t) log_file.tellp();
+  log_file.close();
+  if (sync_writes_ || direct_log_) {
+    // The new log must be on disk before it replaces the old one
+    int tmp_fd = open(tmp_log_path_.c_str(), O_WRONLY);
+    if (tmp_fd != -1) {
+      log_io_->QueueSync(tmp_fd);
+      log_io_->Submit();
+      stats_.Add(RvmStats::SYNCS);
+      close(tmp_fd);
+    }
+  }
+
+  // Make the temporary log file as the new log file
+  std::remove(log_path_.c_str());
+  std::rename(tmp_log_path_.c_str(), log_path_.c_str());
+}
+
+std::list<RedoRecord*> Rvm::GetRedoRecordsForSegment(RvmSegment* segment) {
+  std::list<RedoRecord*> list;
+  for (RvmTransaction* rvm_trans : committed_transactions_) {
+    for (RedoRecord* record : rvm_trans->get_redo_records()) {
+      if (record->get_segment_name() == segment->get_name()) {
+        if (record->get_type() == RedoRecord::RecordType::DESTROY_SEGMENT) {
+          list.clear();
+        } else {
+          list.push_back(record);
+        }
+      }
+    }
+  }
+  return list;
+}
+
+uint32_t Rvm::GetSegmentId(void* segbase) {
+  std::lock_guard<std::mutex> lock(segment_mutex_);
+  std::unordered_map<void*, RvmSegment*>::iterator iterator = base_to_segment_map_.find(segbase);
+  if (iterator == base_to_segment_map_.end()) {
+#if DEBUG
+    std::cerr << "Rvm::GetSegmentId(): Segment " << segbase << " does not exist" << std::endl;
+#endif
+    return 0;
+  }
+
+  RvmSegment* rvm_segment = iterator->second;
+  if (rvm_segment->get_id() == 0) {
+    // First persistent pointer into this segment, so give it an id
+    uint32_t segid = AssignSegmentId(rvm_segment->get_name());
+    if (segid != 0) {
+      rvm_segment->set_id(segid);
+      set_segment_base(segid, rvm_segment->get_base_ptr());
+    }
+  }
+  return rvm_segment->get_id();
+}
+
+void Rvm::set_segment_base(uint32_t segid, char* base) {
+  std::atomic<char*>* chunk = segment_bases_[segid / RVM_SEGMENT_TABLE_CHUNK].load(std::memory_order_relaxed);
+  if (chunk == nullptr) {
+    if (base == nullptr) {
+      return;
+    }
+    chunk = new std::atomic<char*>[RVM_SEGMENT_TABLE_CHUNK];
+    for (size_t i = 0; i < RVM_SEGMENT_TABLE_CHUNK; i++) {
+      chunk[i].store(nullptr, std::memory_order_relaxed);
+    }
+    segment_bases_[segid / RVM_SEGMENT_TABLE_CHUNK].store(chunk, std::memory_order_release);
+  }
+  chunk[segid % RVM_SEGMENT_TABLE_CHUNK].store(base, std::memory_order_release);
+}
+
+void Rvm::LoadSegmentMetadata() {
+  // Segment metadata format, one entry after another
+  // <int bytes> : Entry type
+  // <size_t bytes = N> : Length of segment name
+  // <N bytes> : Characters making up segment name
+  // <uint32_t bytes> : Segment id (RVM_META_SEGMENT_ID)
+  //   or
+  // <uint64_t bytes> : Fixed segment address, 0 to clear (RVM_META_SEGMENT_ADDRESS)
+  std::ifstream meta_file(segment_meta_path_, std::ifstream::binary);
+  long good_size = 0;
+  while (meta_file.good()) {
+    int type;
+    size_t name_len;
+    meta_file.read((char*)&type, sizeof(int));
+    meta_file.read((char*)&name_len, sizeof(size_t));
+    if (!meta_file.good()) {
+      break;
+    }
+
+    std::string name(name_len, 0);
+    meta_file.read(&name[0], name_len);
+    if (type == RVM_META_SEGMENT_ID) {
+      uint32_t segid;
+      meta_file.read((char*)&segid, sizeof(uint32_t));
+      if (!meta_file.good()) {
+        // Torn entry from a crash while it was being appended
+        break;
+      }
+      segment_ids_[name] = segid;
+      next_segment_id_ = std::max(next_segment_id_, segid + 1);
+    } else if (type == RVM_META_SEGMENT_ADDRESS) {
+      uint64_t address;
+      meta_file.read((char*)&address, sizeof(uint64_t));
+      if (!meta_file.good()) {
+        // Torn entry from a crash while it was being appended
+        break;
+      }
+      if (address != 0) {
+        segment_addresses_[name] = address;
+      } else {
+        segment_addresses_.erase(name);
+      }
+    } else {
+#if DEBUG
+      std::cerr << "Rvm::LoadSegmentMetadata(): Invalid Type " << type << std::endl;
+#endif
+      break;
+    }
+    good_size = meta_file.tellg();
+  }
+  meta_file.close();
+
+  // Drop a torn entry so new entries are appended after the last complete one
+  struct stat st;
+  if (stat(segment_meta_path_.c_str(), &st) == 0 && st.st_size > good_size) {
+    if (truncate(segment_meta_path_.c_str(), good_size) != 0) {
+#if DEBUG
+      std::cerr << "Rvm::LoadSegmentMetadata(): Error truncating segment metadata" << std::endl;
+#endif
+    }
   }
+}
 
-  // Make the temporary log file as the new log file
-  std::remove(log_path_.c_str());
-  std::rename(tmp_log_path_.c_str(), log_path_.c_str());
+uint32_t Rvm::AssignSegmentId(const std::string& segname) {
+  std::unordered_map<std::string, uint32_t>::iterator iterator = segment_ids_.find(segname);
+  if (iterator != segment_ids_.end()) {
+    return iterator->second;
+  }
+
+  // Id 0 is the null segment, so the first id handed out is 1
+  uint32_t segid = next_segment_id_;
+  if (segid >= RVM_MAX_SEGMENT_ID) {
+#if DEBUG
+    std::cerr << "Rvm::AssignSegmentId(): Out of segment ids" << std::endl;
+#endif
+    return 0;
+  }
+
+  if (!AppendSegmentMetadata(RVM_META_SEGMENT_ID, segname, &segid, sizeof(uint32_t))) {
+    return 0;
+  }
+
+  segment_ids_[segname] = segid;
+  next_segment_id_ = segid + 1;
+  return segid;
 }
 
-std::list<RedoRecord*> Rvm::GetRedoRecordsForSegment(RvmSegment* segment) {
-  std::list<RedoRecord*> list;
-  for (RvmTransaction* rvm_trans : committed_transactions_) {
-    for (RedoRecord* record : rvm_trans->get_redo_records()) {
-      if (record->get_segment_name() == segment->get_name()) {
-        if (record->get_type() == RedoRecord::RecordType::DESTROY_SEGMENT) {
-          list.clear();
-        } else {
-          list.push_back(record);
-        }
-      }
-    }
+bool Rvm::AppendSegmentMetadata(int type, const std::string& segname, const void* value, size_t size) {
+  bool created = !file_exists(segment_meta_path_);
+  std::ofstream::openmode flags = std::ofstream::out | std::ofstream::binary | std::ofstream::app;
+  std::ofstream meta_file(segment_meta_path_, flags);
+  size_t name_len = segname.length();
+  meta_file.write((char*)&type, sizeof(int));
+  meta_file.write((char*)&name_len, sizeof(size_t));
+  meta_file.write(segname.c_str(), name_len);
+  meta_file.write((const char*)value, size);
+  meta_file.flush();
+  if (!meta_file.good()) {
+#if DEBUG
+    std::cerr << "Rvm::AppendSegmentMetadata(): Error writing segment metadata" << std::endl;
+#endif
+    return false;
   }
-  return list;
+  meta_file.close();
+
+  bool sync;
+  {
+    std::lock_guard<std::mutex> write_lock(log_write_mutex_);
+    sync = sync_writes_;
+  }
+  // Synced commits may hold pointers that use the entry as soon as it is
+  // handed out, so it must be on disk first
+  if (sync && (!rvm_sync_path(segment_meta_path_) || (created && !rvm_sync_path(directory_)))) {
+#if DEBUG
+    std::cerr << "Rvm::AppendSegmentMetadata(): Error syncing segment metadata" << std::endl;
+#endif
+    return false;
+  }
+  return true;
 }
 
+bool Rvm::SkipLogPadding(std::ifstream& log_file, long file_size) {
+  while (log_file.tellg() < file_size) {
+    long entry_start = log_file.tellg();
+    trans_t trans_id;
+    size_t size;
+    log_file.read((char*)&trans_id, sizeof(trans_t));
+    log_file.read((char*)&size, sizeof(size_t));
+    if (!log_file.good()) {
+      // Too short for an entry, let the parser report it
+      log_file.clear();
+      log_file.seekg(entry_start);
+      return false;
+    }
+
+    if (trans_id == RVM_LOG_PAD_ID && size <= (size_t) (file_size - log_file.tellg())) {
+      log_file.seekg(size, log_file.cur);
+    } else if (size == 0) {
+      // Logged transactions always have records, so this is unused space
+      return true;
+    } else {
+      log_file.seekg(entry_start);
+      return false;
+    }
+  }
+  return true;
+}
 
 RvmTransaction* Rvm::ParseTransaction(std::ifstream& log_file) {
   trans_t trans_id;
@@ -458,9 +2700,46 @@ RvmTransaction* Rvm::ParseTransaction(std::ifstream& log_file) {
     return nullptr;
   }
 
+  // A compressed transaction holds a single COMPRESSED_RECORDS entry
+  // that expands into all of its records
+  std::istringstream expanded;
+  std::istream* record_stream = &log_file;
+  int type = 0;
+  log_file.read((char*)&type, sizeof(int));
+  if (log_file.good() && type == RedoRecord::COMPRESSED_RECORDS) {
+    size_t raw_size = 0;
+    size_t compressed_size = 0;
+    log_file.read((char*)&raw_size, sizeof(size_t));
+    log_file.read((char*)&compressed_size, sizeof(size_t));
+    std::vector<char> compressed;
+    std::string raw;
+    bool valid = log_file.good() && compressed_size < raw_size;
+    if (valid) {
+      compressed.resize(compressed_size);
+      log_file.read(compressed.data(), compressed_size);
+      valid = log_file.good();
+    }
+    if (valid) {
+      raw.resize(raw_size);
+      valid = rvm_decompress(compressed.data(), compressed.size(), &raw[0], raw.size());
+    }
+    if (!valid) {
+#if DEBUG
+      std::cout << "Rvm::ParseTransaction(): Compressed records are corrupt" << std::endl;
+#endif
+      return nullptr;
+    }
+    expanded.str(raw);
+    record_stream = &expanded;
+  } else {
+    // Plain records, so the type is read again with the first one
+    log_file.clear();
+    log_file.seekg(-(long) sizeof(int), log_file.cur);
+  }
+
   std::list<RedoRecord*> records;
   for (size_t i = 0; i < num_records; i++) {
-    RedoRecord* record = ParseRedoRecord(log_file);
+    RedoRecord* record = ParseRedoRecord(*record_stream);
     if (record == nullptr) {
       // If error occurred during parsing, delete
       // any created records and return null ptr
@@ -508,7 +2787,7 @@ RvmTransaction* Rvm::ParseTransaction(std::ifstream& log_file) {
 }
 
 
-RedoRecord* Rvm::ParseRedoRecord(std::ifstream& log_file) {
+RedoRecord* Rvm::ParseRedoRecord(std::istream& log_file) {
   // RedoRecord Format
 
   // <size_t-bytes = N> : Length of segment name
@@ -616,6 +2895,139 @@ RedoRecord* Rvm::ParseRedoRecord(std::ifstream& log_file) {
       delete[] name_buf;
       return record;
     }
+    case RedoRecord::ZERO_RANGE: {
+      char len_buf[sizeof(size_t)]; // Buffer to hold name length, offset and size
+
+      // Read Name length
+      log_file.read(len_buf, sizeof(size_t));
+      size_t name_len = *((size_t*)len_buf);
+      if (!log_file.good()) {
+#if DEBUG
+        std::cout << "Rvm::ParseRedoRecord(): Parse record failed" << std::endl;
+#endif
+        return nullptr;
+      }
+
+      // Read name
+      char* name_buf = new char[name_len + 1](); // +1 so that last byte will be string null-terminator
+      log_file.read(name_buf, sizeof(char) * name_len);
+
+      // Read offset and size of the zeroed range
+      log_file.read(len_buf, sizeof(size_t));
+      size_t offset = *((size_t*)len_buf);
+      log_file.read(len_buf, sizeof(size_t));
+      size_t size = *((size_t*)len_buf);
+      if (!log_file.good()) {
+#if DEBUG
+        std::cout << "Rvm::ParseRedoRecord(): Parse record failed" << std::endl;
+#endif
+        delete[] name_buf;
+        return nullptr;
+      }
+
+      RedoRecord* record = new RedoRecord(RedoRecord::ZERO_RANGE, std::string(name_buf), offset, size);
+      delete[] name_buf;
+      return record;
+    }
+    case RedoRecord::ADD_RECORD:
+    case RedoRecord::SET_BIT_RECORD:
+    case RedoRecord::APPEND_RECORD: {
+      char len_buf[sizeof(size_t)]; // Buffer to hold name length, offset, capacity and size
+
+      // Read Name length
+      log_file.read(len_buf, sizeof(size_t));
+      size_t name_len = *((size_t*)len_buf);
+      if (!log_file.good()) {
+#if DEBUG
+        std::cout << "Rvm::ParseRedoRecord(): Parse record failed" << std::endl;
+#endif
+        return nullptr;
+      }
+
+      // Read name and offset
+      char* name_buf = new char[name_len + 1](); // +1 so that last byte will be string null-terminator
+      log_file.read(name_buf, sizeof(char) * name_len);
+      log_file.read(len_buf, sizeof(size_t));
+      size_t offset = *((size_t*)len_buf);
+      std::string name(name_buf);
+      delete[] name_buf;
+      if (!log_file.good()) {
+#if DEBUG
+        std::cout << "Rvm::ParseRedoRecord(): Parse record failed" << std::endl;
+#endif
+        return nullptr;
+      }
+
+      RedoRecord* record = nullptr;
+      if (type == RedoRecord::ADD_RECORD) {
+        // Read the amount added
+        int64_t delta;
+        log_file.read((char*) &delta, sizeof(int64_t));
+        record = new RedoRecord(RedoRecord::ADD_RECORD, name, offset, sizeof(int64_t), (uint64_t) delta);
+      } else if (type == RedoRecord::SET_BIT_RECORD) {
+        // Read the bit number and its new value
+        uint8_t bit_buf[2];
+        log_file.read((char*) bit_buf, sizeof(bit_buf));
+        uint64_t arg = (uint64_t) (bit_buf[0] & 0x7) | ((uint64_t) (bit_buf[1] != 0) << 8);
+        record = new RedoRecord(RedoRecord::SET_BIT_RECORD, name, offset, 1, arg);
+      } else {
+        // Read capacity of the append region and size of the data
+        log_file.read(len_buf, sizeof(size_t));
+        size_t capacity = *((size_t*)len_buf);
+        log_file.read(len_buf, sizeof(size_t));
+        size_t size = *((size_t*)len_buf);
+        if (!log_file.good() || size > capacity) {
+#if DEBUG
+          std::cout << "Rvm::ParseRedoRecord(): Parse record failed" << std::endl;
+#endif
+          return nullptr;
+        }
+        std::vector<char> data(size);
+        log_file.read(data.data(), size);
+        record = new RedoRecord(RedoRecord::APPEND_RECORD, name, offset, size, capacity, data.data());
+      }
+
+      if (!log_file.good()) {
+#if DEBUG
+        std::cout << "Rvm::ParseRedoRecord(): Parse record failed" << std::endl;
+#endif
+        delete record;
+        return nullptr;
+      }
+      return record;
+    }
+    case RedoRecord::RESIZE_SEGMENT: {
+      char len_buf[sizeof(size_t)]; // Buffer to hold name length and size
+
+      // Read Name length
+      log_file.read(len_buf, sizeof(size_t));
+      size_t name_len = *((size_t*)len_buf);
+      if (!log_file.good()) {
+#if DEBUG
+        std::cout << "Rvm::ParseRedoRecord(): Parse record failed" << std::endl;
+#endif
+        return nullptr;
+      }
+
+      // Read name
+      char* name_buf = new char[name_len + 1](); // +1 so that last byte will be string null-terminator
+      log_file.read(name_buf, sizeof(char) * name_len);
+
+      // Read new segment size
+      log_file.read(len_buf, sizeof(size_t));
+      size_t size = *((size_t*)len_buf);
+      if (!log_file.good()) {
+#if DEBUG
+        std::cout << "Rvm::ParseRedoRecord(): Parse record failed" << std::endl;
+#endif
+        delete[] name_buf;
+        return nullptr;
+      }
+
+      RedoRecord* record = new RedoRecord(RedoRecord::RESIZE_SEGMENT, std::string(name_buf), size);
+      delete[] name_buf;
+      return record;
+    }
     default: {
 #if DEBUG
       std::cerr << "Rvm::ParseRedoRecord: Invalid Type " << type << std::endl;
@@ -626,19 +3038,23 @@ RedoRecord* Rvm::ParseRedoRecord(std::ifstream& log_file) {
   }
 }
 
-void Rvm::WriteTransactionToLog(std::ofstream& log_file, RvmTransaction* rvm_trans) {
+void Rvm::WriteTransactionToLog(std::ostream& log_file, RvmTransaction* rvm_trans) {
   trans_t trans_id = rvm_trans->get_id();
   size_t num_records = rvm_trans->get_redo_records().size();
   log_file.write((char*) &trans_id, sizeof(trans_t));
   log_file.write((char*) &num_records, sizeof(size_t));
 
-  WriteRecordsToLog(log_file, rvm_trans->get_redo_records());
+  if (compression_ == RVM_COMPRESSION_NONE) {
+    WriteRecordsToLog(log_file, rvm_trans->get_redo_records());
+  } else {
+    WriteCompressedRecords(log_file, rvm_trans->get_redo_records());
+  }
 
   log_file.write((char*) &num_records, sizeof(size_t));
   log_file.write((char*) &trans_id, sizeof(trans_t));
 }
 
-void Rvm::WriteRecordsToLog(std::ofstream& log_file, const std::list<RedoRecord*>& records) {
+void Rvm::WriteRecordsToLog(std::ostream& log_file, const std::list<RedoRecord*>& records) {
   for (RedoRecord* record : records) {
     int type = record->get_type();
     log_file.write((char*)&type, sizeof(int));
@@ -666,55 +3082,281 @@ void Rvm::WriteRecordsToLog(std::ofstream& log_file, const std::list<RedoRecord*
         log_file.write(record->get_data_ptr(), size);
         break;
       }
+      case RedoRecord::ZERO_RANGE: {
+        size_t str_len = record->get_segment_name().length();
+        log_file.write((char*)&str_len, sizeof(size_t)); // Write length of string
+        log_file.write(record->get_segment_name().c_str(), str_len); // Write string data
+
+        // Write offset and size of the zeroed range
+        size_t offset = record->get_offset();
+        log_file.write((char*)&offset, sizeof(size_t));
+        size_t size = record->get_size();
+        log_file.write((char*)&size, sizeof(size_t));
+        break;
+      }
+      case RedoRecord::ADD_RECORD:
+      case RedoRecord::SET_BIT_RECORD:
+      case RedoRecord::APPEND_RECORD: {
+        // Logical record Format
+        // <4-byte>: type
+        // <size_t-bytes = N> : Length of segment name
+        // <N-bytes> : Characters making up segment
+        // <size_t-bytes> : Offset
+        // ADD_RECORD: <8-bytes> : Amount added
+        // SET_BIT_RECORD: <1-byte> : Bit number, <1-byte> : New value
+        // APPEND_RECORD: <size_t-bytes> : Capacity, <size_t-bytes = M> : Size of data,
+        //                <M-bytes> : Characters making up data
+        size_t str_len = record->get_segment_name().length();
+        log_file.write((char*)&str_len, sizeof(size_t)); // Write length of string
+        log_file.write(record->get_segment_name().c_str(), str_len); // Write string data
+
+        size_t offset = record->get_offset();
+        log_file.write((char*)&offset, sizeof(size_t));
+        if (type == RedoRecord::ADD_RECORD) {
+          uint64_t delta = record->get_arg();
+          log_file.write((char*)&delta, sizeof(uint64_t));
+        } else if (type == RedoRecord::SET_BIT_RECORD) {
+          uint8_t bit_buf[2] = { (uint8_t) (record->get_arg() & 0x7), (uint8_t) (record->get_arg() >> 8) };
+          log_file.write((char*)bit_buf, sizeof(bit_buf));
+        } else {
+          size_t capacity = record->get_arg();
+          log_file.write((char*)&capacity, sizeof(size_t));
+          size_t size = record->get_size();
+          log_file.write((char*)&size, sizeof(size_t));
+          log_file.write(record->get_data_ptr(), size);
+        }
+        break;
+      }
       case RedoRecord::DESTROY_SEGMENT: {
         size_t str_len = record->get_segment_name().length();
         log_file.write((char*)&str_len, sizeof(size_t)); // Write length of string
         log_file.write(record->get_segment_name().c_str(), str_len); // Write string data
         break;
       }
+      case RedoRecord::RESIZE_SEGMENT: {
+        size_t str_len = record->get_segment_name().length();
+        log_file.write((char*)&str_len, sizeof(size_t)); // Write length of string
+        log_file.write(record->get_segment_name().c_str(), str_len); // Write string data
+
+        // Write new segment size
+        size_t size = record->get_size();
+        log_file.write((char*)&size, sizeof(size_t));
+        break;
+      }
       default: {
 #if DEBUG
-        std::cerr << "Rvm::WriteRecordsToLog: Invalid log type " << type << std::endl;
+        std::cerr << "Rvm::WriteRecordsToLog: Invalid log type " << type << std::endl;
+#endif
+        break;
+      }
+    }
+  }
+}
+
+
+bool Rvm::FoldLogicalRecords(const std::string& segname, std::list<RedoRecord*>& records) {
+  // Find how much of the segment the records reach
+  bool has_logical = false;
+  size_t size = 0;
+  size_t resize = SIZE_MAX; // Size set by the last resize record
+  for (RedoRecord* record : records) {
+    size_t end = record->get_offset() + record->get_size();
+    switch (record->get_type()) {
+      case RedoRecord::RESIZE_SEGMENT:
+        end = resize = record->get_size();
+        break;
+      case RedoRecord::APPEND_RECORD:
+        end = record->get_offset() + RVM_APPEND_HEADER_SIZE + record->get_arg();
+        break;
+      default:
+        break;
+    }
+    has_logical |= record->is_logical();
+    size = std::max(size, end);
+  }
+  if (!has_logical) {
+    return false;
+  }
+
+  // Replay the records on the backing store to get the bytes the logical
+  // records leave behind, which replace them as plain redo records
+  std::vector<char> base(size, 0);
+  ReadBackingStore(segname, base.data(), size);
+  std::vector<std::pair<size_t, size_t>> ranges;
+  rvm_apply_redo_records(base.data(), size, records, &ranges);
+
+  std::list<RedoRecord*>::iterator it = records.begin();
+  while (it != records.end()) {
+    if ((*it)->is_logical()) {
+      delete *it;
+      it = records.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  std::sort(ranges.begin(), ranges.end());
+  size_t i = 0;
+  while (i < ranges.size()) {
+    size_t start = ranges[i].first;
+    size_t end = start + ranges[i].second;
+    for (i++; i < ranges.size() && ranges[i].first <= end; i++) {
+      end = std::max(end, ranges[i].first + ranges[i].second);
+    }
+    // Bytes past the final size of the segment are cut off by the resize
+    end = std::min(end, resize);
+    if (start < end) {
+      RedoRecord* record = new RedoRecord(segname, start, end - start);
+      memcpy(record->get_data_ptr(), base.data() + start, end - start);
+      records.push_back(record);
+    }
+  }
+  return true;
+}
+
+bool Rvm::ZeroBackingRange(int fd, uint64_t file_size, uint64_t offset, uint64_t size) {
+  // Punch the range out of the file so it takes no space, or write the
+  // zeros on file systems without hole punching
+  uint64_t end = offset + size;
+  if (offset < file_size) {
+    uint64_t punch_end = std::min(end, file_size);
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, punch_end - offset) != 0) {
+      std::vector<char> zeros(std::min<uint64_t>(punch_end - offset, RVM_ZERO_CHUNK), 0);
+      for (uint64_t pos = offset; pos < punch_end; pos += zeros.size()) {
+        backing_io_->QueueWrite(fd, zeros.data(), std::min<uint64_t>(punch_end - pos, zeros.size()), pos);
+      }
+      if (!backing_io_->Submit()) {
+        return false;
+      }
+    }
+  }
+
+  // Past the end of the file, growing it leaves a hole
+  if (end > file_size) {
+    return ftruncate(fd, end) == 0;
+  }
+  return true;
+}
+
+void Rvm::WriteCompressedRecords(std::ostream& log_file, const std::list<RedoRecord*>& records) {
+  // CompressedRecords Format
+  // <4-byte>: COMPRESSED_RECORDS type
+  // <size_t-bytes = M> : Size of the records
+  // <size_t-bytes = C> : Size of compressed records
+  // <C-bytes> : Records compressed with rvm_compress()
+  std::ostringstream raw_stream;
+  WriteRecordsToLog(raw_stream, records);
+  const std::string& raw = raw_stream.str();
+
+  // Only keep the compressed records if they are smaller with the header
+  size_t header_size = sizeof(int) + 2 * sizeof(size_t);
+  size_t compressed_size = 0;
+  std::vector<char> compressed;
+  if (raw.size() >= RVM_COMPRESS_MIN_SIZE) {
+    compressed.resize(raw.size() - header_size - 1);
+    compressed_size = rvm_compress(raw.data(), raw.size(), compressed.data(), compressed.size());
+  }
+  if (compressed_size == 0) {
+    log_file.write(raw.data(), raw.size());
+    return;
+  }
+
+  int type = RedoRecord::COMPRESSED_RECORDS;
+  size_t raw_size = raw.size();
+  log_file.write((char*)&type, sizeof(int));
+  log_file.write((char*)&raw_size, sizeof(size_t));
+  log_file.write((char*)&compressed_size, sizeof(size_t));
+  log_file.write(compressed.data(), compressed_size);
+}
+
+bool Rvm::ApplyRecordsToBackingFile(const std::string& segname,
+                                    const std::list<RedoRecord*>& records) {
+  if (container_ != nullptr) {
+    return container_->ApplyRecords(segname, records, sync_writes_);
+  }
+
+  std::string segpath = construct_segment_path(segname);
+  // Open for update so that data not covered by the records is preserved
+  int fd = open(segpath.c_str(), O_RDWR | O_CREAT, 0666);
+  if (fd == -1) {
+#if DEBUG
+    std::cout << "Rvm::ApplyRecordsToBackingFile(): Error opening backing file" << std::endl;
+#endif
+    return false;
+  }
+
+  // Queued writes may land in any order, so a record that overlaps one
+  // already queued waits for the batch before it. Writes past the end of
+  // the file leave a hole that reads back as zeros.
+  std::map<uint64_t, uint64_t> queued; // Start to end of each queued write
+  bool success = true;
+  for (RedoRecord* record : records) {
+    if (record->get_type() == RedoRecord::RecordType::RESIZE_SEGMENT) {
+      struct stat st;
+      success = backing_io_->Submit() && fstat(fd, &st) == 0;
+      queued.clear();
+      if (success && (size_t) st.st_size > record->get_size()) {
+        // Drop any data past the new end of the segment
+        success = (ftruncate(fd, record->get_size()) == 0);
+      }
+      if (!success) {
+#if DEBUG
+        std::cout << "Rvm::ApplyRecordsToBackingFile(): Error truncating backing file" << std::endl;
+#endif
+        break;
+      }
+      continue;
+    }
+
+    if (record->get_type() == RedoRecord::RecordType::ZERO_RANGE) {
+      struct stat st;
+      success = backing_io_->Submit() && fstat(fd, &st) == 0;
+      queued.clear();
+      if (success) {
+        success = ZeroBackingRange(fd, st.st_size, record->get_offset(), record->get_size());
+      }
+      if (!success) {
+#if DEBUG
+        std::cout << "Rvm::ApplyRecordsToBackingFile(): Error zeroing backing file" << std::endl;
 #endif
         break;
       }
+      continue;
     }
-  }
-}
-
-
-bool Rvm::ApplyRecordsToBackingFile(const std::string& segname,
-                                    const std::list<RedoRecord*>& records) {
 
-  std::ofstream backing_file(construct_segment_path(segname), std::ofstream::out | std::ofstream::ate);
-
-  for (RedoRecord* record : records) {
-    backing_file.seekp(0, backing_file.end);
-    size_t file_size = (size_t)backing_file.tellp();
     assert(record->get_type()  == RedoRecord::RecordType::REDO_RECORD);
-    if (file_size < record->get_offset()) {
-      // If the file is smaller than the offset, than pad the file
-      // with zeros till the offset
-      char* pad = new char[record->get_offset() - file_size]();
-      backing_file.write(pad, record->get_offset() - file_size);
-      delete[] pad;
-    } else {
-      // Move to offset position and write data
-      backing_file.seekp(record->get_offset());
+    uint64_t start = record->get_offset();
+    uint64_t end = start + record->get_size();
+    std::map<uint64_t, uint64_t>::iterator next = queued.lower_bound(end);
+    if (next != queued.begin() && (--next)->second > start) {
+      success = backing_io_->Submit();
+      queued.clear();
+      if (!success) {
+        break;
+      }
     }
-    backing_file.write(record->get_data_ptr(), record->get_size());
-    if (!backing_file.good()) {
+    backing_io_->QueueWrite(fd, record->get_data_ptr(), record->get_size(), start);
+    queued[start] = std::max(queued[start], end);
+  }
+  RVM_TRACE_BEGIN(tracer_, apply_submit);
+  if (success && sync_writes_) {
+    backing_io_->QueueSync(fd);
+    stats_.Add(RvmStats::SYNCS);
+  }
+  // Always submit so that nothing is left queued against a closed fd
+  if (!backing_io_->Submit()) {
+    success = false;
+  }
+  RVM_TRACE_END(tracer_, apply_submit);
+  close(fd);
 #if DEBUG
-      std::cout << "Rvm::ApplyRecordsToBackingFile(): Error applying changes to backnig file" << std::endl;
-#endif
-      return false;
-    }
+  if (!success) {
+    std::cout << "Rvm::ApplyRecordsToBackingFile(): Error applying changes to backing file" << std::endl;
   }
-  backing_file.flush();
-  return true;
+#endif
+  return success;
 }
 
-
 ///////////////////////////////////////////////////////////////////////////////
 // Library functions (passthrough calls)
 ///////////////////////////////////////////////////////////////////////////////
@@ -725,6 +3367,7 @@ rvm_t rvm_init(const char* directory) {
 
   // Check if rvm instance for directory has already been made
   std::string dir(directory);
+  std::lock_guard<std::mutex> lock(g_rvm_instances_mutex);
   std::unordered_map<std::string, Rvm*>::iterator it = g_rvm_instances.find(dir);
   if (it == g_rvm_instances.end()) {
     // Create new instance
@@ -753,22 +3396,134 @@ void* rvm_map(rvm_t rvm, const char* segname, int size_to_create) {
 #endif
     return (void*) -1;
   }
-  return rvm->MapSegment(name, (size_t) size_to_create);
+  void* segbase = rvm->MapSegment(name, (size_t) size_to_create);
+  if (segbase != (void*) -1 && segbase != nullptr) {
+    rvm->get_recorder().RecordMap(segbase, name, (size_t) size_to_create);
+  }
+  return segbase;
+}
+
+void* rvm_map_fixed(rvm_t rvm, const char* segname, int size_to_create, void* addr) {
+  std::string name(segname);
+  if (name.empty()) {
+#if DEBUG
+    std::cout << "rvm_map_fixed(): Invalid segment name" << std::endl;
+#endif
+    return (void*) -1;
+  }
+
+  if (size_to_create <= 0) {
+#if DEBUG
+    std::cout << "rvm_map_fixed(): Invalid size to create" << std::endl;
+#endif
+    return (void*) -1;
+  }
+  void* segbase = rvm->MapFixedSegment(name, (size_t) size_to_create, addr);
+  if (segbase != (void*) -1 && segbase != nullptr) {
+    rvm->get_recorder().RecordMap(segbase, name, (size_t) size_to_create);
+  }
+  return segbase;
+}
+
+int rvm_map_many(rvm_t rvm, int count, const char** segnames, const int* sizes, void** segbases) {
+  for (int i = 0; i < count; i++) {
+    if (segnames[i] == nullptr || segnames[i][0] == 0 || sizes[i] <= 0) {
+#if DEBUG
+      std::cout << "rvm_map_many(): Invalid segment name or size to create" << std::endl;
+#endif
+      return -1;
+    }
+  }
+  if (rvm->MapSegments(count, segnames, sizes, segbases) != 0) {
+    return -1;
+  }
+  for (int i = 0; i < count; i++) {
+    rvm->get_recorder().RecordMap(segbases[i], std::string(segnames[i]), (size_t) sizes[i]);
+  }
+  return 0;
 }
 
 void rvm_unmap(rvm_t rvm, void* segbase) {
+  rvm->get_recorder().RecordUnmap(segbase);
   rvm->UnmapSegment(segbase);
 }
 
 void rvm_destroy(rvm_t rvm, const char* segname) {
+  rvm->get_recorder().RecordDestroy(std::string(segname));
   rvm->DestroySegment(std::string(segname));
 }
 
+void* rvm_resize(rvm_t rvm, void* segbase, int new_size) {
+  if (new_size <= 0) {
+#if DEBUG
+    std::cout << "rvm_resize(): Invalid size " << new_size << std::endl;
+#endif
+    return (void*) -1;
+  }
+  void* new_segbase = rvm->ResizeSegment(segbase, (size_t) new_size);
+  if (new_segbase != (void*) -1 && new_segbase != nullptr) {
+    rvm->get_recorder().RecordResize(segbase, new_segbase, (size_t) new_size);
+  }
+  return new_segbase;
+}
+
+int rvm_atomic_write(rvm_t rvm, void* segbase, int offset, const void* src, int size) {
+  rvm_write_t write = { offset, src, size };
+  rvm->get_recorder().RecordAtomicWrite(segbase, &write, 1);
+  return rvm->AtomicWrite(segbase, &write, 1);
+}
+
+int rvm_atomic_writev(rvm_t rvm, void* segbase, const rvm_write_t* writes, int count) {
+  if (count <= 0) {
+#if DEBUG
+    std::cout << "rvm_atomic_writev(): Invalid count " << count << std::endl;
+#endif
+    return -1;
+  }
+  rvm->get_recorder().RecordAtomicWrite(segbase, writes, count);
+  return rvm->AtomicWrite(segbase, writes, count);
+}
+
 trans_t rvm_begin_trans(rvm_t rvm, int numsegs, void** segbases) {
-  return rvm->BeginTransaction(numsegs, segbases);
+  trans_t tid = rvm->BeginTransaction(numsegs, segbases, 0);
+  if (tid != (trans_t) -1) {
+    rvm->get_recorder().RecordBegin(tid, numsegs, segbases, 0);
+  }
+  return tid;
+}
+
+trans_t rvm_begin_trans_flags(rvm_t rvm, int numsegs, void** segbases, int flags) {
+  trans_t tid = rvm->BeginTransaction(numsegs, segbases, flags);
+  if (tid != (trans_t) -1) {
+    rvm->get_recorder().RecordBegin(tid, numsegs, segbases, flags);
+  }
+  return tid;
+}
+
+trans_t rvm_begin_read_trans(rvm_t rvm) {
+  rvm->get_recorder().RecordUnsupported("rvm_begin_read_trans");
+  return rvm->BeginReadTransaction();
+}
+
+int rvm_read(trans_t tid, void* segbase, int offset, void* dest, int size) {
+  if (size <= 0 || offset < 0) {
+#if DEBUG
+    std::cerr << "rvm_read(): Invalid offset " << offset << " or size " << size << std::endl;
+#endif
+    return -1;
+  }
+
+  RvmTransaction* rvm_trans = g_trans_table.Find(tid);
+  if (rvm_trans == nullptr || !rvm_trans->is_read_only()) {
+#if DEBUG
+    std::cerr << "rvm_read(): Invalid Read Transaction " << tid << std::endl;
+#endif
+    exit(EXIT_FAILURE);
+  }
+  return rvm_trans->get_rvm()->Read(rvm_trans, segbase, (size_t) offset, dest, (size_t) size);
 }
 
-void rvm_about_to_modify(trans_t tid, void* segbase, int offset, int size) {
+int rvm_about_to_modify(trans_t tid, void* segbase, int offset, int size) {
   if (size <= 0) {
 #if DEBUG
     std::cerr << "rvm_about_to_modify(): Negative size inputted" << size  << std::endl;
@@ -783,10 +3538,10 @@ void rvm_about_to_modify(trans_t tid, void* segbase, int offset, int size) {
     exit(EXIT_FAILURE);
   }
 
-  std::unordered_map<trans_t, RvmTransaction*>::iterator iter = g_trans_map.find(tid);
-  if (iter != g_trans_map.end()) {
-    RvmTransaction* rvm_trans = iter->second;
-    rvm_trans->AboutToModify(segbase, (size_t) offset, (size_t) size);
+  RvmTransaction* rvm_trans = g_trans_table.Find(tid);
+  if (rvm_trans != nullptr) {
+    rvm_trans->get_rvm()->get_recorder().RecordAboutToModify(RvmRecorder::ABOUT_TO_MODIFY, tid, segbase, offset, size);
+    return rvm_trans->AboutToModify(segbase, (size_t) offset, (size_t) size) ? 0 : -1;
   } else {
 #if DEBUG
     std::cerr << "rvm_about_to_modify(): Invalid Transaction " << tid << std::endl;
@@ -795,11 +3550,130 @@ void rvm_about_to_modify(trans_t tid, void* segbase, int offset, int size) {
   }
 }
 
-void rvm_commit_trans(trans_t tid) {
-  std::unordered_map<trans_t, RvmTransaction*>::iterator iter = g_trans_map.find(tid);
-  if (iter != g_trans_map.end()) {
-    RvmTransaction* rvm_trans = iter->second;
-    rvm_trans->get_rvm()->CommitTransaction(rvm_trans);
+int rvm_about_to_modify_v(trans_t tid, const rvm_range_t* ranges, int count) {
+  if (count < 0) {
+#if DEBUG
+    std::cerr << "rvm_about_to_modify_v(): Negative count inputted " << count << std::endl;
+#endif
+    exit(EXIT_FAILURE);
+  }
+  for (int i = 0; i < count; i++) {
+    if (ranges[i].size <= 0 || ranges[i].offset < 0) {
+#if DEBUG
+      std::cerr << "rvm_about_to_modify_v(): Invalid range " << ranges[i].offset << " " << ranges[i].size << std::endl;
+#endif
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  RvmTransaction* rvm_trans = g_trans_table.Find(tid);
+  if (rvm_trans != nullptr) {
+    rvm_trans->get_rvm()->get_recorder().RecordAboutToModifyMany(tid, ranges, count);
+    return rvm_trans->AboutToModifyMany(ranges, count) ? 0 : -1;
+  } else {
+#if DEBUG
+    std::cerr << "rvm_about_to_modify_v(): Invalid Transaction " << tid << std::endl;
+#endif
+    exit(EXIT_FAILURE);
+  }
+}
+
+int rvm_try_about_to_modify(trans_t tid, void* segbase, int offset, int size) {
+  if (size <= 0) {
+#if DEBUG
+    std::cerr << "rvm_try_about_to_modify(): Negative size inputted" << size  << std::endl;
+#endif
+    exit(EXIT_FAILURE);
+  }
+
+  if (offset < 0) {
+#if DEBUG
+    std::cerr << "rvm_try_about_to_modify(): Negative offset inputted" << size  << std::endl;
+#endif
+    exit(EXIT_FAILURE);
+  }
+
+  RvmTransaction* rvm_trans = g_trans_table.Find(tid);
+  if (rvm_trans != nullptr) {
+    rvm_trans->get_rvm()->get_recorder().RecordAboutToModify(RvmRecorder::TRY_ABOUT_TO_MODIFY, tid, segbase, offset,
+                                                              size);
+    return rvm_trans->AboutToModify(segbase, (size_t) offset, (size_t) size, false) ? 0 : -1;
+  } else {
+#if DEBUG
+    std::cerr << "rvm_try_about_to_modify(): Invalid Transaction " << tid << std::endl;
+#endif
+    exit(EXIT_FAILURE);
+  }
+}
+
+int rvm_add_int64(trans_t tid, void* segbase, int offset, long long delta) {
+  if (offset < 0) {
+#if DEBUG
+    std::cerr << "rvm_add_int64(): Negative offset inputted" << offset << std::endl;
+#endif
+    exit(EXIT_FAILURE);
+  }
+
+  RvmTransaction* rvm_trans = g_trans_table.Find(tid);
+  if (rvm_trans != nullptr) {
+    rvm_trans->get_rvm()->get_recorder().RecordAddInt64(tid, segbase, offset, (int64_t) delta);
+    return rvm_trans->AddInt64(segbase, (size_t) offset, (int64_t) delta) ? 0 : -1;
+  } else {
+#if DEBUG
+    std::cerr << "rvm_add_int64(): Invalid Transaction " << tid << std::endl;
+#endif
+    exit(EXIT_FAILURE);
+  }
+}
+
+int rvm_set_bit(trans_t tid, void* segbase, int offset, int bit, int value) {
+  if (offset < 0 || bit < 0 || bit > 7) {
+#if DEBUG
+    std::cerr << "rvm_set_bit(): Invalid offset or bit inputted " << offset << " " << bit << std::endl;
+#endif
+    exit(EXIT_FAILURE);
+  }
+
+  RvmTransaction* rvm_trans = g_trans_table.Find(tid);
+  if (rvm_trans != nullptr) {
+    rvm_trans->get_rvm()->get_recorder().RecordSetBit(tid, segbase, offset, bit, value);
+    return rvm_trans->SetBit(segbase, (size_t) offset, bit, value != 0) ? 0 : -1;
+  } else {
+#if DEBUG
+    std::cerr << "rvm_set_bit(): Invalid Transaction " << tid << std::endl;
+#endif
+    exit(EXIT_FAILURE);
+  }
+}
+
+int rvm_append(trans_t tid, void* segbase, int offset, int capacity, const void* data, int size) {
+  if (offset < 0 || capacity < 0 || size <= 0 || data == nullptr) {
+#if DEBUG
+    std::cerr << "rvm_append(): Invalid offset, capacity or data inputted" << std::endl;
+#endif
+    exit(EXIT_FAILURE);
+  }
+
+  RvmTransaction* rvm_trans = g_trans_table.Find(tid);
+  if (rvm_trans != nullptr) {
+    rvm_trans->get_rvm()->get_recorder().RecordAppend(tid, segbase, offset, capacity, size);
+    return (int) rvm_trans->Append(segbase, (size_t) offset, (size_t) capacity, data, (size_t) size);
+  } else {
+#if DEBUG
+    std::cerr << "rvm_append(): Invalid Transaction " << tid << std::endl;
+#endif
+    exit(EXIT_FAILURE);
+  }
+}
+
+int rvm_commit_trans(trans_t tid) {
+  RvmTransaction* rvm_trans = g_trans_table.Find(tid);
+  if (rvm_trans != nullptr) {
+    Rvm* rvm = rvm_trans->get_rvm();
+    rvm->get_recorder().RecordEnd(RvmRecorder::COMMIT, tid);
+    uint64_t ticket = rvm->CommitTransaction(rvm_trans);
+    // A flushing commit is durable on return unless the log write failed
+    return (ticket == 0 || rvm->IsDurable(ticket)) ? 0 : -1;
   } else {
 #if DEBUG
     std::cerr << "rvm_commit_trans(): Invalid Transaction " << tid << std::endl;
@@ -808,10 +3682,73 @@ void rvm_commit_trans(trans_t tid) {
   }
 }
 
+long rvm_commit_trans_no_flush(trans_t tid) {
+  RvmTransaction* rvm_trans = g_trans_table.Find(tid);
+  if (rvm_trans == nullptr) {
+#if DEBUG
+    std::cerr << "rvm_commit_trans_no_flush(): Invalid Transaction " << tid << std::endl;
+#endif
+    exit(EXIT_FAILURE);
+  }
+  rvm_trans->get_rvm()->get_recorder().RecordEnd(RvmRecorder::COMMIT_NO_FLUSH, tid);
+  return (long) rvm_trans->get_rvm()->CommitTransaction(rvm_trans, false);
+}
+
+rvm_commit_t rvm_commit_trans_async(trans_t tid) {
+  RvmTransaction* rvm_trans = g_trans_table.Find(tid);
+  if (rvm_trans == nullptr || rvm_trans->is_read_only()) {
+#if DEBUG
+    std::cerr << "rvm_commit_trans_async(): Invalid Transaction " << tid << std::endl;
+#endif
+    exit(EXIT_FAILURE);
+  }
+  rvm_trans->get_rvm()->get_recorder().RecordEnd(RvmRecorder::COMMIT_ASYNC, tid);
+  return rvm_trans->get_rvm()->CommitTransactionAsync(rvm_trans);
+}
+
+int rvm_commit_poll(rvm_commit_t handle) {
+  return handle->rvm->PollCommit(handle);
+}
+
+int rvm_commit_wait(rvm_commit_t handle) {
+  return handle->rvm->WaitCommit(handle) ? 0 : -1;
+}
+
+void rvm_commit_set_callback(rvm_commit_t handle, rvm_commit_callback_t callback, void* arg) {
+  handle->rvm->SetCommitCallback(handle, callback, arg);
+}
+
+int rvm_commit_eventfd(rvm_commit_t handle) {
+  return handle->rvm->GetCommitEventFd(handle);
+}
+
+void rvm_commit_release(rvm_commit_t handle) {
+  handle->rvm->ReleaseCommit(handle);
+}
+
+int rvm_flush(rvm_t rvm) {
+  rvm->get_recorder().RecordCall(RvmRecorder::FLUSH);
+  return rvm->Flush() ? 0 : -1;
+}
+
+int rvm_is_durable(rvm_t rvm, long ticket) {
+  return rvm->IsDurable((uint64_t) ticket) ? 1 : 0;
+}
+
+void rvm_set_durable_callback(rvm_t rvm, rvm_durable_callback_t callback, void* arg) {
+  rvm->SetDurableCallback(callback, arg);
+}
+
 void rvm_abort_trans(trans_t tid) {
-  std::unordered_map<trans_t, RvmTransaction*>::iterator iter = g_trans_map.find(tid);
-  if (iter != g_trans_map.end()) {
-    RvmTransaction* rvm_trans = iter->second;
+  RvmTransaction* rvm_trans = g_trans_table.Find(tid);
+  if (rvm_trans != nullptr) {
+    if (!rvm_trans->can_restore()) {
+#if DEBUG
+      std::cerr << "rvm_abort_trans(): Transaction " << tid << " can not be aborted" << std::endl;
+#endif
+      exit(EXIT_FAILURE);
+    }
+    rvm_trans->get_rvm()->get_recorder().RecordEnd(RvmRecorder::ABORT, tid);
     rvm_trans->get_rvm()->AbortTransaction(rvm_trans);
   } else {
 #if DEBUG
@@ -821,6 +3758,135 @@ void rvm_abort_trans(trans_t tid) {
   }
 }
 
+int rvm_savepoint(trans_t tid) {
+  RvmTransaction* rvm_trans = g_trans_table.Find(tid);
+  if (rvm_trans == nullptr || rvm_trans->is_read_only()) {
+#if DEBUG
+    std::cerr << "rvm_savepoint(): Invalid Transaction " << tid << std::endl;
+#endif
+    exit(EXIT_FAILURE);
+  }
+  rvm_trans->get_rvm()->get_recorder().RecordUnsupported("rvm_savepoint");
+  return rvm_trans->Savepoint();
+}
+
+void rvm_rollback_to(trans_t tid, int savepoint) {
+  RvmTransaction* rvm_trans = g_trans_table.Find(tid);
+  if (rvm_trans == nullptr || rvm_trans->is_read_only()) {
+#if DEBUG
+    std::cerr << "rvm_rollback_to(): Invalid Transaction " << tid << std::endl;
+#endif
+    exit(EXIT_FAILURE);
+  }
+
+  if (!rvm_trans->can_restore()) {
+#if DEBUG
+    std::cerr << "rvm_rollback_to(): Transaction " << tid << " can not be rolled back" << std::endl;
+#endif
+    exit(EXIT_FAILURE);
+  }
+
+  rvm_trans->get_rvm()->get_recorder().RecordUnsupported("rvm_rollback_to");
+  if (!rvm_trans->RollbackTo(savepoint)) {
+#if DEBUG
+    std::cerr << "rvm_rollback_to(): Invalid Savepoint " << savepoint << std::endl;
+#endif
+    exit(EXIT_FAILURE);
+  }
+}
+
 void rvm_truncate_log(rvm_t rvm) {
+  rvm->get_recorder().RecordCall(RvmRecorder::TRUNCATE);
   rvm->TruncateLog();
 }
+
+int rvm_set_option(rvm_t rvm, int option, long value) {
+  rvm->get_recorder().RecordSetOption(option, value);
+  return rvm->SetOption(option, value);
+}
+
+unsigned int rvm_segment_id(rvm_t rvm, void* segbase) {
+  return rvm->GetSegmentId(segbase);
+}
+
+void* rvm_segment_base(rvm_t rvm, unsigned int segid) {
+  return rvm->GetSegmentBase(segid);
+}
+
+int rvm_get_stats(rvm_t rvm, rvm_stats_t* stats) {
+  if (stats == nullptr) {
+#if DEBUG
+    std::cerr << "rvm_get_stats(): Invalid stats buffer" << std::endl;
+#endif
+    return -1;
+  }
+  rvm->GetStats(stats);
+  return 0;
+}
+
+int rvm_trace_dump(rvm_t rvm, const char* path) {
+  if (path == nullptr) {
+#if DEBUG
+    std::cerr << "rvm_trace_dump(): Invalid path" << std::endl;
+#endif
+    return -1;
+  }
+  return rvm->get_tracer().Dump(std::string(path));
+}
+
+void* rvm_malloc(trans_t tid, void* segbase, int size) {
+  if (size <= 0) {
+#if DEBUG
+    std::cerr << "rvm_malloc(): Invalid size " << size << std::endl;
+#endif
+    return nullptr;
+  }
+
+  RvmTransaction* rvm_trans = g_trans_table.Find(tid);
+  if (rvm_trans == nullptr) {
+#if DEBUG
+    std::cerr << "rvm_malloc(): Invalid Transaction " << tid << std::endl;
+#endif
+    exit(EXIT_FAILURE);
+  }
+
+  RvmSegment* segment = rvm_trans->find_segment(segbase);
+  if (segment == nullptr) {
+#if DEBUG
+    std::cerr << "rvm_malloc(): Invalid Segment Base" << std::endl;
+#endif
+    exit(EXIT_FAILURE);
+  }
+
+  rvm_trans->get_rvm()->get_recorder().RecordUnsupported("rvm_malloc");
+  RvmHeap heap(rvm_trans, segment);
+  return heap.Allocate((size_t) size);
+}
+
+int rvm_free(trans_t tid, void* segbase, void* ptr) {
+  RvmTransaction* rvm_trans = g_trans_table.Find(tid);
+  if (rvm_trans == nullptr) {
+#if DEBUG
+    std::cerr << "rvm_free(): Invalid Transaction " << tid << std::endl;
+#endif
+    exit(EXIT_FAILURE);
+  }
+
+  RvmSegment* segment = rvm_trans->find_segment(segbase);
+  if (segment == nullptr) {
+#if DEBUG
+    std::cerr << "rvm_free(): Invalid Segment Base" << std::endl;
+#endif
+    exit(EXIT_FAILURE);
+  }
+
+  rvm_trans->get_rvm()->get_recorder().RecordUnsupported("rvm_free");
+  RvmHeap heap(rvm_trans, segment);
+  if (!heap.IsAllocated(ptr)) {
+#if DEBUG
+    std::cerr << "rvm_free(): Invalid pointer " << ptr << std::endl;
+#endif
+    exit(EXIT_FAILURE);
+  }
+  return heap.Free(ptr) ? 0 : -1;
+}
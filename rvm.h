@@ -13,14 +13,151 @@ typedef int trans_t;
 
 rvm_t rvm_init(const char *directory);
 void *rvm_map(rvm_t rvm, const char *segname, int size_to_create);
+void *rvm_map_fixed(rvm_t rvm, const char *segname, int size_to_create, void *addr);
 void rvm_unmap(rvm_t rvm, void *segbase);
 void rvm_destroy(rvm_t rvm, const char *segname);
+void *rvm_resize(rvm_t rvm, void *segbase, int new_size);
 trans_t rvm_begin_trans(rvm_t rvm, int numsegs, void **segbases);
-void rvm_about_to_modify(trans_t tid, void *segbase, int offset, int size);
-void rvm_commit_trans(trans_t tid);
+int rvm_about_to_modify(trans_t tid, void *segbase, int offset, int size);
+int rvm_commit_trans(trans_t tid);
 void rvm_abort_trans(trans_t tid);
 void rvm_truncate_log(rvm_t rvm);
 
+/* No-flush commits. The returned ticket becomes durable once the buffered
+ * log is written by rvm_flush(), a flushing commit or a full buffer. The
+ * callback runs after each write and must not call back into the library.
+ * rvm_commit_trans() and rvm_flush() return -1 if the log write failed; the
+ * entries are kept and written ahead of newer ones by the next flush. */
+typedef void (*rvm_durable_callback_t)(rvm_t rvm, long ticket, void *arg);
+long rvm_commit_trans_no_flush(trans_t tid);
+int rvm_flush(rvm_t rvm);
+int rvm_is_durable(rvm_t rvm, long ticket);
+void rvm_set_durable_callback(rvm_t rvm, rvm_durable_callback_t callback, void *arg);
+
+/* Asynchronous commits. The transaction is committed and visible when the
+ * call returns and its log entry is written by a background thread. The
+ * handle reports when the entry is durable and must be released. Handle
+ * callbacks must not call back into the library. */
+typedef struct RvmCommitHandle *rvm_commit_t;
+typedef void (*rvm_commit_callback_t)(rvm_commit_t handle, void *arg);
+rvm_commit_t rvm_commit_trans_async(trans_t tid);
+int rvm_commit_poll(rvm_commit_t handle); /* 1 durable, 0 in flight, -1 write failed */
+int rvm_commit_wait(rvm_commit_t handle); /* 0 durable, -1 write failed */
+void rvm_commit_set_callback(rvm_commit_t handle, rvm_commit_callback_t callback, void *arg);
+int rvm_commit_eventfd(rvm_commit_t handle);
+void rvm_commit_release(rvm_commit_t handle);
+
+/* Savepoints inside a transaction */
+int rvm_savepoint(trans_t tid);
+void rvm_rollback_to(trans_t tid, int savepoint);
+
+/* Transaction flags */
+#define RVM_TRANS_SHARED 0x1 /* Lock modified byte ranges instead of whole segments */
+#define RVM_TRANS_NO_RESTORE 0x2 /* Never aborted, so no undo copies are taken */
+trans_t rvm_begin_trans_flags(rvm_t rvm, int numsegs, void **segbases, int flags);
+/* A shared transaction waits for ranges held by others. Calls that declare
+ * ranges, rvm_about_to_modify() and the ones below included, return -1
+ * instead when the holders are waiting for it in turn; the transaction
+ * must then be aborted. rvm_try_about_to_modify() never waits. */
+int rvm_try_about_to_modify(trans_t tid, void *segbase, int offset, int size);
+
+/* Batched calls. rvm_about_to_modify_v() sorts and merges the ranges
+ * before declaring them. rvm_map_many() maps all of the segments or none
+ * of them, reading their backing files together, and returns 0 or -1. */
+typedef struct {
+  void *segbase;
+  int offset;
+  int size;
+} rvm_range_t;
+int rvm_about_to_modify_v(trans_t tid, const rvm_range_t *ranges, int count);
+int rvm_map_many(rvm_t rvm, int count, const char **segnames, const int *sizes, void **segbases);
+
+/* Logical updates, logged as the operation instead of the changed bytes.
+ * rvm_append() adds bytes to a region that starts with an 8-byte length
+ * followed by capacity bytes, and returns the segment offset the bytes
+ * were written at or -1 if they do not fit. */
+int rvm_add_int64(trans_t tid, void *segbase, int offset, long long delta);
+int rvm_set_bit(trans_t tid, void *segbase, int offset, int bit, int value);
+int rvm_append(trans_t tid, void *segbase, int offset, int capacity, const void *data, int size);
+
+/* Single-shot atomic writes, logged and durable when the call returns.
+ * They skip transaction setup and undo copies, and return -1 if the
+ * segment is owned by an exclusive transaction or the log write fails. */
+typedef struct {
+  int offset;
+  const void *src;
+  int size;
+} rvm_write_t;
+int rvm_atomic_write(rvm_t rvm, void *segbase, int offset, const void *src, int size);
+int rvm_atomic_writev(rvm_t rvm, void *segbase, const rvm_write_t *writes, int count);
+
+/* Read-only snapshot transactions, ended with rvm_commit_trans() or rvm_abort_trans() */
+trans_t rvm_begin_read_trans(rvm_t rvm);
+int rvm_read(trans_t tid, void *segbase, int offset, void *dest, int size);
+
+/* Instance options */
+#define RVM_OPT_CONTAINER 1 /* Pack segments into one container file */
+#define RVM_OPT_SNAPSHOTS 2 /* Keep pre-images for read-only transactions */
+#define RVM_OPT_LOG_BUFFER_SIZE 3 /* Bytes of no-flush commits buffered before they are written */
+#define RVM_OPT_IO_ENGINE 4 /* Engine for log and backing file writes, one of RVM_IO_ENGINE_* */
+#define RVM_OPT_SYNC 5 /* fdatasync() the log and backing files after writing them */
+#define RVM_OPT_DIRECT_LOG 6 /* Write the log with O_DIRECT | O_DSYNC in preallocated 4KB blocks */
+#define RVM_OPT_COMPRESSION 7 /* Codec for redo data in the log, one of RVM_COMPRESSION_* */
+#define RVM_OPT_TRACE 8 /* Spans kept in the trace ring, 0 turns tracing off */
+#define RVM_IO_ENGINE_AUTO 0 /* io_uring when the kernel supports it, else pwrite() */
+#define RVM_IO_ENGINE_POSIX 1
+#define RVM_IO_ENGINE_URING 2
+#define RVM_COMPRESSION_NONE 0
+#define RVM_COMPRESSION_LZ 1 /* Built-in LZ77 codec */
+int rvm_set_option(rvm_t rvm, int option, long value);
+
+/* Runtime statistics. Counters are totals since rvm_init(). Latencies
+ * are in nanoseconds, with percentiles accurate to about 6%. */
+typedef struct {
+  unsigned long long count;
+  unsigned long long min_ns;
+  unsigned long long mean_ns;
+  unsigned long long p50_ns;
+  unsigned long long p90_ns;
+  unsigned long long p99_ns;
+  unsigned long long p999_ns;
+  unsigned long long max_ns;
+} rvm_latency_t;
+typedef struct {
+  unsigned long long commits; /* Including atomic writes */
+  unsigned long long aborts;
+  unsigned long long about_to_modify_calls;
+  unsigned long long undo_bytes; /* Bytes copied into undo records */
+  unsigned long long redo_bytes; /* Bytes of data in logged redo records */
+  unsigned long long log_bytes_written;
+  unsigned long long syncs; /* fdatasync() calls on the log and backing files */
+  unsigned long long truncations;
+  unsigned long long records_applied; /* Redo records applied to backing files */
+  unsigned long long resident_log_bytes; /* Memory held by the records of the log */
+  rvm_latency_t commit_latency;
+  rvm_latency_t map_latency;
+  rvm_latency_t truncate_latency;
+  rvm_latency_t recovery_latency;
+} rvm_stats_t;
+int rvm_get_stats(rvm_t rvm, rvm_stats_t *stats);
+
+/* Writes the traced spans as Chrome trace JSON, returns the number of spans */
+int rvm_trace_dump(rvm_t rvm, const char *path);
+
+/* Workload traces of map, begin, about_to_modify, commit, abort and truncate calls */
+#define RVM_REPLAY_MAX_SPEED 1 /* Do not wait out the time between recorded calls */
+int rvm_record_start(rvm_t rvm, const char *path);
+int rvm_record_stop(rvm_t rvm);
+int rvm_replay(rvm_t rvm, const char *path, int flags);
+
+void *rvm_malloc(trans_t tid, void *segbase, int size);
+int rvm_free(trans_t tid, void *segbase, void *ptr);
+
+/* Persistent segment ids, see rvm_ptr.h */
+#define RVM_MAX_SEGMENT_ID (1U << 24)
+unsigned int rvm_segment_id(rvm_t rvm, void *segbase);
+void *rvm_segment_base(rvm_t rvm, unsigned int segid);
+
 #ifdef __cplusplus
 } // extern C
 #endif
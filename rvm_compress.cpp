@@ -0,0 +1,173 @@
+#include "rvm.h"
+#include "rvm_internal.h"
+#include <cstring>
+#include <algorithm>
+
+// LZ77 codec for redo payloads. The output is a list of sequences, each
+// a token byte, literal bytes and a back reference:
+//   <1 byte>: literal count in the high nibble, match length - 4 in the low
+//   <0+ bytes>: more literal count, present when the nibble is 15, 255 per byte until a smaller byte
+//   <L bytes>: literals
+//   <2 bytes>: match offset back from the current position, 1 to 65535
+//   <0+ bytes>: more match length, present when the nibble is 15
+// The last sequence has only literals and ends the input. Runs of zeros
+// and repeated fields become matches with small offsets.
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+
+static inline uint32_t read32(const unsigned char* p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(uint32_t));
+  return value;
+}
+
+static inline uint32_t hash32(uint32_t value) {
+  return (value * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+// Writes a length that did not fit its nibble, returns false if out of room
+static bool write_length(unsigned char*& op, const unsigned char* op_end, size_t length) {
+  while (length >= 255) {
+    if (op == op_end) {
+      return false;
+    }
+    *op++ = 255;
+    length -= 255;
+  }
+  if (op == op_end) {
+    return false;
+  }
+  *op++ = (unsigned char) length;
+  return true;
+}
+
+static bool write_sequence(unsigned char*& op, const unsigned char* op_end, const unsigned char* literals,
+                           size_t num_literals, size_t offset, size_t match_length) {
+  if (op == op_end) {
+    return false;
+  }
+  unsigned char* token = op++;
+  *token = (unsigned char) (std::min(num_literals, (size_t) 15) << 4);
+  if (num_literals >= 15 && !write_length(op, op_end, num_literals - 15)) {
+    return false;
+  }
+  if ((size_t) (op_end - op) < num_literals) {
+    return false;
+  }
+  memcpy(op, literals, num_literals);
+  op += num_literals;
+
+  if (match_length == 0) {
+    return true;
+  }
+  if (op_end - op < 2) {
+    return false;
+  }
+  *op++ = (unsigned char) (offset & 0xFF);
+  *op++ = (unsigned char) (offset >> 8);
+  size_t extra = match_length - LZ_MIN_MATCH;
+  *token |= (unsigned char) std::min(extra, (size_t) 15);
+  return extra < 15 || write_length(op, op_end, extra - 15);
+}
+
+size_t rvm_compress(const char* src, size_t size, char* dst, size_t capacity) {
+  const unsigned char* in = (const unsigned char*) src;
+  unsigned char* op = (unsigned char*) dst;
+  const unsigned char* op_end = op + capacity;
+  uint32_t table[1 << LZ_HASH_BITS];
+  memset(table, 0, sizeof(table));
+
+  size_t anchor = 0;
+  size_t pos = 0;
+  while (size >= LZ_MIN_MATCH && pos <= size - LZ_MIN_MATCH) {
+    uint32_t sequence = read32(in + pos);
+    uint32_t hash = hash32(sequence);
+    size_t candidate = table[hash];
+    table[hash] = (uint32_t) pos;
+    if (candidate >= pos || pos - candidate > LZ_MAX_OFFSET || read32(in + candidate) != sequence) {
+      // Step faster through data that does not compress
+      pos += 1 + ((pos - anchor) >> 6);
+      continue;
+    }
+
+    size_t length = LZ_MIN_MATCH;
+    while (pos + length < size && in[candidate + length] == in[pos + length]) {
+      length++;
+    }
+    if (!write_sequence(op, op_end, in + anchor, pos - anchor, pos - candidate, length)) {
+      return 0;
+    }
+    pos += length;
+    anchor = pos;
+  }
+
+  if (!write_sequence(op, op_end, in + anchor, size - anchor, 0, 0)) {
+    return 0;
+  }
+  return op - (unsigned char*) dst;
+}
+
+// Reads a length continued past its nibble, returns false at end of input
+static bool read_length(const unsigned char*& ip, const unsigned char* ip_end, size_t& length) {
+  unsigned char byte;
+  do {
+    if (ip == ip_end) {
+      return false;
+    }
+    byte = *ip++;
+    length += byte;
+  } while (byte == 255);
+  return true;
+}
+
+bool rvm_decompress(const char* src, size_t size, char* dst, size_t dst_size) {
+  const unsigned char* ip = (const unsigned char*) src;
+  const unsigned char* ip_end = ip + size;
+  unsigned char* op = (unsigned char*) dst;
+  unsigned char* op_end = op + dst_size;
+
+  while (ip < ip_end) {
+    unsigned char token = *ip++;
+    size_t num_literals = token >> 4;
+    if (num_literals == 15 && !read_length(ip, ip_end, num_literals)) {
+      return false;
+    }
+    if ((size_t) (ip_end - ip) < num_literals || (size_t) (op_end - op) < num_literals) {
+      return false;
+    }
+    memcpy(op, ip, num_literals);
+    ip += num_literals;
+    op += num_literals;
+    if (ip == ip_end) {
+      // Literals only, so this was the last sequence
+      break;
+    }
+
+    if (ip_end - ip < 2) {
+      return false;
+    }
+    size_t offset = ip[0] | ((size_t) ip[1] << 8);
+    ip += 2;
+    size_t length = token & 15;
+    if (length == 15 && !read_length(ip, ip_end, length)) {
+      return false;
+    }
+    length += LZ_MIN_MATCH;
+    if (offset == 0 || offset > (size_t) (op - (unsigned char*) dst) || (size_t) (op_end - op) < length) {
+      return false;
+    }
+
+    // The match may overlap the bytes it produces
+    const unsigned char* match = op - offset;
+    if (offset >= length) {
+      memcpy(op, match, length);
+      op += length;
+    } else {
+      for (size_t i = 0; i < length; i++) {
+        *op++ = *match++;
+      }
+    }
+  }
+  return op == op_end;
+}
@@ -0,0 +1,485 @@
+#include "rvm.h"
+#include "rvm_internal.h"
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+
+// Extents are at least one page and grow in powers of two so that a
+// segment that keeps growing is only moved a logarithmic number of times
+#define RVM_CONTAINER_MIN_EXTENT 4096
+#define RVM_CONTAINER_ZERO_CHUNK (64 * 1024)
+
+// Directory journal entry types
+#define RVM_CONTAINER_EXTENT 1
+#define RVM_CONTAINER_REMOVE 2
+
+static uint64_t round_to_extent(uint64_t size) {
+  uint64_t capacity = RVM_CONTAINER_MIN_EXTENT;
+  while (capacity < size) {
+    capacity <<= 1;
+  }
+  return capacity;
+}
+
+static bool write_fully(int fd, const char* buf, size_t size, uint64_t offset) {
+  while (size > 0) {
+    ssize_t written = pwrite(fd, buf, size, offset);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    buf += written;
+    size -= written;
+    offset += written;
+  }
+  return true;
+}
+
+static size_t read_fully(int fd, char* buf, size_t size, uint64_t offset) {
+  size_t total = 0;
+  while (total < size) {
+    ssize_t bytes = pread(fd, buf + total, size - total, offset + total);
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes <= 0) {
+      break;
+    }
+    total += bytes;
+  }
+  return total;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// RvmContainer functions
+///////////////////////////////////////////////////////////////////////////////
+RvmContainer::RvmContainer(std::string directory)
+        : directory_(directory), data_fd_(-1), data_end_(0), journal_entries_(0), names_synced_(false) {
+  data_path_ = directory_ + "/" + "container.rvm";
+  dir_path_ = directory_ + "/" + "container_dir.rvm";
+  tmp_dir_path_ = dir_path_ + ".tmp";
+}
+
+RvmContainer::~RvmContainer() {
+  if (data_fd_ >= 0) {
+    close(data_fd_);
+  }
+}
+
+bool RvmContainer::Open() {
+  data_fd_ = open(data_path_.c_str(), O_RDWR | O_CREAT, 0600);
+  if (data_fd_ < 0) {
+#if DEBUG
+    std::cerr << "RvmContainer::Open(): Error opening " << data_path_ << std::endl;
+#endif
+    return false;
+  }
+
+  if (!LoadDirectory()) {
+    return false;
+  }
+
+  // Everything between the live extents is free space
+  std::map<uint64_t, uint64_t> used;
+  for (auto const& entry : extents_) {
+    used[entry.second.offset] = entry.second.capacity;
+  }
+  data_end_ = 0;
+  for (auto const& extent : used) {
+    if (extent.first > data_end_) {
+      free_extents_[data_end_] = extent.first - data_end_;
+    }
+    data_end_ = extent.first + extent.second;
+  }
+
+  // Remember which segments still live in their own backing file, so
+  // that they can be found without a stat() per segment
+  DIR* dir = opendir(directory_.c_str());
+  if (dir != nullptr) {
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+      std::string file(entry->d_name);
+      if (file.size() > 8 && file.compare(0, 4, "seg_") == 0 &&
+          file.compare(file.size() - 4, 4, ".rvm") == 0) {
+        legacy_segments_.insert(file.substr(4, file.size() - 8));
+      }
+    }
+    closedir(dir);
+  }
+  return true;
+}
+
+bool RvmContainer::LoadDirectory() {
+  std::ifstream dir_file(dir_path_, std::ifstream::binary);
+  long good_size = 0;
+  while (dir_file.good()) {
+    // Directory entry format
+    // <int bytes> : Entry type
+    // <size_t bytes = N> : Length of segment name
+    // <N bytes> : Characters making up segment name
+    // <3 x uint64_t bytes> : Extent offset, capacity and segment length (EXTENT only)
+    int type;
+    size_t name_len;
+    dir_file.read((char*)&type, sizeof(int));
+    dir_file.read((char*)&name_len, sizeof(size_t));
+    if (!dir_file.good()) {
+      break;
+    }
+
+    std::string name(name_len, 0);
+    dir_file.read(&name[0], name_len);
+    if (type == RVM_CONTAINER_EXTENT) {
+      Extent extent;
+      dir_file.read((char*)&extent, sizeof(Extent));
+      if (!dir_file.good()) {
+        break;
+      }
+      extents_[name] = extent;
+    } else if (type == RVM_CONTAINER_REMOVE) {
+      if (!dir_file.good()) {
+        break;
+      }
+      extents_.erase(name);
+    } else {
+#if DEBUG
+      std::cerr << "RvmContainer::LoadDirectory(): Invalid Type " << type << std::endl;
+#endif
+      break;
+    }
+    good_size = dir_file.tellg();
+    journal_entries_++;
+  }
+  dir_file.close();
+
+  // Drop an entry torn by a crash so that new entries are appended after
+  // the last complete one
+  struct stat st;
+  if (stat(dir_path_.c_str(), &st) == 0 && st.st_size > good_size) {
+    if (truncate(dir_path_.c_str(), good_size) != 0) {
+#if DEBUG
+      std::cerr << "RvmContainer::LoadDirectory(): Error truncating directory" << std::endl;
+#endif
+      return false;
+    }
+  }
+  return true;
+}
+
+size_t RvmContainer::ReadSegment(const std::string& segname, char* buf, size_t size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::unordered_map<std::string, Extent>::iterator iterator = extents_.find(segname);
+  if (iterator != extents_.end()) {
+    const Extent& extent = iterator->second;
+    return read_fully(data_fd_, buf, std::min<uint64_t>(size, extent.length), extent.offset);
+  }
+
+  if (legacy_segments_.count(segname) != 0) {
+    // Not packed yet, so read the segment's own backing file
+    std::ifstream backing_file(legacy_path(segname), std::ifstream::binary);
+    backing_file.read(buf, size);
+    return backing_file.gcount();
+  }
+  return 0;
+}
+
+bool RvmContainer::ApplyRecords(const std::string& segname, const std::list<RedoRecord*>& records, bool sync) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Start from the current extent, or from the segment's own backing file
+  // the first time it is written to the container
+  Extent old_extent = { 0, 0, 0 };
+  bool has_extent = false;
+  bool is_legacy = false;
+  std::unordered_map<std::string, Extent>::iterator iterator = extents_.find(segname);
+  if (iterator != extents_.end()) {
+    old_extent = iterator->second;
+    has_extent = true;
+  } else if (legacy_segments_.count(segname) != 0) {
+    struct stat st;
+    if (stat(legacy_path(segname).c_str(), &st) == 0) {
+      old_extent.length = st.st_size;
+      is_legacy = true;
+    }
+  }
+
+  // Find the largest the segment gets while the records are applied
+  uint64_t length = old_extent.length;
+  uint64_t peak = length;
+  for (RedoRecord* record : records) {
+    if (record->get_type() == RedoRecord::RecordType::RESIZE_SEGMENT) {
+      length = std::min<uint64_t>(length, record->get_size());
+    } else {
+      length = std::max<uint64_t>(length, record->get_offset() + record->get_size());
+    }
+    peak = std::max(peak, length);
+  }
+
+  Extent extent = old_extent;
+  bool moved = !has_extent || peak > old_extent.capacity;
+  if (moved) {
+    // Copy the segment into a new extent, the old one stays valid until
+    // the directory points at the new one
+    extent.capacity = round_to_extent(peak);
+    extent.offset = Allocate(extent.capacity);
+    if (!CopyIntoExtent(segname, old_extent, is_legacy, extent.offset)) {
+      Release(extent.offset, extent.capacity);
+      return false;
+    }
+  }
+
+  length = old_extent.length;
+  for (RedoRecord* record : records) {
+    if (record->get_type() == RedoRecord::RecordType::RESIZE_SEGMENT) {
+      length = std::min<uint64_t>(length, record->get_size());
+      continue;
+    }
+
+    bool success = true;
+    if (length < record->get_offset()) {
+      // Data past the end of the segment must read back as zeros
+      success = WriteZeros(extent.offset + length, record->get_offset() - length);
+    }
+    if (success && record->get_type() == RedoRecord::RecordType::ZERO_RANGE) {
+      success = WriteZeros(extent.offset + record->get_offset(), record->get_size());
+    } else if (success) {
+      assert(record->get_type() == RedoRecord::RecordType::REDO_RECORD);
+      success = write_fully(data_fd_, record->get_data_ptr(), record->get_size(),
+                            extent.offset + record->get_offset());
+    }
+    if (!success) {
+#if DEBUG
+      std::cout << "RvmContainer::ApplyRecords(): Error applying changes to container" << std::endl;
+#endif
+      if (moved) {
+        Release(extent.offset, extent.capacity);
+      }
+      return false;
+    }
+    length = std::max<uint64_t>(length, record->get_offset() + record->get_size());
+  }
+  extent.length = length;
+
+  // The directory entry must not point at data that is not on disk yet
+  if (sync && fdatasync(data_fd_) != 0) {
+#if DEBUG
+    std::cout << "RvmContainer::ApplyRecords(): Error syncing container" << std::endl;
+#endif
+    if (moved) {
+      Release(extent.offset, extent.capacity);
+    }
+    return false;
+  }
+  if (!AppendEntry(RVM_CONTAINER_EXTENT, segname, &extent)) {
+    if (moved) {
+      Release(extent.offset, extent.capacity);
+    }
+    return false;
+  }
+  extents_[segname] = extent;
+  if (sync && !SyncDirectory()) {
+    // The entry may or may not be on disk, so both extents and the
+    // segment's own file are kept, and the records stay in the log
+    return false;
+  }
+
+  if (moved && has_extent) {
+    Release(old_extent.offset, old_extent.capacity);
+  }
+  if (legacy_segments_.erase(segname) != 0) {
+    // The container now holds the segment, so its own file can go
+    remove(legacy_path(segname).c_str());
+  }
+  return true;
+}
+
+bool RvmContainer::RemoveSegment(const std::string& segname, bool sync) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::unordered_map<std::string, Extent>::iterator iterator = extents_.find(segname);
+  if (iterator != extents_.end()) {
+    if (!AppendEntry(RVM_CONTAINER_REMOVE, segname, nullptr) || (sync && !SyncDirectory())) {
+      return false;
+    }
+    Release(iterator->second.offset, iterator->second.capacity);
+    extents_.erase(iterator);
+  }
+
+  if (legacy_segments_.erase(segname) != 0) {
+    if (remove(legacy_path(segname).c_str()) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool RvmContainer::CopyIntoExtent(const std::string& segname, const Extent& old_extent,
+                                  bool is_legacy, uint64_t offset) {
+  int src_fd = data_fd_;
+  uint64_t src_offset = old_extent.offset;
+  if (is_legacy) {
+    src_fd = open(legacy_path(segname).c_str(), O_RDONLY);
+    src_offset = 0;
+    if (src_fd < 0) {
+      return false;
+    }
+  }
+
+  std::vector<char> buf(RVM_CONTAINER_ZERO_CHUNK);
+  bool success = true;
+  for (uint64_t copied = 0; copied < old_extent.length && success; copied += buf.size()) {
+    size_t size = std::min<uint64_t>(buf.size(), old_extent.length - copied);
+    size_t bytes = read_fully(src_fd, &buf[0], size, src_offset + copied);
+    // A short read only happens for a legacy file shorter than its length
+    memset(&buf[bytes], 0, size - bytes);
+    success = write_fully(data_fd_, &buf[0], size, offset + copied);
+  }
+
+  if (is_legacy) {
+    close(src_fd);
+  }
+#if DEBUG
+  if (!success) {
+    std::cout << "RvmContainer::CopyIntoExtent(): Error copying segment " << segname << std::endl;
+  }
+#endif
+  return success;
+}
+
+bool RvmContainer::WriteZeros(uint64_t offset, uint64_t size) {
+  // Punch a hole where the data file already has blocks
+  struct stat st;
+  if (size > 0 && fstat(data_fd_, &st) == 0 && offset + size <= (uint64_t) st.st_size &&
+      fallocate(data_fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, size) == 0) {
+    return true;
+  }
+
+  std::vector<char> zeros(std::min<uint64_t>(size, RVM_CONTAINER_ZERO_CHUNK), 0);
+  while (size > 0) {
+    size_t chunk = std::min<uint64_t>(size, zeros.size());
+    if (!write_fully(data_fd_, &zeros[0], chunk, offset)) {
+      return false;
+    }
+    offset += chunk;
+    size -= chunk;
+  }
+  return true;
+}
+
+uint64_t RvmContainer::Allocate(uint64_t capacity) {
+  // First fit from the free space, otherwise extend the container
+  for (std::map<uint64_t, uint64_t>::iterator free = free_extents_.begin();
+       free != free_extents_.end(); free++) {
+    if (free->second >= capacity) {
+      uint64_t offset = free->first;
+      uint64_t remaining = free->second - capacity;
+      free_extents_.erase(free);
+      if (remaining > 0) {
+        free_extents_[offset + capacity] = remaining;
+      }
+      return offset;
+    }
+  }
+
+  uint64_t offset = data_end_;
+  data_end_ += capacity;
+  return offset;
+}
+
+void RvmContainer::Release(uint64_t offset, uint64_t capacity) {
+  // Merge with the neighbouring free extents
+  std::map<uint64_t, uint64_t>::iterator next = free_extents_.lower_bound(offset);
+  if (next != free_extents_.end() && next->first == offset + capacity) {
+    capacity += next->second;
+    next = free_extents_.erase(next);
+  }
+  if (next != free_extents_.begin()) {
+    std::map<uint64_t, uint64_t>::iterator prev = std::prev(next);
+    if (prev->first + prev->second == offset) {
+      prev->second += capacity;
+      return;
+    }
+  }
+  free_extents_[offset] = capacity;
+}
+
+bool RvmContainer::AppendEntry(int type, const std::string& segname, const Extent* extent) {
+  if (journal_entries_ > 2 * extents_.size() + RVM_CONTAINER_COMPACT_SLACK) {
+    // Most entries are stale, so rewrite the directory with the live ones
+    if (!CompactDirectory()) {
+      return false;
+    }
+  }
+
+  std::ofstream::openmode flags = std::ofstream::out | std::ofstream::binary | std::ofstream::app;
+  std::ofstream dir_file(dir_path_, flags);
+  WriteEntry(dir_file, type, segname, extent);
+  dir_file.flush();
+  if (!dir_file.good()) {
+#if DEBUG
+    std::cerr << "RvmContainer::AppendEntry(): Error writing directory" << std::endl;
+#endif
+    return false;
+  }
+  journal_entries_++;
+  return true;
+}
+
+bool RvmContainer::SyncDirectory() {
+  // The first sync, and the first after a compaction renamed the file,
+  // also puts the names of the container files on disk
+  if (!rvm_sync_path(dir_path_) || (!names_synced_ && !rvm_sync_path(directory_))) {
+#if DEBUG
+    std::cerr << "RvmContainer::SyncDirectory(): Error syncing directory" << std::endl;
+#endif
+    return false;
+  }
+  names_synced_ = true;
+  return true;
+}
+
+bool RvmContainer::CompactDirectory() {
+  std::ofstream::openmode flags = std::ofstream::out | std::ofstream::binary | std::ofstream::trunc;
+  std::ofstream tmp_file(tmp_dir_path_, flags);
+  for (auto const& entry : extents_) {
+    WriteEntry(tmp_file, RVM_CONTAINER_EXTENT, entry.first, &entry.second);
+  }
+  tmp_file.flush();
+  if (!tmp_file.good()) {
+#if DEBUG
+    std::cerr << "RvmContainer::CompactDirectory(): Error writing directory" << std::endl;
+#endif
+    return false;
+  }
+  tmp_file.close();
+  // A rename that reaches the disk before the entries would leave an
+  // empty directory
+  if (!rvm_sync_path(tmp_dir_path_)) {
+#if DEBUG
+    std::cerr << "RvmContainer::CompactDirectory(): Error syncing directory" << std::endl;
+#endif
+    return false;
+  }
+
+  // Make the temporary directory the new directory
+  std::rename(tmp_dir_path_.c_str(), dir_path_.c_str());
+  names_synced_ = false;
+  journal_entries_ = extents_.size();
+  return true;
+}
+
+void RvmContainer::WriteEntry(std::ofstream& dir_file, int type, const std::string& segname,
+                              const Extent* extent) {
+  size_t name_len = segname.length();
+  dir_file.write((char*)&type, sizeof(int));
+  dir_file.write((char*)&name_len, sizeof(size_t));
+  dir_file.write(segname.c_str(), name_len);
+  if (type == RVM_CONTAINER_EXTENT) {
+    dir_file.write((const char*)extent, sizeof(Extent));
+  }
+}
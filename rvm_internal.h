@@ -1,27 +1,146 @@
 #ifndef RVM_INTERNAL_H
 #define RVM_INTERNAL_H
 
+#include <string>
 #include <vector>
 #include <list>
+#include <map>
 #include <unordered_map>
+#include <unordered_set>
+#include <set>
 #include <sys/stat.h>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <cstdint>
+#include <cstdio>
 
 #define DEBUG 1
+
+// Segments at least this large are backed by anonymous mappings so that
+// rvm_resize() can grow or shrink them with mremap() instead of copying
+#define RVM_MMAP_THRESHOLD (128 * 1024)
+
+// Default bytes of no-flush commits buffered before they are written
+#define RVM_DEFAULT_LOG_BUFFER_SIZE (1 << 20)
+
+// Logged size of a redo record apart from its segment name and data
+#define RVM_REDO_HEADER_SIZE (sizeof(int) + 3 * sizeof(size_t))
+
+// Largest buffer of zeros written where holes cannot be punched
+#define RVM_ZERO_CHUNK (1 << 20)
+
+// Transactions whose records take fewer bytes than this are never compressed
+#define RVM_COMPRESS_MIN_SIZE 64
+
+// Direct log writes cover whole blocks. Each commit is padded out to a
+// block boundary with a padding entry, which starts with RVM_LOG_PAD_ID in
+// place of a transaction id followed by the number of padding bytes. The
+// log file is grown by fallocate() in steps of RVM_LOG_PREALLOC_SIZE, and
+// an entry header with no records marks the unused tail.
+#define RVM_LOG_BLOCK_SIZE 4096
+#define RVM_LOG_PREALLOC_SIZE (4 << 20)
+#define RVM_LOG_PAD_ID (-1)
+
+// Number of segment ids per chunk of the segment base table
+#define RVM_SEGMENT_TABLE_CHUNK 4096
+
+// Segment metadata entry types
+#define RVM_META_SEGMENT_ID 1
+#define RVM_META_SEGMENT_ADDRESS 2
 #if !DEBUG
   #define NDEBUG
 #endif
 
 
 class RvmTransaction;
+class UndoRecord;
+
+// Appends the offset and size of each run of bytes where new_data differs
+// from old_data. Runs split by fewer than min_gap equal bytes are merged.
+// Compares with AVX2 or SSE2 when the CPU has them.
+void rvm_diff_ranges(const char* old_data, const char* new_data, size_t size, size_t min_gap,
+                     std::vector<std::pair<size_t, size_t>>& ranges);
+
+// Appends the offset and size of each run of at least min_run zero bytes
+void rvm_zero_runs(const char* data, size_t size, size_t min_run,
+                   std::vector<std::pair<size_t, size_t>>& runs);
+
+// LZ77 codec for redo data. rvm_compress() returns the compressed size, or
+// 0 if it does not fit in capacity. rvm_decompress() fails unless src
+// decodes to exactly dst_size bytes.
+size_t rvm_compress(const char* src, size_t size, char* dst, size_t capacity);
+bool rvm_decompress(const char* src, size_t size, char* dst, size_t dst_size);
+
+// Internal transaction flags, above the ones in rvm.h
+#define RVM_TRANS_READ_ONLY 0x100 // Snapshot reader started by rvm_begin_read_trans()
+#define RVM_TRANS_VERSIONED 0x200 // Registers undo copies for snapshot readers
+
+// Pre-images of segment bytes that let read-only transactions see the
+// segment as of an earlier commit. Entries of open transactions point at
+// their undo copies. Committed entries own their data and carry the commit
+// sequence number of the transaction that overwrote the bytes.
+class RvmVersionStore {
+ public:
+  ~RvmVersionStore();
 
-static std::unordered_map<std::string, Rvm*> g_rvm_instances;
-static std::unordered_map<trans_t, RvmTransaction*> g_trans_map;
-static std::atomic<trans_t> g_trans_id (0);
+  void Register(const UndoRecord* record);
+  void Unregister(const UndoRecord* record);
+  // Takes ownership of data, or drops the entry if data is nullptr
+  void Publish(const UndoRecord* record, char* data, uint64_t seq);
+  // Drops committed entries no reader can see past
+  void Prune(uint64_t min_snapshot);
+  void Read(uint64_t snapshot, const char* base, size_t offset, size_t size, char* dest);
+
+ private:
+  struct Version {
+    const UndoRecord* record;
+    uint64_t seq;
+    size_t offset;
+    size_t size;
+    const char* data;
+  };
+
+  std::mutex mutex_;
+  std::list<Version> in_flight_; // In the order they were registered
+  std::list<Version> committed_; // Ordered by seq
+};
+
+// Byte ranges of a segment held by shared transactions until they commit
+// or abort. Ranges held by the same transaction never conflict.
+class RvmRangeLock {
+ public:
+  RvmRangeLock() : max_size_(0) {};
+
+  // Waits for conflicting ranges to be released, or returns false right
+  // away if wait is false. Also returns false instead of waiting when the
+  // holders are themselves waiting, through any segment, for the owner.
+  bool Lock(trans_t owner, size_t offset, size_t size, bool wait);
+  void UnlockAll(trans_t owner);
+
+ private:
+  bool Conflicts(trans_t owner, size_t offset, size_t size, std::vector<trans_t>* holders) const;
+  static bool WaitFor(trans_t owner, const std::vector<trans_t>& holders);
+  static void StopWaiting(trans_t owner);
+
+  std::mutex mutex_;
+  std::condition_variable released_;
+  std::multimap<size_t, std::pair<size_t, trans_t>> ranges_; // Start to end and owner
+  size_t max_size_; // Largest range held since ranges_ was last empty
+
+  // Transactions blocked in Lock() to the holders they wait for, shared by
+  // every segment since a deadlock can span segments
+  static std::mutex waits_mutex_;
+  static std::unordered_map<trans_t, std::vector<trans_t>> waits_for_;
+};
 
 class RvmSegment {
  public:
-  RvmSegment(Rvm* rvm, std::string segname, size_t segsize);
+  // Unless load is false, the contents are read from the backing store and the log
+  RvmSegment(Rvm* rvm, std::string segname, size_t segsize, char* fixed_base = nullptr, bool load = true);
   ~RvmSegment();
 
   const std::string& get_name() const {
@@ -48,22 +167,71 @@ class RvmSegment {
     owned_by_ = owner;
   }
 
+  // True if any transaction, exclusive or shared, is using the segment
   bool has_owner() const {
-    return owned_by_ != nullptr;
+    return owned_by_ != nullptr || num_sharers_ != 0;
   }
 
+  void add_sharer() {
+    num_sharers_++;
+  }
+
+  void remove_sharer() {
+    num_sharers_--;
+  }
+
+  // Read-only transactions pin the segments they read, so the segments
+  // are not unmapped or moved under them, but do not own them
+  bool has_readers() const {
+    return num_readers_ != 0;
+  }
+
+  void add_reader() {
+    num_readers_++;
+  }
+
+  void remove_reader() {
+    num_readers_--;
+  }
+
+  RvmRangeLock& get_range_lock() {
+    return range_lock_;
+  }
+
+  RvmVersionStore& get_versions() {
+    return versions_;
+  }
+
+  uint32_t get_id() const {
+    return id_;
+  }
+
+  void set_id(uint32_t id) {
+    id_ = id;
+  }
+
+  bool Resize(size_t new_size);
+
  private:
   Rvm* rvm_;
+  uint32_t id_;
   std::string name_;
   std::string path_;
   char* base_;
   size_t size_;
+  bool mmapped_;
+  bool fixed_; // Mapped at a recorded address that must not move
   RvmTransaction* owned_by_;
+  int num_sharers_; // Shared transactions using the segment
+  int num_readers_; // Read-only transactions that read the segment
+  RvmRangeLock range_lock_;
+  RvmVersionStore versions_;
 };
 
 class UndoRecord {
  public:
-  UndoRecord(RvmSegment* segment, size_t offset, size_t size);
+  // Without capture only the range is recorded and Rollback() must not be called
+  UndoRecord(RvmSegment* segment, size_t offset, size_t size, bool capture = true);
   ~UndoRecord();
 
   void Rollback();
@@ -83,11 +251,37 @@ class UndoRecord {
     return segment_->get_name();
   }
 
+  RvmSegment* get_segment() const {
+    return segment_;
+  }
+
+  const char* get_copy() const {
+    return undo_copy_;
+  }
+
+  // Set while the range is only changed by logical records, which are
+  // logged in place of its bytes
+  bool is_logical() const {
+    return logical_;
+  }
+
+  void set_logical(bool logical) {
+    logical_ = logical;
+  }
+
+  // Hands the undo copy over to the caller
+  char* release_copy() {
+    char* copy = undo_copy_;
+    undo_copy_ = nullptr;
+    return copy;
+  }
+
  private:
   RvmSegment* segment_;
   size_t offset_;
   size_t size_;
   char* undo_copy_;
+  bool logical_;
 };
 
 
@@ -95,12 +289,25 @@ class RedoRecord {
  public:
   enum RecordType {
     REDO_RECORD = 1,
-    DESTROY_SEGMENT = 2
+    DESTROY_SEGMENT = 2,
+    RESIZE_SEGMENT = 3,
+    COMPRESSED_RECORDS = 4, // Only in the log, holds the other records of a transaction compressed
+    ZERO_RANGE = 5, // Zeros a range, no data is stored
+    // Logical records, replayed against the bytes already in the segment.
+    // get_size() is the number of bytes each one changes at get_offset().
+    ADD_RECORD = 6, // Adds get_arg() to the int64 at the offset
+    SET_BIT_RECORD = 7, // get_arg() holds the bit number and, above it, the new value
+    APPEND_RECORD = 8 // Appends the data to the append region at the offset, get_arg() is its capacity
   };
 
   RedoRecord(std::string segname, size_t offset, size_t size);
   RedoRecord(const UndoRecord* record);
+  // Covers size bytes at offset within the range of record
+  RedoRecord(const UndoRecord* record, size_t offset, size_t size);
   RedoRecord(RecordType type, std::string segname);
+  RedoRecord(RecordType type, std::string segname, size_t size);
+  RedoRecord(RecordType type, std::string segname, size_t offset, size_t size, uint64_t arg = 0,
+             const char* data = nullptr);
 
   ~RedoRecord();
 
@@ -124,26 +331,63 @@ class RedoRecord {
     return data_;
   }
 
+  uint64_t get_arg() const {
+    return arg_;
+  }
+
+  void add_to_arg(uint64_t delta) {
+    arg_ += delta;
+  }
+
+  bool is_logical() const {
+    return type_ == ADD_RECORD || type_ == SET_BIT_RECORD || type_ == APPEND_RECORD;
+  }
+
  private:
   RecordType type_;
   std::string segment_name_;
   size_t offset_;
   size_t size_;
   char* data_;
+  uint64_t arg_;
 };
 
+// Bytes at the start of an append region that hold its used length
+#define RVM_APPEND_HEADER_SIZE sizeof(uint64_t)
+
+// Applies records to the first size bytes of a segment in log order. The
+// ranges changed by logical records are added to logical_ranges if set.
+void rvm_apply_redo_records(char* base, size_t size, const std::list<RedoRecord*>& records,
+                            std::vector<std::pair<size_t, size_t>>* logical_ranges = nullptr);
+
 class RvmTransaction {
  public:
-  RvmTransaction(trans_t tid, Rvm* rvm) : id_(tid), rvm_(rvm) {};
+  RvmTransaction(trans_t tid, Rvm* rvm, int flags = 0)
+          : id_(tid), handle_(-1), flags_(flags), snapshot_(0), rvm_(rvm) {};
   RvmTransaction(trans_t tid, Rvm* rvm, const std::list<RedoRecord*>& records)
-          : id_(tid), rvm_(rvm), redo_records_(records) {
+          : id_(tid), handle_(-1), flags_(0), snapshot_(0), rvm_(rvm), redo_records_(records) {
   };
   ~RvmTransaction();
 
 
-  void AboutToModify(void* segbase, size_t offset, size_t size);
+  // Returns false if another shared transaction holds part of the range
+  // and wait is false or waiting for it would deadlock. The calls below
+  // fail the same way.
+  bool AboutToModify(void* segbase, size_t offset, size_t size, bool wait = true, bool logical = false);
+  bool AboutToModifyMany(const rvm_range_t* ranges, int count);
+  bool AddInt64(void* segbase, size_t offset, int64_t delta);
+  bool SetBit(void* segbase, size_t offset, int bit, bool value);
+  // Returns the segment offset the data was written at, -1 if it does not
+  // fit or its range could not be locked
+  long Append(void* segbase, size_t offset, size_t capacity, const void* data, size_t size);
   void Commit();
   void Abort();
+
+  // Savepoints are numbered from 0 in the order they were taken. Rolling
+  // back to one undoes the changes declared after it and drops the
+  // savepoints taken after it.
+  int Savepoint();
+  bool RollbackTo(int savepoint);
   void AddSegment(RvmSegment* segment);
   void RemoveSegments();
 
@@ -151,6 +395,47 @@ class RvmTransaction {
     return id_;
   }
 
+  // Handle given out to the application, see RvmTransactionTable
+  trans_t get_handle() const {
+    return handle_;
+  }
+
+  void set_handle(trans_t handle) {
+    handle_ = handle;
+  }
+
+  // Shared transactions lock byte ranges instead of whole segments
+  bool is_shared() const {
+    return (flags_ & RVM_TRANS_SHARED) != 0;
+  }
+
+  bool is_read_only() const {
+    return (flags_ & RVM_TRANS_READ_ONLY) != 0;
+  }
+
+  bool is_versioned() const {
+    return (flags_ & RVM_TRANS_VERSIONED) != 0;
+  }
+
+  // No-restore transactions can not be rolled back. They still take undo
+  // copies when they are versioned, since snapshot readers need them.
+  bool can_restore() const {
+    return (flags_ & RVM_TRANS_NO_RESTORE) == 0;
+  }
+
+  // Commit sequence number a read-only transaction reads at
+  uint64_t get_snapshot() const {
+    return snapshot_;
+  }
+
+  void set_snapshot(uint64_t snapshot) {
+    snapshot_ = snapshot;
+  }
+
+  // Moves the undo copies of a versioned transaction into the version
+  // stores of its segments, or drops them if no reader needs them
+  void PublishVersions(uint64_t seq, bool retain);
+
   const std::list<RedoRecord*>& get_redo_records() const {
     return redo_records_;
   }
@@ -163,12 +448,443 @@ class RvmTransaction {
     return rvm_;
   }
 
+  RvmSegment* find_segment(void* segbase) const {
+    std::unordered_map<void*, RvmSegment*>::const_iterator iterator = base_to_segment_map_.find(segbase);
+    return (iterator != base_to_segment_map_.end()) ? iterator->second : nullptr;
+  }
+
+  std::vector<RvmSegment*> get_segments() const {
+    std::vector<RvmSegment*> segments;
+    for (auto const entry : base_to_segment_map_) {
+      segments.push_back(entry.second);
+    }
+    return segments;
+  }
+
  private:
-  trans_t id_;
+  trans_t id_; // Sequence number written to the log
+  trans_t handle_;
+  int flags_;
+  uint64_t snapshot_;
   Rvm* rvm_;
   std::unordered_map<void*, RvmSegment*> base_to_segment_map_;
   std::list<UndoRecord*> undo_records_;
   std::list<RedoRecord*> redo_records_;
+  std::list<RedoRecord*> logical_records_; // Logged ahead of the physical records at commit
+  // Number of undo records and logical records when each savepoint was taken
+  std::vector<std::pair<size_t, size_t>> savepoints_;
+
+  void RollbackRecords(size_t keep, size_t keep_logical);
+  // Whether any byte of the range was declared with AboutToModify() for a
+  // direct change
+  bool OverlapsPhysical(void* segbase, size_t offset, size_t size) const;
+  void AddRedoRecords(const UndoRecord* record, size_t offset, size_t size);
+};
+
+// Maps transaction handles to live transactions without locks.
+//
+// A handle packs a slot index (low RVM_TRANS_SLOT_BITS bits) and the
+// generation of that slot (the bits above). Erasing a handle bumps the
+// slot's generation, so stale handles fail the generation compare even
+// after the slot is reused. Generations start at 1, so small integers
+// such as 0 are never valid handles. Slots live in chunks that are
+// allocated on first use and never freed, and released slots are kept
+// on a tagged lock-free free list.
+#define RVM_TRANS_SLOT_BITS 16
+#define RVM_TRANS_MAX_SLOTS (1U << RVM_TRANS_SLOT_BITS)
+#define RVM_TRANS_MAX_GENERATION 0x7FFFU
+#define RVM_TRANS_SLOT_CHUNK 1024
+
+class RvmTransactionTable {
+ public:
+  RvmTransactionTable();
+  ~RvmTransactionTable();
+
+  // Returns (trans_t) -1 if all slots are in use
+  trans_t Insert(RvmTransaction* rvm_trans);
+  RvmTransaction* Find(trans_t tid) const;
+  bool Erase(trans_t tid);
+
+ private:
+  struct Slot {
+    std::atomic<uint32_t> generation;
+    std::atomic<RvmTransaction*> rvm_trans;
+    std::atomic<uint32_t> next_free; // Index + 1 of the next free slot, 0 ends the list
+  };
+
+  Slot* get_slot(uint32_t index) const {
+    Slot* chunk = chunks_[index / RVM_TRANS_SLOT_CHUNK].load(std::memory_order_acquire);
+    return (chunk != nullptr) ? &chunk[index % RVM_TRANS_SLOT_CHUNK] : nullptr;
+  }
+
+  uint32_t AllocateSlot();
+
+  std::atomic<Slot*> chunks_[RVM_TRANS_MAX_SLOTS / RVM_TRANS_SLOT_CHUNK];
+  std::atomic<uint32_t> next_slot_; // Slots at and above this were never used
+  std::atomic<uint64_t> free_head_; // ABA tag in the upper half, slot index + 1 in the lower
+};
+
+// Completion handle of an asynchronous commit
+struct RvmCommitHandle {
+  Rvm* rvm;
+  uint64_t ticket; // Durable once the log is written up to this commit
+  rvm_commit_callback_t callback;
+  void* callback_arg;
+  int event_fd; // -1 until asked for
+};
+
+// Counters and latency histograms of an instance. Each thread adds to one
+// of RVM_STATS_STRIPES cache-line aligned stripes with relaxed atomics, so
+// threads rarely share a line. Collect() sums the stripes. Latencies are
+// kept in nanoseconds in log-linear buckets: exact below 16, then 8
+// buckets per power of two, for at most 12.5% error.
+#define RVM_STATS_STRIPES 8
+#define RVM_STATS_SUB_BITS 3
+#define RVM_STATS_MAX_EXPONENT 40 // Latencies are capped at 2^40 ns
+#define RVM_STATS_BUCKETS ((RVM_STATS_MAX_EXPONENT - RVM_STATS_SUB_BITS + 2) << RVM_STATS_SUB_BITS)
+
+uint64_t rvm_now_ns();
+
+class RvmStats {
+ public:
+  enum Counter {
+    COMMITS,
+    ABORTS,
+    ABOUT_TO_MODIFY_CALLS,
+    UNDO_BYTES,
+    REDO_BYTES,
+    LOG_BYTES_WRITTEN,
+    SYNCS,
+    TRUNCATIONS,
+    RECORDS_APPLIED,
+    NUM_COUNTERS
+  };
+
+  enum Latency {
+    COMMIT_LATENCY,
+    MAP_LATENCY,
+    TRUNCATE_LATENCY,
+    RECOVERY_LATENCY,
+    NUM_LATENCIES
+  };
+
+  RvmStats();
+  ~RvmStats();
+
+  void Add(Counter counter, uint64_t value = 1) {
+    GetStripe().counters[counter].fetch_add(value, std::memory_order_relaxed);
+  }
+
+  void Record(Latency latency, uint64_t ns);
+  // Fills everything but resident_log_bytes
+  void Collect(rvm_stats_t* stats) const;
+
+ private:
+  struct Histogram {
+    std::atomic<uint64_t> buckets[RVM_STATS_BUCKETS];
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> min;
+    std::atomic<uint64_t> max;
+  };
+
+  struct alignas(64) Stripe {
+    std::atomic<uint64_t> counters[NUM_COUNTERS];
+    Histogram histograms[NUM_LATENCIES];
+  };
+
+  Stripe* stripes_; // Allocated 64-byte aligned, which new only does from C++17
+
+  Stripe& GetStripe();
+  void CollectLatency(Latency latency, rvm_latency_t* out) const;
+};
+
+// Static tracepoints at phase boundaries. Building with -DRVM_USDT=1 and
+// <sys/sdt.h> turns each into a pair of USDT probes, rvm:<name>__begin
+// and rvm:<name>__end, otherwise the probes compile to nothing. Spans are
+// also kept in the instance's trace ring while it has a capacity.
+#ifndef RVM_USDT
+#define RVM_USDT 0
+#endif
+#if RVM_USDT
+#include <sys/sdt.h>
+#define RVM_PROBE(name) DTRACE_PROBE(rvm, name)
+#else
+#define RVM_PROBE(name) do {} while (0)
+#endif
+
+#define RVM_TRACE_BEGIN(tracer, name) \
+  RVM_PROBE(name##__begin); \
+  uint64_t rvm_trace_##name = (tracer).Begin()
+
+#define RVM_TRACE_END(tracer, name) \
+  do { \
+    RVM_PROBE(name##__end); \
+    (tracer).End(#name, rvm_trace_##name); \
+  } while (0)
+
+// Spans read from RVM_TRACE_EVENTS at rvm_init(), so recovery can be traced
+#define RVM_TRACE_ENV "RVM_TRACE_EVENTS"
+
+// Ring of the most recent spans, written out as Chrome trace events
+class RvmTracer {
+ public:
+  RvmTracer() : enabled_(false), ring_(nullptr) {};
+  ~RvmTracer();
+
+  // 0 when tracing is off
+  uint64_t Begin() const {
+    return enabled_.load(std::memory_order_relaxed) ? rvm_now_ns() : 0;
+  }
+
+  void End(const char* name, uint64_t start) {
+    if (start != 0) {
+      Record(name, start, rvm_now_ns());
+    }
+  }
+
+  // Drops the spans kept so far, a capacity of 0 turns tracing off
+  void SetCapacity(size_t capacity);
+  // Returns the number of spans written, -1 if the file can not be written
+  int Dump(const std::string& path);
+
+ private:
+  struct Event {
+    const char* name;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    uint32_t tid;
+  };
+
+  // A span claims the next slot with one fetch_add and publishes it by
+  // storing its span number + 1 in seq, so spans never wait on each other.
+  // seq is 0 while the slot is being written.
+  struct Slot {
+    std::atomic<uint64_t> seq;
+    std::atomic<const char*> name;
+    std::atomic<uint64_t> start_ns;
+    std::atomic<uint64_t> end_ns;
+    std::atomic<uint32_t> tid;
+  };
+
+  struct Ring {
+    size_t capacity;
+    std::atomic<uint64_t> next; // Spans recorded so far, the next one goes to next % capacity
+    Slot* slots;
+
+    ~Ring() {
+      delete[] slots;
+    }
+  };
+
+  std::atomic<bool> enabled_;
+  std::atomic<Ring*> ring_;
+  std::mutex mutex_; // Serializes SetCapacity() and Dump()
+  // Rings replaced by SetCapacity(), which open spans may still write to
+  std::vector<Ring*> retired_rings_;
+
+  void Record(const char* name, uint64_t start, uint64_t end);
+};
+
+// File that records the calls made on an instance from rvm_init() on
+#define RVM_RECORD_ENV "RVM_RECORD_TRACE"
+
+// Writes the calls applications make to a workload trace that
+// rvm_replay() drives another instance with. Segments and transactions
+// are named by small ids local to the trace. rvm_record.cpp has the format.
+class RvmRecorder {
+ public:
+  enum Op {
+    MAP = 1,
+    UNMAP = 2,
+    DESTROY = 3,
+    BEGIN = 4,
+    ABOUT_TO_MODIFY = 5,
+    COMMIT = 6,
+    COMMIT_NO_FLUSH = 7,
+    ABORT = 8,
+    TRUNCATE = 9,
+    BEGIN_FLAGS = 10,
+    COMMIT_ASYNC = 11,
+    FLUSH = 12,
+    RESIZE = 13,
+    ABOUT_TO_MODIFY_V = 14,
+    TRY_ABOUT_TO_MODIFY = 15,
+    ATOMIC_WRITE = 16,
+    ADD_INT64 = 17,
+    SET_BIT = 18,
+    APPEND = 19,
+    SET_OPTION = 20,
+    UNSUPPORTED = 21
+  };
+
+  RvmRecorder() : enabled_(false), file_(nullptr), last_ns_(0), next_segment_id_(1) {};
+  ~RvmRecorder();
+
+  // Segments already mapped are recorded as maps first
+  bool Start(const std::string& path, const std::vector<RvmSegment*>& segments);
+  bool Stop();
+
+  // Each is a single relaxed load while nothing is being recorded
+  void RecordMap(void* segbase, const std::string& segname, size_t size);
+  void RecordUnmap(void* segbase);
+  void RecordDestroy(const std::string& segname);
+  void RecordResize(void* old_segbase, void* new_segbase, size_t new_size);
+  void RecordBegin(trans_t tid, int numsegs, void** segbases, int flags);
+  // ABOUT_TO_MODIFY or TRY_ABOUT_TO_MODIFY
+  void RecordAboutToModify(Op op, trans_t tid, void* segbase, int offset, int size);
+  void RecordAboutToModifyMany(trans_t tid, const rvm_range_t* ranges, int count);
+  void RecordAtomicWrite(void* segbase, const rvm_write_t* writes, int count);
+  void RecordAddInt64(trans_t tid, void* segbase, int offset, int64_t delta);
+  void RecordSetBit(trans_t tid, void* segbase, int offset, int bit, int value);
+  void RecordAppend(trans_t tid, void* segbase, int offset, int capacity, int size);
+  // COMMIT, COMMIT_NO_FLUSH, COMMIT_ASYNC or ABORT
+  void RecordEnd(Op op, trans_t tid);
+  // TRUNCATE or FLUSH
+  void RecordCall(Op op);
+  void RecordSetOption(int option, long value);
+  // Calls the replay can not issue are kept in the trace by name
+  void RecordUnsupported(const char* call);
+
+ private:
+  std::atomic<bool> enabled_;
+  std::mutex mutex_; // Guards everything below
+  FILE* file_;
+  uint64_t last_ns_;
+  uint32_t next_segment_id_;
+  std::unordered_map<void*, uint32_t> segment_ids_;
+
+  bool is_enabled() const {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  // Looks up the id of a recorded segment, false if file_ is closed too
+  bool FindSegment(void* segbase, uint32_t* id);
+  void WriteOp(Op op);
+  void WriteVarint(uint64_t value);
+  void WriteName(const std::string& name);
+};
+
+// Issues writes and syncs against file descriptors. Queued operations may
+// run in any order and are only known to be done once Submit() returns, so
+// callers submit before queueing a write that overlaps a queued one and
+// keep the buffers alive until then. A sync covers every write queued
+// before it. An engine is not thread safe.
+class RvmIoEngine {
+ public:
+  virtual ~RvmIoEngine() {};
+
+  virtual void QueueWrite(int fd, const void* buf, size_t size, uint64_t offset) = 0;
+  // Reads stop early at the end of the file and leave the rest of buf as is
+  virtual void QueueRead(int fd, void* buf, size_t size, uint64_t offset) = 0;
+  virtual void QueueSync(int fd) = 0;
+  // Runs everything queued and waits for it, false if any of it failed
+  virtual bool Submit() = 0;
+  virtual const char* get_name() const = 0;
+
+  // Returns nullptr if the engine kind is not available
+  static RvmIoEngine* Create(int kind);
+};
+
+// fdatasync()s the file or directory at path, for files written through
+// streams and for directory entries a rename or a new file changed
+bool rvm_sync_path(const std::string& path);
+
+// Persistent heap kept at the start of a segment. All allocator metadata
+// lives in the segment itself and is only changed after an AboutToModify()
+// on the owning transaction, so it commits and aborts with the transaction.
+#define RVM_HEAP_MAGIC 0x5041454847525652ULL // "RVMGHEAP"
+#define RVM_HEAP_MIN_BLOCK 16
+#define RVM_HEAP_NUM_CLASSES 28
+#define RVM_HEAP_ALLOCATED (1ULL << 63)
+
+class RvmHeap {
+ public:
+  RvmHeap(RvmTransaction* rvm_trans, RvmSegment* segment)
+          : rvm_trans_(rvm_trans), segment_(segment) {};
+
+  // Returns nullptr if the segment is full or a range could not be locked
+  void* Allocate(size_t size);
+  bool IsAllocated(void* ptr);
+  // Frees a block IsAllocated() accepted, returns false if a range could
+  // not be locked
+  bool Free(void* ptr);
+
+ private:
+  struct Header {
+    uint64_t magic;
+    uint64_t top; // Offset of the first never-allocated byte
+    uint64_t free_lists[RVM_HEAP_NUM_CLASSES]; // Offset of first free block per size class
+  };
+
+  // Precedes every allocation, keeps the payload 16-byte aligned
+  struct BlockHeader {
+    uint64_t size_class; // Size class index, RVM_HEAP_ALLOCATED set while in use
+    uint64_t next_free; // Offset of the next free block in the same class
+  };
+
+  RvmTransaction* rvm_trans_;
+  RvmSegment* segment_;
+
+  Header* get_header();
+  bool Modify(const void* field, size_t size);
+};
+
+// Single file that packs the backing data of many segments. Each segment
+// owns one extent of the data file. The directory that maps segment names
+// to extents is an append-only journal that is compacted once most of its
+// entries are stale.
+#define RVM_CONTAINER_COMPACT_SLACK 1024
+
+class RvmContainer {
+ public:
+  RvmContainer(std::string directory);
+  ~RvmContainer();
+
+  bool Open();
+  size_t ReadSegment(const std::string& segname, char* buf, size_t size);
+  // With sync set, the data and the directory entry that points at it are
+  // on disk before the space or files the segment used before are freed
+  bool ApplyRecords(const std::string& segname, const std::list<RedoRecord*>& records, bool sync);
+  bool RemoveSegment(const std::string& segname, bool sync);
+
+  static bool Exists(const std::string& directory) {
+    struct stat buffer;
+    return (stat((directory + "/" + "container_dir.rvm").c_str(), &buffer) == 0);
+  }
+
+ private:
+  struct Extent {
+    uint64_t offset;
+    uint64_t capacity;
+    uint64_t length;
+  };
+
+  std::string directory_;
+  std::string data_path_;
+  std::string dir_path_;
+  std::string tmp_dir_path_;
+  std::mutex mutex_; // Guards all container state
+  int data_fd_;
+  uint64_t data_end_;
+  size_t journal_entries_;
+  bool names_synced_; // Whether the directory holding the files was synced
+  std::unordered_map<std::string, Extent> extents_;
+  std::map<uint64_t, uint64_t> free_extents_; // Offset to size of free space
+  std::unordered_set<std::string> legacy_segments_; // Segments still in their own file
+
+  inline std::string legacy_path(const std::string& segname) {
+    return directory_ + "/" + "seg_" + segname + ".rvm";
+  }
+
+  bool LoadDirectory();
+  bool CopyIntoExtent(const std::string& segname, const Extent& old_extent, bool is_legacy, uint64_t offset);
+  bool WriteZeros(uint64_t offset, uint64_t size);
+  uint64_t Allocate(uint64_t capacity);
+  void Release(uint64_t offset, uint64_t capacity);
+  bool AppendEntry(int type, const std::string& segname, const Extent* extent);
+  bool SyncDirectory();
+  bool CompactDirectory();
+  void WriteEntry(std::ofstream& dir_file, int type, const std::string& segname, const Extent* extent);
 };
 
 class Rvm {
@@ -177,15 +893,61 @@ class Rvm {
   ~Rvm();
 
   void* MapSegment(std::string segname, size_t segsize);
+  void* MapFixedSegment(std::string segname, size_t segsize, void* addr);
+  int MapSegments(int count, const char** segnames, const int* sizes, void** segbases);
   void UnmapSegment(void* segbase);
   void DestroySegment(std::string segname);
-  trans_t BeginTransaction(int numsegs, void** segbases);
-  void CommitTransaction(RvmTransaction* rvm_trans);
+  void* ResizeSegment(void* segbase, size_t new_size);
+  int AtomicWrite(void* segbase, const rvm_write_t* writes, int count);
+  trans_t BeginTransaction(int numsegs, void** segbases, int flags);
+  trans_t BeginReadTransaction();
+  int Read(RvmTransaction* rvm_trans, void* segbase, size_t offset, void* dest, size_t size);
+  // Returns the commit's durability ticket, 0 if nothing was logged
+  uint64_t CommitTransaction(RvmTransaction* rvm_trans, bool flush = true);
   void AbortTransaction(RvmTransaction* rvm_trans);
   void TruncateLog();
+  bool Flush();
+  bool IsDurable(uint64_t ticket);
+  void SetDurableCallback(rvm_durable_callback_t callback, void* arg);
+
+  RvmCommitHandle* CommitTransactionAsync(RvmTransaction* rvm_trans);
+  // 1 once durable, -1 if the log write failed, 0 while in flight
+  int PollCommit(RvmCommitHandle* handle);
+  bool WaitCommit(RvmCommitHandle* handle);
+  void SetCommitCallback(RvmCommitHandle* handle, rvm_commit_callback_t callback, void* arg);
+  int GetCommitEventFd(RvmCommitHandle* handle);
+  void ReleaseCommit(RvmCommitHandle* handle);
+  int SetOption(int option, long value);
+  void GetStats(rvm_stats_t* stats);
+
+  RvmStats& get_stats() {
+    return stats_;
+  }
+
+  RvmTracer& get_tracer() {
+    return tracer_;
+  }
+
+  RvmRecorder& get_recorder() {
+    return recorder_;
+  }
+
+  int StartRecording(const std::string& path);
+
+  void ReadBackingStore(const std::string& segname, char* base, size_t size);
 
   std::list<RedoRecord*> GetRedoRecordsForSegment(RvmSegment* segment);
 
+  uint32_t GetSegmentId(void* segbase);
+
+  void* GetSegmentBase(uint32_t segid) const {
+    if (segid >= RVM_MAX_SEGMENT_ID) {
+      return nullptr;
+    }
+    std::atomic<char*>* chunk = segment_bases_[segid / RVM_SEGMENT_TABLE_CHUNK].load(std::memory_order_acquire);
+    return (chunk != nullptr) ? chunk[segid % RVM_SEGMENT_TABLE_CHUNK].load(std::memory_order_acquire) : nullptr;
+  }
+
   inline std::string construct_segment_path(std::string segname) {
     return directory_ + "/" + "seg_" + segname + ".rvm";
   }
@@ -194,14 +956,90 @@ class Rvm {
   std::string directory_;
   std::string log_path_;
   std::string tmp_log_path_;
+
+  // Lock order is segment_mutex_ before log_mutex_.
+  // segment_mutex_ guards the segment maps, segment ownership and the
+  // segment metadata; log_mutex_ guards the committed transactions, the
+  // log file and the backing store.
+  std::mutex segment_mutex_;
+  std::mutex log_mutex_;
+
   std::unordered_map<std::string, RvmSegment*> name_to_segment_map_;
   std::unordered_map<void*, RvmSegment*> base_to_segment_map_;
   std::list<RvmTransaction*> committed_transactions_;
+  int log_fd_; // Kept open for appends between truncations
+  uint64_t log_end_; // Offset of the next append to log_fd_
+  uint64_t log_alloc_end_; // Bytes of the log file allocated so far
+  bool direct_log_;
+  char* direct_buf_; // Block-aligned staging buffer for direct log writes
+  size_t direct_buf_size_;
+  RvmContainer* container_; // Packs segment data into one file when set
+
+  // Snapshot reads. commit_seq_ counts logged transactions and snapshots_
+  // holds the sequence number each open reader reads at. Both are guarded
+  // by log_mutex_.
+  bool snapshots_enabled_;
+  uint64_t commit_seq_;
+  std::multiset<uint64_t> snapshots_;
+
+  // No-flush commits wait in pending_log_ until the next flush. Commits up
+  // to durable_seq_ are in the log file. Guarded by log_mutex_.
+  std::ostringstream pending_log_;
+  size_t log_buffer_limit_;
+  int compression_; // Codec for redo data written to the log
+  uint64_t durable_seq_;
+  uint64_t failed_seq_; // Newest commit whose log write failed
+  rvm_durable_callback_t durable_callback_;
+  void* durable_callback_arg_;
+
+  // Flushing commits and flusher_, which writes asynchronous commits, take
+  // the buffered entries under log_mutex_ and write them under
+  // log_write_mutex_ alone, so commits keep filling the buffer during the
+  // write. Lock order is log_mutex_ before log_write_mutex_, which guards
+  // log_fd_ and the direct log state.
+  std::mutex log_write_mutex_;
+  // Entries taken from pending_log_ whose write failed. They are written
+  // ahead of newer entries so the log keeps commit order.
+  std::string unwritten_log_;
+  std::condition_variable durable_cv_;
+  bool log_writing_; // A flushing commit is writing for the others waiting on durable_cv_
+  std::condition_variable flush_cv_;
+  std::thread flusher_;
+  bool flush_requested_;
+  bool flusher_stop_;
+  std::list<RvmCommitHandle*> waiting_commits_; // Handles with a callback or eventfd
+
+  // log_io_ writes the log under log_write_mutex_, backing_io_ writes the
+  // backing files under log_mutex_ during truncation. With sync_writes_
+  // set both are followed by fdatasync().
+  int io_engine_kind_;
+  RvmIoEngine* log_io_;
+  RvmIoEngine* backing_io_;
+  bool sync_writes_;
+
+  // Persistent segment ids used by rvm::ptr. The table from id to mapped
+  // base is split into chunks that are allocated on first use and never
+  // move, so it can be read without a lock.
+  std::string segment_meta_path_;
+  std::unordered_map<std::string, uint32_t> segment_ids_;
+  std::atomic<std::atomic<char*>*> segment_bases_[RVM_MAX_SEGMENT_ID / RVM_SEGMENT_TABLE_CHUNK];
+  uint32_t next_segment_id_;
+
+  // Recorded addresses of segments mapped with rvm_map_fixed()
+  std::unordered_map<std::string, uint64_t> segment_addresses_;
+
+  RvmStats stats_;
+  RvmTracer tracer_;
+  RvmRecorder recorder_;
 
   inline std::string construct_log_path() {
     return directory_ + "/" + "redo_log.rvm";
   }
 
+  inline std::string construct_segment_meta_path() {
+    return directory_ + "/" + "segment_meta.rvm";
+  }
+
   inline std::string construct_tmp_path(std::string path) {
     return path + ".tmp";
   }
@@ -211,15 +1049,39 @@ class Rvm {
     return (stat (name.c_str(), &buffer) == 0);
   }
 
-  trans_t get_next_transaction_id() {
-    return g_trans_id.fetch_add(1);
-  }
+  trans_t get_next_transaction_id();
+  void* MapSegmentLocked(std::string segname, size_t segsize, char* fixed_base);
+  void AddSegmentLocked(RvmSegment* rvm_segment);
+  uint64_t LogTransaction(RvmTransaction* rvm_trans, bool flush = true);
+  bool FlushLogLocked();
+  bool WritePendingLocked(std::unique_lock<std::mutex>& lock);
+  bool WriteLog(const std::string& pending);
+  bool AppendToLog(const char* data, size_t size);
+  bool OpenLog();
+  bool StageDirectLogWrite(const char* data, size_t size, uint64_t* start, size_t* length);
+  bool SkipLogPadding(std::ifstream& log_file, long file_size);
+  void NotifyDurable(uint64_t old_durable_seq);
+  void PublishDurableLocked(uint64_t seq);
+  void CompleteCommitLocked(RvmCommitHandle* handle);
+  void FlusherMain();
+  void EndReadTransaction(RvmTransaction* rvm_trans);
 
   RvmTransaction* ParseTransaction(std::ifstream& log_file);
-  RedoRecord* ParseRedoRecord(std::ifstream& log_file);
-  void WriteTransactionToLog(std::ofstream& log_file, RvmTransaction* rvm_trans);
-  void WriteRecordsToLog(std::ofstream& log_file, const std::list<RedoRecord*>& records);
+  RedoRecord* ParseRedoRecord(std::istream& log_file);
+  void WriteTransactionToLog(std::ostream& log_file, RvmTransaction* rvm_trans);
+  void WriteRecordsToLog(std::ostream& log_file, const std::list<RedoRecord*>& records);
+  void WriteCompressedRecords(std::ostream& log_file, const std::list<RedoRecord*>& records);
   bool ApplyRecordsToBackingFile(const std::string& segname, const std::list<RedoRecord*>& records);
+  // Returns whether records held logical records to fold
+  bool FoldLogicalRecords(const std::string& segname, std::list<RedoRecord*>& records);
+  // Writes rvm_trans, if any, to a new log that replaces the current one.
+  // The caller holds log_mutex_ and log_write_mutex_.
+  void ReplaceLog(RvmTransaction* rvm_trans);
+  bool ZeroBackingRange(int fd, uint64_t file_size, uint64_t offset, uint64_t size);
+  void LoadSegmentMetadata();
+  uint32_t AssignSegmentId(const std::string& segname);
+  bool AppendSegmentMetadata(int type, const std::string& segname, const void* value, size_t size);
+  void set_segment_base(uint32_t segid, char* base);
 
 };
 
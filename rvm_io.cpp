@@ -0,0 +1,392 @@
+#include "rvm.h"
+#include "rvm_internal.h"
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+static bool write_fully(int fd, const char* buf, size_t size, uint64_t offset) {
+  while (size > 0) {
+    ssize_t written = pwrite(fd, buf, size, offset);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    buf += written;
+    size -= written;
+    offset += written;
+  }
+  return true;
+}
+
+static bool read_fully(int fd, char* buf, size_t size, uint64_t offset) {
+  while (size > 0) {
+    ssize_t num_read = pread(fd, buf, size, offset);
+    if (num_read < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    if (num_read == 0) {
+      // End of file
+      break;
+    }
+    buf += num_read;
+    size -= num_read;
+    offset += num_read;
+  }
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// RvmPosixIoEngine functions
+///////////////////////////////////////////////////////////////////////////////
+// Runs every operation as soon as it is queued
+class RvmPosixIoEngine : public RvmIoEngine {
+ public:
+  RvmPosixIoEngine() : failed_(false) {};
+
+  void QueueWrite(int fd, const void* buf, size_t size, uint64_t offset) {
+    if (!write_fully(fd, (const char*) buf, size, offset)) {
+      failed_ = true;
+    }
+  }
+
+  void QueueRead(int fd, void* buf, size_t size, uint64_t offset) {
+    if (!read_fully(fd, (char*) buf, size, offset)) {
+      failed_ = true;
+    }
+  }
+
+  void QueueSync(int fd) {
+    if (fdatasync(fd) != 0) {
+      failed_ = true;
+    }
+  }
+
+  bool Submit() {
+    bool success = !failed_;
+    failed_ = false;
+    return success;
+  }
+
+  const char* get_name() const {
+    return "posix";
+  }
+
+ private:
+  bool failed_;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// RvmUringIoEngine functions
+///////////////////////////////////////////////////////////////////////////////
+// Queues operations in an io_uring submission ring and submits them with
+// one system call. Writes may run in any order, so callers must submit
+// before queueing a write that overlaps one already queued. A sync is
+// drained behind everything queued before it.
+#define RVM_URING_ENTRIES 64
+
+class RvmUringIoEngine : public RvmIoEngine {
+ public:
+  RvmUringIoEngine();
+  ~RvmUringIoEngine();
+
+  bool Init();
+  void QueueWrite(int fd, const void* buf, size_t size, uint64_t offset);
+  void QueueRead(int fd, void* buf, size_t size, uint64_t offset);
+  void QueueSync(int fd);
+  bool Submit();
+
+  const char* get_name() const {
+    return "io_uring";
+  }
+
+ private:
+  struct Op {
+    int fd;
+    const char* buf;
+    size_t size;
+    uint64_t offset;
+    bool sync;
+    bool read;
+  };
+
+  int ring_fd_;
+  unsigned int entries_;
+  void* sq_ring_;
+  size_t sq_ring_size_;
+  void* cq_ring_;
+  size_t cq_ring_size_;
+  struct io_uring_sqe* sqes_;
+  size_t sqes_size_;
+
+  unsigned int* sq_tail_;
+  unsigned int* sq_mask_;
+  unsigned int* sq_array_;
+  unsigned int* cq_head_;
+  unsigned int* cq_tail_;
+  unsigned int* cq_mask_;
+  struct io_uring_cqe* cqes_;
+
+  pid_t pid_; // The ring is shared with forked children, which must not use it
+  Op ops_[RVM_URING_ENTRIES];
+  unsigned int num_queued_;
+  bool failed_;
+
+  struct io_uring_sqe* NextSqe(const Op& op);
+  void Complete(const Op& op, int result);
+};
+
+RvmUringIoEngine::RvmUringIoEngine()
+        : ring_fd_(-1), entries_(0), sq_ring_(MAP_FAILED), sq_ring_size_(0), cq_ring_(MAP_FAILED),
+          cq_ring_size_(0), sqes_((struct io_uring_sqe*) MAP_FAILED), sqes_size_(0), pid_(getpid()), num_queued_(0), failed_(false) {
+}
+
+RvmUringIoEngine::~RvmUringIoEngine() {
+  if (sqes_ != MAP_FAILED) {
+    munmap(sqes_, sqes_size_);
+  }
+  if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+    munmap(cq_ring_, cq_ring_size_);
+  }
+  if (sq_ring_ != MAP_FAILED) {
+    munmap(sq_ring_, sq_ring_size_);
+  }
+  if (ring_fd_ >= 0) {
+    close(ring_fd_);
+  }
+}
+
+bool RvmUringIoEngine::Init() {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring_fd_ = (int) syscall(__NR_io_uring_setup, RVM_URING_ENTRIES, &params);
+  if (ring_fd_ < 0) {
+    return false;
+  }
+  entries_ = params.sq_entries;
+
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    // Both rings share one mapping
+    sq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    cq_ring_size_ = sq_ring_size_;
+  }
+
+  sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  ring_fd_, IORING_OFF_SQ_RING);
+  if (sq_ring_ == MAP_FAILED) {
+    return false;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    cq_ring_ = sq_ring_;
+  } else {
+    cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    ring_fd_, IORING_OFF_CQ_RING);
+    if (cq_ring_ == MAP_FAILED) {
+      return false;
+    }
+  }
+
+  sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  sqes_ = (struct io_uring_sqe*) mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                      ring_fd_, IORING_OFF_SQES);
+  if (sqes_ == MAP_FAILED) {
+    return false;
+  }
+
+  char* sq = (char*) sq_ring_;
+  char* cq = (char*) cq_ring_;
+  sq_tail_ = (unsigned int*) (sq + params.sq_off.tail);
+  sq_mask_ = (unsigned int*) (sq + params.sq_off.ring_mask);
+  sq_array_ = (unsigned int*) (sq + params.sq_off.array);
+  cq_head_ = (unsigned int*) (cq + params.cq_off.head);
+  cq_tail_ = (unsigned int*) (cq + params.cq_off.tail);
+  cq_mask_ = (unsigned int*) (cq + params.cq_off.ring_mask);
+  cqes_ = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+  if (entries_ > RVM_URING_ENTRIES) {
+    entries_ = RVM_URING_ENTRIES;
+  }
+  return true;
+}
+
+struct io_uring_sqe* RvmUringIoEngine::NextSqe(const Op& op) {
+  if (num_queued_ == entries_) {
+    // Ring is full, so run what is queued first
+    if (!Submit()) {
+      failed_ = true;
+    }
+  }
+
+  unsigned int tail = *sq_tail_ + num_queued_;
+  unsigned int index = tail & *sq_mask_;
+  struct io_uring_sqe* sqe = &sqes_[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sq_array_[index] = index;
+  sqe->user_data = num_queued_;
+  ops_[num_queued_] = op;
+  num_queued_++;
+  return sqe;
+}
+
+void RvmUringIoEngine::QueueWrite(int fd, const void* buf, size_t size, uint64_t offset) {
+  Op op = { fd, (const char*) buf, size, offset, false, false };
+  if (pid_ != getpid()) {
+    Complete(op, 0);
+    return;
+  }
+  struct io_uring_sqe* sqe = NextSqe(op);
+  sqe->opcode = IORING_OP_WRITE;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t) (uintptr_t) buf;
+  sqe->len = (uint32_t) size;
+  sqe->off = offset;
+}
+
+void RvmUringIoEngine::QueueRead(int fd, void* buf, size_t size, uint64_t offset) {
+  Op op = { fd, (const char*) buf, size, offset, false, true };
+  if (pid_ != getpid()) {
+    Complete(op, 0);
+    return;
+  }
+  struct io_uring_sqe* sqe = NextSqe(op);
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t) (uintptr_t) buf;
+  sqe->len = (uint32_t) size;
+  sqe->off = offset;
+}
+
+void RvmUringIoEngine::QueueSync(int fd) {
+  Op op = { fd, nullptr, 0, 0, true, false };
+  if (pid_ != getpid()) {
+    Complete(op, -EINVAL);
+    return;
+  }
+  struct io_uring_sqe* sqe = NextSqe(op);
+  sqe->opcode = IORING_OP_FSYNC;
+  sqe->fd = fd;
+  sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+  sqe->flags = IOSQE_IO_DRAIN;
+}
+
+void RvmUringIoEngine::Complete(const Op& op, int result) {
+  if (op.sync) {
+    if (result == -EINVAL || result == -EOPNOTSUPP) {
+      result = fdatasync(op.fd);
+    }
+    if (result < 0) {
+      failed_ = true;
+    }
+    return;
+  }
+
+  if (result == -EINVAL || result == -EOPNOTSUPP) {
+    // Kernel without IORING_OP_WRITE or IORING_OP_READ, so do it directly
+    result = 0;
+  } else if (result < 0) {
+    failed_ = true;
+    return;
+  }
+
+  // Finish short writes and reads directly
+  size_t done = (size_t) result;
+  if (done < op.size) {
+    bool success;
+    if (op.read) {
+      success = read_fully(op.fd, (char*) op.buf + done, op.size - done, op.offset + done);
+    } else {
+      success = write_fully(op.fd, op.buf + done, op.size - done, op.offset + done);
+    }
+    if (!success) {
+      failed_ = true;
+    }
+  }
+}
+
+bool RvmUringIoEngine::Submit() {
+  unsigned int count = num_queued_;
+  if (count > 0) {
+    __atomic_store_n(sq_tail_, *sq_tail_ + count, __ATOMIC_RELEASE);
+
+    unsigned int submitted = 0;
+    unsigned int completed = 0;
+    while (completed < count) {
+      int ret = (int) syscall(__NR_io_uring_enter, ring_fd_, count - submitted, count - completed,
+                              IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (ret < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+#if DEBUG
+        std::cerr << "RvmUringIoEngine::Submit(): io_uring_enter failed: " << strerror(errno) << std::endl;
+#endif
+        failed_ = true;
+        break;
+      }
+      submitted += (unsigned int) ret;
+
+      unsigned int head = *cq_head_;
+      unsigned int tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+      while (head != tail) {
+        struct io_uring_cqe* cqe = &cqes_[head & *cq_mask_];
+        Complete(ops_[cqe->user_data], cqe->res);
+        head++;
+        completed++;
+      }
+      __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+    num_queued_ = 0;
+  }
+
+  bool success = !failed_;
+  failed_ = false;
+  return success;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// RvmIoEngine functions
+///////////////////////////////////////////////////////////////////////////////
+RvmIoEngine* RvmIoEngine::Create(int kind) {
+  if (kind == RVM_IO_ENGINE_URING || kind == RVM_IO_ENGINE_AUTO) {
+    RvmUringIoEngine* engine = new RvmUringIoEngine();
+    if (engine->Init()) {
+      return engine;
+    }
+    delete engine;
+    if (kind == RVM_IO_ENGINE_URING) {
+#if DEBUG
+      std::cerr << "RvmIoEngine::Create(): io_uring is not available" << std::endl;
+#endif
+      return nullptr;
+    }
+  } else if (kind != RVM_IO_ENGINE_POSIX) {
+#if DEBUG
+    std::cerr << "RvmIoEngine::Create(): Invalid engine " << kind << std::endl;
+#endif
+    return nullptr;
+  }
+  return new RvmPosixIoEngine();
+}
+
+bool rvm_sync_path(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+  bool success = (fdatasync(fd) == 0);
+  close(fd);
+  return success;
+}
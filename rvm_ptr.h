@@ -0,0 +1,72 @@
+#ifndef __LIBRVM_PTR__
+#define __LIBRVM_PTR__
+
+#include "rvm.h"
+#include <cstddef>
+#include <cstdint>
+
+namespace rvm {
+
+// Position-independent pointer for use inside recoverable segments.
+//
+// A raw pointer stored in a segment is only valid for the current mapping
+// of that segment. ptr<T> instead stores the persistent id of the target
+// segment together with the offset of the object inside it, and resolves
+// them through the base table of an rvm instance. Both fit in 8 bytes:
+// the upper 24 bits hold the segment id and the lower 40 bits the offset.
+// Segment id 0 is reserved for the null pointer.
+template <typename T>
+class ptr {
+ public:
+  ptr() : value_(0) {}
+
+  // Build a pointer to raw, which must lie inside the segment at segbase
+  ptr(rvm_t rvm, void* segbase, T* raw) : value_(0) {
+    if (raw != nullptr) {
+      uint64_t segid = rvm_segment_id(rvm, segbase);
+      uint64_t offset = (uint64_t) ((char*) raw - (char*) segbase);
+      if (segid != 0) {
+        value_ = (segid << OFFSET_BITS) | (offset & OFFSET_MASK);
+      }
+    }
+  }
+
+  // Returns nullptr if the target segment is not mapped in rvm
+  T* get(rvm_t rvm) const {
+    if (value_ == 0) {
+      return nullptr;
+    }
+    char* base = (char*) rvm_segment_base(rvm, get_segment_id());
+    return (base != nullptr) ? (T*) (base + get_offset()) : nullptr;
+  }
+
+  unsigned int get_segment_id() const {
+    return (unsigned int) (value_ >> OFFSET_BITS);
+  }
+
+  size_t get_offset() const {
+    return (size_t) (value_ & OFFSET_MASK);
+  }
+
+  bool is_null() const {
+    return value_ == 0;
+  }
+
+  bool operator==(const ptr& other) const {
+    return value_ == other.value_;
+  }
+
+  bool operator!=(const ptr& other) const {
+    return value_ != other.value_;
+  }
+
+ private:
+  static const int OFFSET_BITS = 40;
+  static const uint64_t OFFSET_MASK = (1ULL << OFFSET_BITS) - 1;
+
+  uint64_t value_;
+};
+
+} // namespace rvm
+
+#endif
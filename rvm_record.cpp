@@ -0,0 +1,758 @@
+#include "rvm.h"
+#include "rvm_internal.h"
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include <climits>
+#include <algorithm>
+
+// Workload trace format. The file starts with RVM_RECORD_MAGIC, which ends
+// in the format version. Every call follows as one op byte, the
+// nanoseconds since the previous call as an unsigned LEB128 varint, and
+// the op's fields, also varints:
+//
+//   MAP             segment id, size, name length, name bytes
+//   UNMAP           segment id
+//   DESTROY         name length, name bytes
+//   RESIZE          segment id, new size
+//   BEGIN           transaction, segment count, segment ids
+//   BEGIN_FLAGS     transaction, flags, segment count, segment ids
+//   ABOUT_TO_MODIFY, TRY_ABOUT_TO_MODIFY
+//                   transaction, segment id, offset, size
+//   ABOUT_TO_MODIFY_V
+//                   transaction, range count, segment id, offset and size
+//                   of each range
+//   ATOMIC_WRITE    segment id, write count, offset and size of each write
+//   ADD_INT64       transaction, segment id, offset, delta as two's
+//                   complement
+//   SET_BIT         transaction, segment id, offset, bit, value
+//   APPEND          transaction, segment id, offset, capacity, size
+//   COMMIT, COMMIT_NO_FLUSH, COMMIT_ASYNC, ABORT
+//                   transaction
+//   TRUNCATE, FLUSH nothing
+//   SET_OPTION      option, value as two's complement
+//   UNSUPPORTED     call name length, call name bytes
+//
+// Segment ids are handed out by the recorder as segments are mapped; every
+// map call, fixed or batched, is written as MAP records. Transactions are
+// recorded as the trans_t handles of the recording instance. Commits and
+// aborts are recorded before the call and maps, resizes and begins after
+// it returns, so the order of the trace is one the calls of all threads
+// could have run in. Calls the replay can not reproduce, such as
+// savepoints and heap allocations, are written as UNSUPPORTED so a trace
+// shows where it differs from the recorded workload.
+#define RVM_RECORD_MAGIC "RVMWKLD1"
+#define RVM_RECORD_MAGIC_SIZE 8
+
+RvmRecorder::~RvmRecorder() {
+  Stop();
+}
+
+bool RvmRecorder::Start(const std::string& path, const std::vector<RvmSegment*>& segments) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (file_ != nullptr) {
+#if DEBUG
+    std::cerr << "RvmRecorder::Start(): Already recording" << std::endl;
+#endif
+    return false;
+  }
+  file_ = fopen(path.c_str(), "wb");
+  if (file_ == nullptr) {
+#if DEBUG
+    std::cerr << "RvmRecorder::Start(): Could not open " << path << std::endl;
+#endif
+    return false;
+  }
+  fwrite(RVM_RECORD_MAGIC, 1, RVM_RECORD_MAGIC_SIZE, file_);
+  last_ns_ = rvm_now_ns();
+  next_segment_id_ = 1;
+  segment_ids_.clear();
+  for (RvmSegment* segment : segments) {
+    uint32_t id = next_segment_id_++;
+    segment_ids_[segment->get_base_ptr()] = id;
+    WriteOp(MAP);
+    WriteVarint(id);
+    WriteVarint(segment->get_size());
+    WriteName(segment->get_name());
+  }
+  enabled_.store(true, std::memory_order_relaxed);
+  return true;
+}
+
+bool RvmRecorder::Stop() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (file_ == nullptr) {
+    return false;
+  }
+  enabled_.store(false, std::memory_order_relaxed);
+  bool success = (fclose(file_) == 0);
+  file_ = nullptr;
+  return success;
+}
+
+void RvmRecorder::RecordMap(void* segbase, const std::string& segname, size_t size) {
+  if (!is_enabled()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (file_ == nullptr) {
+    return;
+  }
+  uint32_t id = next_segment_id_++;
+  segment_ids_[segbase] = id;
+  WriteOp(MAP);
+  WriteVarint(id);
+  WriteVarint(size);
+  WriteName(segname);
+}
+
+void RvmRecorder::RecordUnmap(void* segbase) {
+  if (!is_enabled()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint32_t id;
+  if (!FindSegment(segbase, &id)) {
+    return;
+  }
+  WriteOp(UNMAP);
+  WriteVarint(id);
+  segment_ids_.erase(segbase);
+}
+
+void RvmRecorder::RecordDestroy(const std::string& segname) {
+  if (!is_enabled()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (file_ == nullptr) {
+    return;
+  }
+  WriteOp(DESTROY);
+  WriteName(segname);
+}
+
+void RvmRecorder::RecordResize(void* old_segbase, void* new_segbase, size_t new_size) {
+  if (!is_enabled()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint32_t id;
+  if (!FindSegment(old_segbase, &id)) {
+    return;
+  }
+  // A resize may move the segment
+  segment_ids_.erase(old_segbase);
+  segment_ids_[new_segbase] = id;
+  WriteOp(RESIZE);
+  WriteVarint(id);
+  WriteVarint(new_size);
+}
+
+void RvmRecorder::RecordBegin(trans_t tid, int numsegs, void** segbases, int flags) {
+  if (!is_enabled()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<uint32_t> ids(numsegs);
+  for (int i = 0; i < numsegs; i++) {
+    if (!FindSegment(segbases[i], &ids[i])) {
+      // Mapped before a previous recording stopped, the replay can not know it
+      return;
+    }
+  }
+  if (flags == 0) {
+    WriteOp(BEGIN);
+    WriteVarint((uint32_t) tid);
+  } else {
+    WriteOp(BEGIN_FLAGS);
+    WriteVarint((uint32_t) tid);
+    WriteVarint((uint32_t) flags);
+  }
+  WriteVarint(ids.size());
+  for (uint32_t id : ids) {
+    WriteVarint(id);
+  }
+}
+
+void RvmRecorder::RecordAboutToModify(Op op, trans_t tid, void* segbase, int offset, int size) {
+  if (!is_enabled()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint32_t id;
+  if (!FindSegment(segbase, &id)) {
+    return;
+  }
+  WriteOp(op);
+  WriteVarint((uint32_t) tid);
+  WriteVarint(id);
+  WriteVarint((uint32_t) offset);
+  WriteVarint((uint32_t) size);
+}
+
+void RvmRecorder::RecordAboutToModifyMany(trans_t tid, const rvm_range_t* ranges, int count) {
+  if (!is_enabled()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<uint32_t> ids(count);
+  for (int i = 0; i < count; i++) {
+    if (!FindSegment(ranges[i].segbase, &ids[i])) {
+      return;
+    }
+  }
+  WriteOp(ABOUT_TO_MODIFY_V);
+  WriteVarint((uint32_t) tid);
+  WriteVarint((uint32_t) count);
+  for (int i = 0; i < count; i++) {
+    WriteVarint(ids[i]);
+    WriteVarint((uint32_t) ranges[i].offset);
+    WriteVarint((uint32_t) ranges[i].size);
+  }
+}
+
+void RvmRecorder::RecordAtomicWrite(void* segbase, const rvm_write_t* writes, int count) {
+  if (!is_enabled()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint32_t id;
+  if (!FindSegment(segbase, &id)) {
+    return;
+  }
+  WriteOp(ATOMIC_WRITE);
+  WriteVarint(id);
+  WriteVarint((uint32_t) count);
+  for (int i = 0; i < count; i++) {
+    WriteVarint((uint32_t) writes[i].offset);
+    WriteVarint((uint32_t) writes[i].size);
+  }
+}
+
+void RvmRecorder::RecordAddInt64(trans_t tid, void* segbase, int offset, int64_t delta) {
+  if (!is_enabled()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint32_t id;
+  if (!FindSegment(segbase, &id)) {
+    return;
+  }
+  WriteOp(ADD_INT64);
+  WriteVarint((uint32_t) tid);
+  WriteVarint(id);
+  WriteVarint((uint32_t) offset);
+  WriteVarint((uint64_t) delta);
+}
+
+void RvmRecorder::RecordSetBit(trans_t tid, void* segbase, int offset, int bit, int value) {
+  if (!is_enabled()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint32_t id;
+  if (!FindSegment(segbase, &id)) {
+    return;
+  }
+  WriteOp(SET_BIT);
+  WriteVarint((uint32_t) tid);
+  WriteVarint(id);
+  WriteVarint((uint32_t) offset);
+  WriteVarint((uint32_t) bit);
+  WriteVarint(value != 0 ? 1 : 0);
+}
+
+void RvmRecorder::RecordAppend(trans_t tid, void* segbase, int offset, int capacity, int size) {
+  if (!is_enabled()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint32_t id;
+  if (!FindSegment(segbase, &id)) {
+    return;
+  }
+  WriteOp(APPEND);
+  WriteVarint((uint32_t) tid);
+  WriteVarint(id);
+  WriteVarint((uint32_t) offset);
+  WriteVarint((uint32_t) capacity);
+  WriteVarint((uint32_t) size);
+}
+
+void RvmRecorder::RecordEnd(Op op, trans_t tid) {
+  if (!is_enabled()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (file_ == nullptr) {
+    return;
+  }
+  WriteOp(op);
+  WriteVarint((uint32_t) tid);
+}
+
+void RvmRecorder::RecordCall(Op op) {
+  if (!is_enabled()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (file_ == nullptr) {
+    return;
+  }
+  WriteOp(op);
+}
+
+void RvmRecorder::RecordSetOption(int option, long value) {
+  if (!is_enabled()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (file_ == nullptr) {
+    return;
+  }
+  WriteOp(SET_OPTION);
+  WriteVarint((uint32_t) option);
+  WriteVarint((uint64_t) value);
+}
+
+void RvmRecorder::RecordUnsupported(const char* call) {
+  if (!is_enabled()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (file_ == nullptr) {
+    return;
+  }
+  WriteOp(UNSUPPORTED);
+  WriteName(std::string(call));
+}
+
+bool RvmRecorder::FindSegment(void* segbase, uint32_t* id) {
+  std::unordered_map<void*, uint32_t>::iterator it = segment_ids_.find(segbase);
+  if (file_ == nullptr || it == segment_ids_.end()) {
+    return false;
+  }
+  *id = it->second;
+  return true;
+}
+
+// Timestamps are taken under mutex_, so they grow in file order
+void RvmRecorder::WriteOp(Op op) {
+  uint64_t now = rvm_now_ns();
+  putc((int) op, file_);
+  WriteVarint(now - last_ns_);
+  last_ns_ = now;
+}
+
+void RvmRecorder::WriteVarint(uint64_t value) {
+  while (value >= 0x80) {
+    putc((int) ((value & 0x7f) | 0x80), file_);
+    value >>= 7;
+  }
+  putc((int) value, file_);
+}
+
+void RvmRecorder::WriteName(const std::string& name) {
+  WriteVarint(name.size());
+  fwrite(name.data(), 1, name.size(), file_);
+}
+
+static bool read_varint(FILE* file, uint64_t* value) {
+  *value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int byte = getc(file);
+    if (byte == EOF) {
+      return false;
+    }
+    *value |= (uint64_t) (byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool read_name(FILE* file, std::string* name) {
+  uint64_t length;
+  if (!read_varint(file, &length) || length > NAME_MAX) {
+    return false;
+  }
+  name->resize((size_t) length);
+  return fread(&(*name)[0], 1, (size_t) length, file) == length;
+}
+
+static bool read_varints(FILE* file, int count, uint64_t* values) {
+  for (int i = 0; i < count; i++) {
+    if (!read_varint(file, &values[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Whether the replay's segment id holds size bytes at offset
+static bool in_segment(const std::unordered_map<uint64_t, size_t>& sizes, uint64_t id, uint64_t offset,
+                       uint64_t size) {
+  std::unordered_map<uint64_t, size_t>::const_iterator it = sizes.find(id);
+  return it != sizes.end() && size > 0 && size <= it->second && offset <= it->second - size;
+}
+
+// Reads the segment ids that follow a BEGIN or BEGIN_FLAGS op
+static bool read_begin_segments(FILE* file, const std::unordered_map<uint64_t, char*>& segbases,
+                                std::vector<void*>* bases, bool* known) {
+  uint64_t numsegs;
+  if (!read_varint(file, &numsegs) || numsegs > RVM_MAX_SEGMENT_ID) {
+    return false;
+  }
+  *known = true;
+  for (uint64_t i = 0; i < numsegs; i++) {
+    uint64_t id;
+    if (!read_varint(file, &id)) {
+      return false;
+    }
+    std::unordered_map<uint64_t, char*>::const_iterator it = segbases.find(id);
+    if (it == segbases.end()) {
+      *known = false;
+    } else {
+      bases->push_back(it->second);
+    }
+  }
+  return true;
+}
+
+// Replays the calls in the trace at path on rvm. The application's bytes
+// are not in the trace, so every about_to_modify range is overwritten with
+// a value that changes from call to call, which makes each commit log the
+// whole range; atomic writes and appends write such values too. Returns
+// the number of calls made, -1 if the trace can not be read. UNSUPPORTED
+// records are skipped and not counted.
+static int replay_trace(rvm_t rvm, FILE* file, int flags) {
+  std::unordered_map<uint64_t, char*> segbases;
+  std::unordered_map<uint64_t, size_t> sizes;
+  std::unordered_map<uint64_t, trans_t> transactions;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  uint64_t trace_ns = 0;
+  unsigned char generation = 0;
+  int calls = 0;
+  bool success = true;
+
+  int op;
+  while ((op = getc(file)) != EOF) {
+    uint64_t delta;
+    if (!read_varint(file, &delta)) {
+      success = false;
+      break;
+    }
+    trace_ns += delta;
+    if ((flags & RVM_REPLAY_MAX_SPEED) == 0) {
+      std::this_thread::sleep_until(start + std::chrono::nanoseconds(trace_ns));
+    }
+
+    uint64_t id;
+    uint64_t tid;
+    switch (op) {
+      case RvmRecorder::MAP: {
+        uint64_t size;
+        std::string segname;
+        if (!read_varint(file, &id) || !read_varint(file, &size) || !read_name(file, &segname)) {
+          success = false;
+          break;
+        }
+        char* segbase = (char*) rvm_map(rvm, segname.c_str(), (int) size);
+        calls++;
+        if (segbase != (char*) -1 && segbase != nullptr) {
+          segbases[id] = segbase;
+          sizes[id] = (size_t) size;
+        }
+        break;
+      }
+      case RvmRecorder::UNMAP: {
+        if (!read_varint(file, &id)) {
+          success = false;
+          break;
+        }
+        if (segbases.count(id) != 0) {
+          rvm_unmap(rvm, segbases[id]);
+          segbases.erase(id);
+          calls++;
+        }
+        break;
+      }
+      case RvmRecorder::DESTROY: {
+        std::string segname;
+        if (!read_name(file, &segname)) {
+          success = false;
+          break;
+        }
+        rvm_destroy(rvm, segname.c_str());
+        calls++;
+        break;
+      }
+      case RvmRecorder::RESIZE: {
+        uint64_t size;
+        if (!read_varint(file, &id) || !read_varint(file, &size)) {
+          success = false;
+          break;
+        }
+        if (segbases.count(id) != 0 && size > 0 && size <= INT_MAX) {
+          char* segbase = (char*) rvm_resize(rvm, segbases[id], (int) size);
+          calls++;
+          if (segbase != (char*) -1 && segbase != nullptr) {
+            segbases[id] = segbase;
+            sizes[id] = (size_t) size;
+          }
+        }
+        break;
+      }
+      case RvmRecorder::BEGIN:
+      case RvmRecorder::BEGIN_FLAGS: {
+        uint64_t begin_flags = 0;
+        std::vector<void*> bases;
+        bool known;
+        if (!read_varint(file, &tid) || (op == RvmRecorder::BEGIN_FLAGS && !read_varint(file, &begin_flags)) ||
+            !read_begin_segments(file, segbases, &bases, &known)) {
+          success = false;
+          break;
+        }
+        if (!known) {
+          break;
+        }
+        trans_t trans = rvm_begin_trans_flags(rvm, (int) bases.size(), bases.data(), (int) begin_flags);
+        calls++;
+        if (trans != (trans_t) -1) {
+          transactions[tid] = trans;
+        }
+        break;
+      }
+      case RvmRecorder::ABOUT_TO_MODIFY:
+      case RvmRecorder::TRY_ABOUT_TO_MODIFY: {
+        uint64_t offset;
+        uint64_t size;
+        if (!read_varint(file, &tid) || !read_varint(file, &id) || !read_varint(file, &offset) ||
+            !read_varint(file, &size)) {
+          success = false;
+          break;
+        }
+        if (transactions.count(tid) != 0 && in_segment(sizes, id, offset, size)) {
+          if (op == RvmRecorder::ABOUT_TO_MODIFY) {
+            rvm_about_to_modify(transactions[tid], segbases[id], (int) offset, (int) size);
+          } else if (rvm_try_about_to_modify(transactions[tid], segbases[id], (int) offset, (int) size) != 0) {
+            calls++;
+            break;
+          }
+          // A prime cycle, so ranges rewritten in a loop keep changing
+          generation = (unsigned char) (generation % 251 + 1);
+          memset(segbases[id] + offset, generation, (size_t) size);
+          calls++;
+        }
+        break;
+      }
+      case RvmRecorder::ABOUT_TO_MODIFY_V: {
+        uint64_t count;
+        if (!read_varint(file, &tid) || !read_varint(file, &count)) {
+          success = false;
+          break;
+        }
+        std::vector<rvm_range_t> ranges;
+        bool valid = true;
+        for (uint64_t i = 0; i < count && success; i++) {
+          uint64_t range[3];
+          success = read_varints(file, 3, range);
+          if (success && in_segment(sizes, range[0], range[1], range[2])) {
+            rvm_range_t entry = { segbases[range[0]], (int) range[1], (int) range[2] };
+            ranges.push_back(entry);
+          } else {
+            valid = false;
+          }
+        }
+        if (!success || !valid || count == 0 || transactions.count(tid) == 0) {
+          break;
+        }
+        rvm_about_to_modify_v(transactions[tid], ranges.data(), (int) ranges.size());
+        generation = (unsigned char) (generation % 251 + 1);
+        for (const rvm_range_t& range : ranges) {
+          memset((char*) range.segbase + range.offset, generation, (size_t) range.size);
+        }
+        calls++;
+        break;
+      }
+      case RvmRecorder::ATOMIC_WRITE: {
+        uint64_t count;
+        if (!read_varint(file, &id) || !read_varint(file, &count)) {
+          success = false;
+          break;
+        }
+        std::vector<rvm_write_t> writes;
+        size_t max_size = 0;
+        bool valid = true;
+        for (uint64_t i = 0; i < count && success; i++) {
+          uint64_t write[2];
+          success = read_varints(file, 2, write);
+          if (success && in_segment(sizes, id, write[0], write[1])) {
+            rvm_write_t entry = { (int) write[0], nullptr, (int) write[1] };
+            writes.push_back(entry);
+            max_size = std::max(max_size, (size_t) write[1]);
+          } else {
+            valid = false;
+          }
+        }
+        if (!success || !valid || count == 0) {
+          break;
+        }
+        generation = (unsigned char) (generation % 251 + 1);
+        std::vector<char> src(max_size, (char) generation);
+        for (rvm_write_t& write : writes) {
+          write.src = src.data();
+        }
+        rvm_atomic_writev(rvm, segbases[id], writes.data(), (int) writes.size());
+        calls++;
+        break;
+      }
+      case RvmRecorder::ADD_INT64:
+      case RvmRecorder::SET_BIT:
+      case RvmRecorder::APPEND: {
+        // Offset, then delta; bit and value; or capacity and size
+        uint64_t args[3];
+        if (!read_varint(file, &tid) || !read_varint(file, &id) ||
+            !read_varints(file, (op == RvmRecorder::ADD_INT64) ? 2 : 3, args)) {
+          success = false;
+          break;
+        }
+        if (transactions.count(tid) == 0 || segbases.count(id) == 0) {
+          break;
+        }
+        if (op == RvmRecorder::ADD_INT64 && in_segment(sizes, id, args[0], sizeof(int64_t))) {
+          rvm_add_int64(transactions[tid], segbases[id], (int) args[0], (long long) args[1]);
+          calls++;
+        } else if (op == RvmRecorder::SET_BIT && in_segment(sizes, id, args[0], 1) && args[1] < 8) {
+          rvm_set_bit(transactions[tid], segbases[id], (int) args[0], (int) args[1], (int) args[2]);
+          calls++;
+        } else if (op == RvmRecorder::APPEND && args[2] > 0 && args[2] <= args[1] &&
+                   in_segment(sizes, id, args[0], RVM_APPEND_HEADER_SIZE + args[1])) {
+          generation = (unsigned char) (generation % 251 + 1);
+          std::vector<char> data((size_t) args[2], (char) generation);
+          rvm_append(transactions[tid], segbases[id], (int) args[0], (int) args[1], data.data(), (int) args[2]);
+          calls++;
+        }
+        break;
+      }
+      case RvmRecorder::COMMIT:
+      case RvmRecorder::COMMIT_NO_FLUSH:
+      case RvmRecorder::COMMIT_ASYNC:
+      case RvmRecorder::ABORT: {
+        if (!read_varint(file, &tid)) {
+          success = false;
+          break;
+        }
+        if (transactions.count(tid) != 0) {
+          if (op == RvmRecorder::COMMIT) {
+            rvm_commit_trans(transactions[tid]);
+          } else if (op == RvmRecorder::COMMIT_NO_FLUSH) {
+            rvm_commit_trans_no_flush(transactions[tid]);
+          } else if (op == RvmRecorder::COMMIT_ASYNC) {
+            // Nothing in the trace says when the caller waited
+            rvm_commit_release(rvm_commit_trans_async(transactions[tid]));
+          } else {
+            rvm_abort_trans(transactions[tid]);
+          }
+          transactions.erase(tid);
+          calls++;
+        }
+        break;
+      }
+      case RvmRecorder::FLUSH:
+        rvm_flush(rvm);
+        calls++;
+        break;
+      case RvmRecorder::SET_OPTION: {
+        uint64_t option;
+        uint64_t value;
+        if (!read_varint(file, &option) || !read_varint(file, &value)) {
+          success = false;
+          break;
+        }
+        rvm_set_option(rvm, (int) option, (long) value);
+        calls++;
+        break;
+      }
+      case RvmRecorder::UNSUPPORTED: {
+        std::string call;
+        if (!read_name(file, &call)) {
+          success = false;
+          break;
+        }
+#if DEBUG
+        std::cerr << "rvm_replay(): Skipping unsupported call " << call << std::endl;
+#endif
+        break;
+      }
+      case RvmRecorder::TRUNCATE:
+        rvm_truncate_log(rvm);
+        calls++;
+        break;
+      default:
+        success = false;
+        break;
+    }
+    if (!success) {
+      break;
+    }
+  }
+
+  // Transactions still open when the recording stopped leave nothing behind
+  for (auto& entry : transactions) {
+    rvm_abort_trans(entry.second);
+  }
+#if DEBUG
+  if (!success) {
+    std::cerr << "rvm_replay(): Corrupt trace after " << calls << " calls" << std::endl;
+  }
+#endif
+  return success ? calls : -1;
+}
+
+int Rvm::StartRecording(const std::string& path) {
+  std::lock_guard<std::mutex> lock(segment_mutex_);
+  std::vector<RvmSegment*> segments;
+  for (auto const entry : base_to_segment_map_) {
+    segments.push_back(entry.second);
+  }
+  return recorder_.Start(path, segments) ? 0 : -1;
+}
+
+int rvm_record_start(rvm_t rvm, const char* path) {
+  if (path == nullptr) {
+#if DEBUG
+    std::cerr << "rvm_record_start(): Invalid path" << std::endl;
+#endif
+    return -1;
+  }
+  return rvm->StartRecording(std::string(path));
+}
+
+int rvm_record_stop(rvm_t rvm) {
+  return rvm->get_recorder().Stop() ? 0 : -1;
+}
+
+int rvm_replay(rvm_t rvm, const char* path, int flags) {
+  FILE* file = (path != nullptr) ? fopen(path, "rb") : nullptr;
+  if (file == nullptr) {
+#if DEBUG
+    std::cerr << "rvm_replay(): Could not open trace " << (path != nullptr ? path : "") << std::endl;
+#endif
+    return -1;
+  }
+  char magic[RVM_RECORD_MAGIC_SIZE];
+  int calls = -1;
+  if (fread(magic, 1, RVM_RECORD_MAGIC_SIZE, file) == RVM_RECORD_MAGIC_SIZE &&
+      memcmp(magic, RVM_RECORD_MAGIC, RVM_RECORD_MAGIC_SIZE) == 0) {
+    calls = replay_trace(rvm, file, flags);
+  } else {
+#if DEBUG
+    std::cerr << "rvm_replay(): " << path << " is not a workload trace" << std::endl;
+#endif
+  }
+  fclose(file);
+  return calls;
+}
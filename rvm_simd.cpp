@@ -0,0 +1,123 @@
+#include "rvm.h"
+#include "rvm_internal.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RVM_HAVE_X86 1
+#else
+#define RVM_HAVE_X86 0
+#endif
+
+// Each scan returns the index of the first byte at or after pos whose
+// equality matches want_equal, or size if there is none. Bytes of a are
+// compared with those of b, or with zero when kZero is set.
+typedef size_t (*scan_fn)(const char* a, const char* b, size_t pos, size_t size, bool want_equal);
+
+template <bool kZero>
+static size_t scan_scalar(const char* a, const char* b, size_t pos, size_t size, bool want_equal) {
+  // Skip whole words that cannot hold a match, then find the byte
+  while (pos + sizeof(uint64_t) <= size) {
+    uint64_t x;
+    uint64_t y = 0;
+    memcpy(&x, a + pos, sizeof(uint64_t));
+    if (!kZero) {
+      memcpy(&y, b + pos, sizeof(uint64_t));
+    }
+    uint64_t v = x ^ y;
+    bool found = want_equal ? (((v - 0x0101010101010101ULL) & ~v & 0x8080808080808080ULL) != 0) : (v != 0);
+    if (found) {
+      break;
+    }
+    pos += sizeof(uint64_t);
+  }
+  while (pos < size && ((a[pos] == (kZero ? 0 : b[pos])) != want_equal)) {
+    pos++;
+  }
+  return pos;
+}
+
+#if RVM_HAVE_X86
+template <bool kZero>
+__attribute__((target("sse2")))
+static size_t scan_sse2(const char* a, const char* b, size_t pos, size_t size, bool want_equal) {
+  while (pos + 16 <= size) {
+    __m128i x = _mm_loadu_si128((const __m128i*) (a + pos));
+    __m128i y = kZero ? _mm_setzero_si128() : _mm_loadu_si128((const __m128i*) (b + pos));
+    unsigned int mask = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+    if (!want_equal) {
+      mask = ~mask & 0xFFFF;
+    }
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+    pos += 16;
+  }
+  return scan_scalar<kZero>(a, b, pos, size, want_equal);
+}
+
+template <bool kZero>
+__attribute__((target("avx2")))
+static size_t scan_avx2(const char* a, const char* b, size_t pos, size_t size, bool want_equal) {
+  while (pos + 32 <= size) {
+    __m256i x = _mm256_loadu_si256((const __m256i*) (a + pos));
+    __m256i y = kZero ? _mm256_setzero_si256() : _mm256_loadu_si256((const __m256i*) (b + pos));
+    unsigned int mask = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+    if (!want_equal) {
+      mask = ~mask;
+    }
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+    pos += 32;
+  }
+  return scan_sse2<kZero>(a, b, pos, size, want_equal);
+}
+#endif
+
+template <bool kZero>
+static scan_fn select_scan() {
+#if RVM_HAVE_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return scan_avx2<kZero>;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return scan_sse2<kZero>;
+  }
+#endif
+  return scan_scalar<kZero>;
+}
+
+static const scan_fn g_scan = select_scan<false>();
+static const scan_fn g_scan_zero = select_scan<true>();
+
+void rvm_diff_ranges(const char* old_data, const char* new_data, size_t size, size_t min_gap,
+                     std::vector<std::pair<size_t, size_t>>& ranges) {
+  size_t pos = g_scan(old_data, new_data, 0, size, false);
+  while (pos < size) {
+    // Extend the changed run over unchanged gaps shorter than min_gap
+    size_t start = pos;
+    size_t end;
+    while (true) {
+      end = g_scan(old_data, new_data, pos, size, true);
+      pos = g_scan(old_data, new_data, end, size, false);
+      if (pos == size || pos - end >= min_gap) {
+        break;
+      }
+    }
+    ranges.push_back(std::make_pair(start, end - start));
+  }
+}
+
+void rvm_zero_runs(const char* data, size_t size, size_t min_run,
+                   std::vector<std::pair<size_t, size_t>>& runs) {
+  size_t pos = g_scan_zero(data, nullptr, 0, size, true);
+  while (pos < size) {
+    size_t end = g_scan_zero(data, nullptr, pos, size, false);
+    if (end - pos >= min_run) {
+      runs.push_back(std::make_pair(pos, end - pos));
+    }
+    pos = g_scan_zero(data, nullptr, end, size, true);
+  }
+}
@@ -0,0 +1,148 @@
+#include "rvm.h"
+#include "rvm_internal.h"
+#include <chrono>
+#include <cstdlib>
+#include <new>
+
+uint64_t rvm_now_ns() {
+  return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Threads are spread over the stripes in the order they first add a value
+static std::atomic<unsigned int> g_next_stripe(0);
+static thread_local unsigned int t_stripe = g_next_stripe.fetch_add(1, std::memory_order_relaxed);
+
+static size_t bucket_index(uint64_t value) {
+  if (value < (2ULL << RVM_STATS_SUB_BITS)) {
+    return (size_t) value;
+  }
+  unsigned int exponent = 63 - __builtin_clzll(value);
+  if (exponent > RVM_STATS_MAX_EXPONENT) {
+    return RVM_STATS_BUCKETS - 1;
+  }
+  // The top RVM_STATS_SUB_BITS + 1 bits of the value pick the bucket
+  return (size_t) (((exponent - RVM_STATS_SUB_BITS) << RVM_STATS_SUB_BITS) +
+                   (value >> (exponent - RVM_STATS_SUB_BITS)));
+}
+
+// Middle of the values that fall into a bucket
+static uint64_t bucket_value(size_t index) {
+  if (index < (2U << RVM_STATS_SUB_BITS)) {
+    return index;
+  }
+  unsigned int shift = (unsigned int) (index >> RVM_STATS_SUB_BITS) - 1;
+  uint64_t mantissa = (index & ((1U << RVM_STATS_SUB_BITS) - 1)) | (1U << RVM_STATS_SUB_BITS);
+  return (mantissa << shift) + ((1ULL << shift) >> 1);
+}
+
+RvmStats::RvmStats() {
+  void* memory;
+  if (posix_memalign(&memory, alignof(Stripe), RVM_STATS_STRIPES * sizeof(Stripe)) != 0) {
+    throw std::bad_alloc();
+  }
+  stripes_ = (Stripe*) memory;
+  for (size_t i = 0; i < RVM_STATS_STRIPES; i++) {
+    Stripe& stripe = *new (&stripes_[i]) Stripe;
+    for (size_t j = 0; j < NUM_COUNTERS; j++) {
+      stripe.counters[j].store(0, std::memory_order_relaxed);
+    }
+    for (size_t j = 0; j < NUM_LATENCIES; j++) {
+      Histogram& histogram = stripe.histograms[j];
+      for (size_t k = 0; k < RVM_STATS_BUCKETS; k++) {
+        histogram.buckets[k].store(0, std::memory_order_relaxed);
+      }
+      histogram.sum.store(0, std::memory_order_relaxed);
+      histogram.min.store(UINT64_MAX, std::memory_order_relaxed);
+      histogram.max.store(0, std::memory_order_relaxed);
+    }
+  }
+}
+
+RvmStats::~RvmStats() {
+  free(stripes_);
+}
+
+RvmStats::Stripe& RvmStats::GetStripe() {
+  return stripes_[t_stripe % RVM_STATS_STRIPES];
+}
+
+void RvmStats::Record(Latency latency, uint64_t ns) {
+  Histogram& histogram = GetStripe().histograms[latency];
+  histogram.buckets[bucket_index(ns)].fetch_add(1, std::memory_order_relaxed);
+  histogram.sum.fetch_add(ns, std::memory_order_relaxed);
+
+  uint64_t min = histogram.min.load(std::memory_order_relaxed);
+  while (ns < min && !histogram.min.compare_exchange_weak(min, ns, std::memory_order_relaxed)) {
+  }
+  uint64_t max = histogram.max.load(std::memory_order_relaxed);
+  while (ns > max && !histogram.max.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+  }
+}
+
+void RvmStats::Collect(rvm_stats_t* stats) const {
+  uint64_t counters[NUM_COUNTERS] = { 0 };
+  for (size_t i = 0; i < RVM_STATS_STRIPES; i++) {
+    for (size_t j = 0; j < NUM_COUNTERS; j++) {
+      counters[j] += stripes_[i].counters[j].load(std::memory_order_relaxed);
+    }
+  }
+  stats->commits = counters[COMMITS];
+  stats->aborts = counters[ABORTS];
+  stats->about_to_modify_calls = counters[ABOUT_TO_MODIFY_CALLS];
+  stats->undo_bytes = counters[UNDO_BYTES];
+  stats->redo_bytes = counters[REDO_BYTES];
+  stats->log_bytes_written = counters[LOG_BYTES_WRITTEN];
+  stats->syncs = counters[SYNCS];
+  stats->truncations = counters[TRUNCATIONS];
+  stats->records_applied = counters[RECORDS_APPLIED];
+
+  CollectLatency(COMMIT_LATENCY, &stats->commit_latency);
+  CollectLatency(MAP_LATENCY, &stats->map_latency);
+  CollectLatency(TRUNCATE_LATENCY, &stats->truncate_latency);
+  CollectLatency(RECOVERY_LATENCY, &stats->recovery_latency);
+}
+
+void RvmStats::CollectLatency(Latency latency, rvm_latency_t* out) const {
+  std::vector<uint64_t> buckets(RVM_STATS_BUCKETS, 0);
+  uint64_t count = 0;
+  uint64_t sum = 0;
+  uint64_t min = UINT64_MAX;
+  uint64_t max = 0;
+  for (size_t i = 0; i < RVM_STATS_STRIPES; i++) {
+    const Histogram& histogram = stripes_[i].histograms[latency];
+    for (size_t j = 0; j < RVM_STATS_BUCKETS; j++) {
+      uint64_t num = histogram.buckets[j].load(std::memory_order_relaxed);
+      buckets[j] += num;
+      count += num;
+    }
+    sum += histogram.sum.load(std::memory_order_relaxed);
+    min = std::min(min, histogram.min.load(std::memory_order_relaxed));
+    max = std::max(max, histogram.max.load(std::memory_order_relaxed));
+  }
+
+  out->count = count;
+  out->min_ns = (count > 0) ? min : 0;
+  out->max_ns = max;
+  out->mean_ns = (count > 0) ? sum / count : 0;
+
+  // Each percentile is the middle of the bucket holding its rank, kept
+  // within the exact min and max
+  const double percentiles[4] = { 0.5, 0.9, 0.99, 0.999 };
+  unsigned long long* results[4] = { &out->p50_ns, &out->p90_ns, &out->p99_ns, &out->p999_ns };
+  for (size_t i = 0; i < 4; i++) {
+    *results[i] = 0;
+    if (count == 0) {
+      continue;
+    }
+    uint64_t rank = (uint64_t) (percentiles[i] * (double) (count - 1)) + 1;
+    uint64_t seen = 0;
+    for (size_t j = 0; j < RVM_STATS_BUCKETS; j++) {
+      seen += buckets[j];
+      if (seen >= rank) {
+        *results[i] = std::max(min, std::min(max, bucket_value(j)));
+        break;
+      }
+    }
+  }
+}
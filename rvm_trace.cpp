@@ -0,0 +1,101 @@
+#include "rvm.h"
+#include "rvm_internal.h"
+#include <cstdio>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+static uint32_t current_tid() {
+  static thread_local uint32_t tid = (uint32_t) syscall(SYS_gettid);
+  return tid;
+}
+
+RvmTracer::~RvmTracer() {
+  delete ring_.load(std::memory_order_relaxed);
+  for (Ring* retired : retired_rings_) {
+    delete retired;
+  }
+}
+
+void RvmTracer::SetCapacity(size_t capacity) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Ring* ring = nullptr;
+  if (capacity > 0) {
+    ring = new Ring();
+    ring->capacity = capacity;
+    ring->next.store(0, std::memory_order_relaxed);
+    ring->slots = new Slot[capacity];
+    for (size_t i = 0; i < capacity; i++) {
+      ring->slots[i].seq.store(0, std::memory_order_relaxed);
+    }
+  }
+  Ring* old_ring = ring_.exchange(ring, std::memory_order_acq_rel);
+  if (old_ring != nullptr) {
+    // A span that loaded the old ring may still be writing to it
+    retired_rings_.push_back(old_ring);
+  }
+  enabled_.store(capacity > 0, std::memory_order_relaxed);
+}
+
+void RvmTracer::Record(const char* name, uint64_t start, uint64_t end) {
+  Ring* ring = ring_.load(std::memory_order_acquire);
+  if (ring == nullptr) {
+    // Turned off while the span was open
+    return;
+  }
+  uint64_t n = ring->next.fetch_add(1, std::memory_order_relaxed);
+  Slot& slot = ring->slots[n % ring->capacity];
+  slot.seq.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.name.store(name, std::memory_order_relaxed);
+  slot.start_ns.store(start, std::memory_order_relaxed);
+  slot.end_ns.store(end, std::memory_order_relaxed);
+  slot.tid.store(current_tid(), std::memory_order_relaxed);
+  slot.seq.store(n + 1, std::memory_order_release);
+}
+
+int RvmTracer::Dump(const std::string& path) {
+  std::vector<Event> events;
+  {
+    // Oldest span first. Slots still being written, or already reused by
+    // a newer span, are left out.
+    std::lock_guard<std::mutex> lock(mutex_);
+    Ring* ring = ring_.load(std::memory_order_acquire);
+    uint64_t next = (ring != nullptr) ? ring->next.load(std::memory_order_relaxed) : 0;
+    size_t count = (ring != nullptr) ? (size_t) std::min<uint64_t>(next, ring->capacity) : 0;
+    for (size_t i = 0; i < count; i++) {
+      uint64_t n = next - count + i;
+      Slot& slot = ring->slots[n % ring->capacity];
+      if (slot.seq.load(std::memory_order_acquire) != n + 1) {
+        continue;
+      }
+      Event event;
+      event.name = slot.name.load(std::memory_order_relaxed);
+      event.start_ns = slot.start_ns.load(std::memory_order_relaxed);
+      event.end_ns = slot.end_ns.load(std::memory_order_relaxed);
+      event.tid = slot.tid.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.seq.load(std::memory_order_relaxed) == n + 1) {
+        events.push_back(event);
+      }
+    }
+  }
+
+  FILE* file = fopen(path.c_str(), "w");
+  if (file == nullptr) {
+    return -1;
+  }
+
+  // Complete ("X") events with times in microseconds
+  int pid = (int) getpid();
+  fprintf(file, "{\"traceEvents\":[");
+  for (size_t i = 0; i < events.size(); i++) {
+    const Event& event = events[i];
+    fprintf(file, "%s\n{\"name\":\"%s\",\"cat\":\"rvm\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u}",
+            (i == 0) ? "" : ",", event.name, event.start_ns / 1000.0, (event.end_ns - event.start_ns) / 1000.0,
+            pid, event.tid);
+  }
+  fprintf(file, "\n],\"displayTimeUnit\":\"ns\"}\n");
+  bool success = (fclose(file) == 0);
+  return success ? (int) events.size() : -1;
+}
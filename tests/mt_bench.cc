@@ -0,0 +1,66 @@
+/*
+ * Measures commit throughput as threads are added. Each thread owns one
+ * segment and runs small transactions against it, so the numbers show
+ * how much the library serializes otherwise independent work.
+ *
+ * Usage: mt_bench [transactions per thread]
+ */
+#include "rvm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#define SEG_SIZE 65536
+#define RANGES_PER_TRANS 4
+#define RANGE_SIZE 64
+
+static void worker(rvm_t rvm, char* seg, int num_trans) {
+  for (int i = 0; i < num_trans; i++) {
+    trans_t trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+    for (int j = 0; j < RANGES_PER_TRANS; j++) {
+      int offset = ((i * RANGES_PER_TRANS + j) * RANGE_SIZE) % SEG_SIZE;
+      rvm_about_to_modify(trans, seg, offset, RANGE_SIZE);
+      memset(seg + offset, i, RANGE_SIZE);
+    }
+    rvm_commit_trans(trans);
+  }
+}
+
+int main(int argc, char** argv) {
+  int num_trans = (argc > 1) ? atoi(argv[1]) : 2000;
+  int thread_counts[] = { 1, 2, 4, 8 };
+  char name[64];
+
+  rvm_t rvm = rvm_init("rvm_segments");
+  printf("threads  transactions  seconds  trans/sec\n");
+  for (int num_threads : thread_counts) {
+    std::vector<char*> segs;
+    for (int i = 0; i < num_threads; i++) {
+      sprintf(name, "mt_bench_%d", i);
+      rvm_destroy(rvm, name);
+      segs.push_back((char*) rvm_map(rvm, name, SEG_SIZE));
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; i++) {
+      threads.push_back(std::thread(worker, rvm, segs[i], num_trans));
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    long total = (long) num_threads * num_trans;
+    printf("%7d  %12ld  %7.3f  %9.0f\n", num_threads, total, seconds, total / seconds);
+
+    rvm_truncate_log(rvm);
+    for (char* seg : segs) {
+      rvm_unmap(rvm, seg);
+    }
+  }
+  return 0;
+}
@@ -7,7 +7,7 @@ LD_LIBRARY_PATH=../ ./multi-abort
 LD_LIBRARY_PATH=../ ./multi
 LD_LIBRARY_PATH=../ ./truncate
 
-for i in `seq 24`; do
+for i in `seq 52`; do
   printf -v i "%02d" $i
   printf -v bench test${i}
   echo "Running $bench"
@@ -0,0 +1,252 @@
+/*
+ * Microbenchmarks for the single-threaded hot paths: about_to_modify
+ * against ranges per transaction, commit latency and throughput across
+ * payload sizes and durability modes, map time against segment size and
+ * log length, truncate time against record count and recovery time
+ * against log size. Results are written as one JSON document so runs can
+ * be compared between releases.
+ *
+ * Usage: rvm_bench [iterations] [output file]
+ */
+#include "rvm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#define DIRECTORY "rvm_segments"
+#define SEG_SIZE (1 << 20)
+#define RANGE_SIZE 64
+
+static FILE* out;
+static bool first_result = true;
+
+static uint64_t now_ns() {
+  return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Starts the next object of the results array
+static void begin_result(const char* name) {
+  fprintf(out, "%s\n    {\"name\": \"%s\"", first_result ? "" : ",", name);
+  first_result = false;
+}
+
+static void end_result() {
+  fprintf(out, "}");
+}
+
+static uint64_t percentile(const std::vector<uint64_t>& sorted, double p) {
+  return sorted[std::min(sorted.size() - 1, (size_t) (p * sorted.size()))];
+}
+
+static char* fresh_segment(rvm_t rvm, const char* name, int size) {
+  rvm_destroy(rvm, name);
+  return (char*) rvm_map(rvm, name, size);
+}
+
+// One transaction that sets size bytes at offset. Commits only log changed
+// bytes, so the value cycles through a prime number of values to differ
+// from whatever an earlier pass over the segment left there.
+static void commit_range(rvm_t rvm, char* seg, int offset, int size, bool flush) {
+  static int generation = 0;
+  trans_t trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+  rvm_about_to_modify(trans, seg, offset, size);
+  generation = (generation + 1) % 251;
+  memset(seg + offset, generation, size);
+  if (flush) {
+    rvm_commit_trans(trans);
+  } else {
+    rvm_commit_trans_no_flush(trans);
+  }
+}
+
+static void bench_about_to_modify(rvm_t rvm, int iterations) {
+  int range_counts[] = { 1, 4, 16, 64, 256 };
+  char* seg = fresh_segment(rvm, "bench_atm", SEG_SIZE);
+
+  for (int ranges : range_counts) {
+    uint64_t total_ns = 0;
+    for (int i = 0; i < iterations; i++) {
+      trans_t trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+      uint64_t start = now_ns();
+      for (int j = 0; j < ranges; j++) {
+        rvm_about_to_modify(trans, seg, j * RANGE_SIZE, RANGE_SIZE);
+      }
+      total_ns += now_ns() - start;
+      rvm_abort_trans(trans);
+    }
+    begin_result("about_to_modify");
+    fprintf(out, ", \"ranges\": %d, \"transactions\": %d, \"ns_per_call\": %.1f, \"ns_per_trans\": %.1f",
+            ranges, iterations, (double) total_ns / ((double) iterations * ranges),
+            (double) total_ns / iterations);
+    end_result();
+  }
+  rvm_unmap(rvm, seg);
+  rvm_destroy(rvm, "bench_atm");
+}
+
+static void bench_commit(rvm_t rvm, int iterations) {
+  int payloads[] = { 64, 1024, 16384, 262144 };
+  const char* modes[] = { "no_flush", "flush", "sync" };
+  char* seg = fresh_segment(rvm, "bench_commit", SEG_SIZE);
+
+  for (const char* mode : modes) {
+    bool flush = (strcmp(mode, "no_flush") != 0);
+    bool sync = (strcmp(mode, "sync") == 0);
+    // Every synced commit waits for the disk
+    int commits = sync ? std::max(iterations / 10, 10) : iterations;
+    rvm_set_option(rvm, RVM_OPT_SYNC, sync ? 1 : 0);
+
+    for (int payload : payloads) {
+      // The log keeps every record in memory until the truncation below
+      int count = std::min(commits, std::max((64 << 20) / payload, 10));
+      std::vector<uint64_t> latencies;
+      uint64_t start = now_ns();
+      for (int i = 0; i < count; i++) {
+        int offset = (int) (((long) i * payload) % (SEG_SIZE - payload + 1));
+        uint64_t commit_start = now_ns();
+        commit_range(rvm, seg, offset, payload, flush);
+        latencies.push_back(now_ns() - commit_start);
+      }
+      if (!flush) {
+        // Buffered commits count once they are written
+        rvm_flush(rvm);
+      }
+      double seconds = (now_ns() - start) / 1e9;
+      std::sort(latencies.begin(), latencies.end());
+
+      begin_result("commit");
+      fprintf(out, ", \"mode\": \"%s\", \"payload_bytes\": %d, \"commits\": %d, \"seconds\": %.6f", mode,
+              payload, count, seconds);
+      fprintf(out, ", \"commits_per_sec\": %.1f, \"mb_per_sec\": %.2f", count / seconds,
+              (double) count * payload / seconds / (1 << 20));
+      fprintf(out, ", \"p50_ns\": %llu, \"p99_ns\": %llu, \"max_ns\": %llu",
+              (unsigned long long) percentile(latencies, 0.5), (unsigned long long) percentile(latencies, 0.99),
+              (unsigned long long) latencies.back());
+      end_result();
+      rvm_truncate_log(rvm);
+    }
+  }
+  rvm_set_option(rvm, RVM_OPT_SYNC, 0);
+  rvm_unmap(rvm, seg);
+  rvm_destroy(rvm, "bench_commit");
+}
+
+static void bench_map(rvm_t rvm) {
+  int sizes[] = { 1 << 16, 1 << 20, 1 << 24 };
+  int log_lengths[] = { 0, 1000, 10000 };
+  const int maps = 5;
+
+  for (int size : sizes) {
+    for (int records : log_lengths) {
+      char* seg = fresh_segment(rvm, "bench_map", size);
+      for (int i = 0; i < records; i++) {
+        commit_range(rvm, seg, (i * RANGE_SIZE) % (size - RANGE_SIZE), RANGE_SIZE, false);
+      }
+      rvm_flush(rvm);
+
+      // Each map reads the backing file and replays the log
+      uint64_t total_ns = 0;
+      for (int i = 0; i < maps; i++) {
+        rvm_unmap(rvm, seg);
+        uint64_t start = now_ns();
+        seg = (char*) rvm_map(rvm, "bench_map", size);
+        total_ns += now_ns() - start;
+      }
+      begin_result("map");
+      fprintf(out, ", \"segment_bytes\": %d, \"log_records\": %d, \"ns\": %llu", size, records,
+              (unsigned long long) (total_ns / maps));
+      end_result();
+
+      rvm_unmap(rvm, seg);
+      rvm_truncate_log(rvm);
+    }
+  }
+  rvm_destroy(rvm, "bench_map");
+}
+
+static void bench_truncate(rvm_t rvm) {
+  int record_counts[] = { 100, 1000, 10000, 100000 };
+  char* seg = fresh_segment(rvm, "bench_truncate", SEG_SIZE);
+
+  for (int records : record_counts) {
+    for (int i = 0; i < records; i++) {
+      commit_range(rvm, seg, (i * RANGE_SIZE) % SEG_SIZE, RANGE_SIZE, false);
+    }
+    rvm_flush(rvm);
+    uint64_t start = now_ns();
+    rvm_truncate_log(rvm);
+    uint64_t elapsed = now_ns() - start;
+
+    begin_result("truncate");
+    fprintf(out, ", \"records\": %d, \"ns\": %llu", records, (unsigned long long) elapsed);
+    end_result();
+  }
+  rvm_unmap(rvm, seg);
+  rvm_destroy(rvm, "bench_truncate");
+}
+
+static void bench_recovery(rvm_t rvm) {
+  int record_counts[] = { 100, 1000, 10000, 100000 };
+  char command[256];
+  char directory[64];
+
+  for (int records : record_counts) {
+    rvm_stats_t before;
+    rvm_stats_t after;
+    char* seg = fresh_segment(rvm, "bench_recovery", SEG_SIZE);
+    rvm_get_stats(rvm, &before);
+    for (int i = 0; i < records; i++) {
+      commit_range(rvm, seg, (i * RANGE_SIZE) % SEG_SIZE, RANGE_SIZE, false);
+    }
+    rvm_flush(rvm);
+    rvm_get_stats(rvm, &after);
+
+    // rvm_init() returns the open instance of a directory, so the log is
+    // recovered from a copy in a directory not opened before
+    sprintf(directory, DIRECTORY "/recovery_%d", records);
+    sprintf(command, "mkdir -p %s && cp " DIRECTORY "/redo_log.rvm %s", directory, directory);
+    if (system(command) != 0) {
+      fprintf(stderr, "rvm_bench: could not copy the log to %s\n", directory);
+      exit(1);
+    }
+    uint64_t start = now_ns();
+    rvm_init(directory);
+    uint64_t elapsed = now_ns() - start;
+
+    begin_result("recovery");
+    fprintf(out, ", \"records\": %d, \"log_bytes\": %llu, \"ns\": %llu", records,
+            after.log_bytes_written - before.log_bytes_written, (unsigned long long) elapsed);
+    end_result();
+    rvm_unmap(rvm, seg);
+    rvm_truncate_log(rvm);
+  }
+  rvm_destroy(rvm, "bench_recovery");
+}
+
+int main(int argc, char** argv) {
+  int iterations = (argc > 1) ? atoi(argv[1]) : 1000;
+  out = (argc > 2) ? fopen(argv[2], "w") : stdout;
+  if (iterations <= 0 || out == NULL) {
+    fprintf(stderr, "Usage: rvm_bench [iterations] [output file]\n");
+    return 1;
+  }
+
+  rvm_t rvm = rvm_init(DIRECTORY);
+  rvm_truncate_log(rvm);
+  fprintf(out, "{\n  \"benchmark\": \"rvm_bench\",\n  \"iterations\": %d,\n  \"results\": [", iterations);
+  bench_about_to_modify(rvm, iterations);
+  bench_commit(rvm, iterations);
+  bench_map(rvm);
+  bench_truncate(rvm);
+  bench_recovery(rvm);
+  fprintf(out, "\n  ]\n}\n");
+
+  if (out != stdout) {
+    fclose(out);
+  }
+  return 0;
+}
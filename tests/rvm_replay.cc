@@ -0,0 +1,52 @@
+/*
+ * Drives an instance with a workload trace recorded through
+ * rvm_record_start() or RVM_RECORD_TRACE, and prints the time taken and
+ * the instance's commit latencies as JSON.
+ *
+ * Usage: rvm_replay <trace> [directory] [--max-speed]
+ */
+#include "rvm.h"
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+static void print_latency(const char* name, const rvm_latency_t& latency) {
+  printf(",\n  \"%s\": {\"count\": %llu, \"p50_ns\": %llu, \"p99_ns\": %llu, \"max_ns\": %llu}", name,
+         latency.count, latency.p50_ns, latency.p99_ns, latency.max_ns);
+}
+
+int main(int argc, char** argv) {
+  const char* directory = "rvm_replay_segments";
+  int flags = 0;
+  if (argc < 2) {
+    fprintf(stderr, "Usage: rvm_replay <trace> [directory] [--max-speed]\n");
+    return 1;
+  }
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "--max-speed") == 0) {
+      flags |= RVM_REPLAY_MAX_SPEED;
+    } else {
+      directory = argv[i];
+    }
+  }
+
+  rvm_t rvm = rvm_init(directory);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  int calls = rvm_replay(rvm, argv[1], flags);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  if (calls < 0) {
+    fprintf(stderr, "rvm_replay: could not replay %s\n", argv[1]);
+    return 1;
+  }
+
+  rvm_stats_t stats;
+  rvm_get_stats(rvm, &stats);
+  printf("{\n  \"trace\": \"%s\",\n  \"max_speed\": %s,\n  \"calls\": %d,\n  \"seconds\": %.6f", argv[1],
+         (flags & RVM_REPLAY_MAX_SPEED) ? "true" : "false", calls, seconds);
+  printf(",\n  \"commits\": %llu,\n  \"aborts\": %llu,\n  \"log_bytes_written\": %llu", stats.commits,
+         stats.aborts, stats.log_bytes_written);
+  print_latency("commit_latency", stats.commit_latency);
+  print_latency("truncate_latency", stats.truncate_latency);
+  printf("\n}\n");
+  return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * Test that rvm_resize() grows and shrinks a mapped segment and that
+ * the new size is recovered from the log and after truncation
+ */
+#include "rvm.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#define TEST_STRING "hello, world"
+#define SMALL_SIZE 10000
+#define LARGE_SIZE 400000
+#define SHRUNK_SIZE 300000
+#define OFFSET2 350000
+#define OFFSET3 250000
+
+/* proc1 grows a segment, writes past the old end, shrinks it, then exits */
+void proc1() {
+  rvm_t rvm;
+  trans_t trans;
+  char* segs[1];
+
+  rvm = rvm_init("rvm_segments");
+  rvm_destroy(rvm, "testseg25");
+  segs[0] = (char*) rvm_map(rvm, "testseg25", SMALL_SIZE);
+
+  trans = rvm_begin_trans(rvm, 1, (void**) segs);
+  rvm_about_to_modify(trans, segs[0], 0, 100);
+  sprintf(segs[0], TEST_STRING);
+  rvm_commit_trans(trans);
+
+  // Resizing a segment owned by a transaction should fail
+  trans = rvm_begin_trans(rvm, 1, (void**) segs);
+  if (rvm_resize(rvm, segs[0], LARGE_SIZE) != (void*) -1) {
+    printf("ERROR: resize of segment in a transaction succeeded\n");
+    exit(2);
+  }
+  rvm_abort_trans(trans);
+
+  segs[0] = (char*) rvm_resize(rvm, segs[0], LARGE_SIZE);
+  if (strcmp(segs[0], TEST_STRING)) {
+    printf("ERROR: data lost while growing segment\n");
+    exit(2);
+  }
+
+  trans = rvm_begin_trans(rvm, 1, (void**) segs);
+  rvm_about_to_modify(trans, segs[0], OFFSET2, 100);
+  sprintf(segs[0] + OFFSET2, TEST_STRING);
+  rvm_about_to_modify(trans, segs[0], OFFSET3, 100);
+  sprintf(segs[0] + OFFSET3, TEST_STRING);
+  rvm_commit_trans(trans);
+
+  segs[0] = (char*) rvm_resize(rvm, segs[0], SHRUNK_SIZE);
+
+  abort();
+}
+
+/* proc2 maps the segment at the large size and checks what survived */
+void proc2(int truncate) {
+  char* segs[1];
+  rvm_t rvm;
+
+  rvm = rvm_init("rvm_segments");
+  if (truncate) {
+    rvm_truncate_log(rvm);
+  }
+
+  segs[0] = (char*) rvm_map(rvm, "testseg25", LARGE_SIZE);
+  if (strcmp(segs[0], TEST_STRING)) {
+    printf("ERROR: first hello not present\n");
+    exit(2);
+  }
+  if (strcmp(segs[0] + OFFSET3, TEST_STRING)) {
+    printf("ERROR: second hello not present\n");
+    exit(2);
+  }
+  if (segs[0][OFFSET2] != 0) {
+    printf("ERROR: data past shrunk end should be 0\n");
+    exit(2);
+  }
+
+  rvm_unmap(rvm, segs[0]);
+}
+
+int main(int argc, char** argv) {
+  int pid;
+
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(2);
+  }
+  if (pid == 0) {
+    proc1();
+    exit(0);
+  }
+
+  waitpid(pid, NULL, 0);
+
+  proc2(0);
+  proc2(1);
+
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * Test that rvm_malloc()/rvm_free() allocate inside a segment, that an
+ * aborted allocation is rolled back, and that the heap survives a crash
+ */
+#include "rvm.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#define NUM_NODES 1000
+
+struct node {
+  long next; /* Offset of the next node in the segment, 0 ends the list */
+  int val;
+};
+
+struct root {
+  long head;
+  int count;
+};
+
+/* proc1 builds a list of nodes in one segment, then exits */
+void proc1() {
+  rvm_t rvm;
+  trans_t trans;
+  char* segs[2];
+  struct root* root;
+  struct node* node;
+  void* aborted;
+  int i;
+
+  rvm = rvm_init("rvm_segments");
+  rvm_destroy(rvm, "testseg26");
+  rvm_destroy(rvm, "testseg26root");
+  segs[0] = (char*) rvm_map(rvm, "testseg26", 1 << 20);
+  segs[1] = (char*) rvm_map(rvm, "testseg26root", sizeof(struct root));
+  root = (struct root*) segs[1];
+
+  trans = rvm_begin_trans(rvm, 2, (void**) segs);
+  rvm_about_to_modify(trans, segs[1], 0, sizeof(struct root));
+  for (i = 0; i < NUM_NODES; i++) {
+    node = (struct node*) rvm_malloc(trans, segs[0], sizeof(struct node));
+    node->val = i;
+    node->next = root->head;
+    root->head = (char*) node - segs[0];
+    root->count++;
+  }
+  rvm_commit_trans(trans);
+
+  // An aborted allocation should hand out the same block again
+  trans = rvm_begin_trans(rvm, 2, (void**) segs);
+  aborted = rvm_malloc(trans, segs[0], 100);
+  rvm_abort_trans(trans);
+
+  trans = rvm_begin_trans(rvm, 2, (void**) segs);
+  if (rvm_malloc(trans, segs[0], 100) != aborted) {
+    printf("ERROR: aborted allocation was not rolled back\n");
+    exit(2);
+  }
+
+  // A freed block should be reused by the next allocation of its size
+  node = (struct node*) (segs[0] + root->head);
+  rvm_about_to_modify(trans, segs[1], 0, sizeof(struct root));
+  root->head = node->next;
+  root->count--;
+  rvm_free(trans, segs[0], node);
+  if (rvm_malloc(trans, segs[0], sizeof(struct node)) != node) {
+    printf("ERROR: freed block was not reused\n");
+    exit(2);
+  }
+  rvm_free(trans, segs[0], node);
+  rvm_commit_trans(trans);
+
+  abort();
+}
+
+/* proc2 maps the segment and walks the list */
+void proc2() {
+  char* segs[2];
+  rvm_t rvm;
+  trans_t trans;
+  struct root* root;
+  long offset;
+  int count = 0;
+
+  rvm = rvm_init("rvm_segments");
+  segs[0] = (char*) rvm_map(rvm, "testseg26", 1 << 20);
+  segs[1] = (char*) rvm_map(rvm, "testseg26root", sizeof(struct root));
+
+  root = (struct root*) segs[1];
+  for (offset = root->head; offset != 0; offset = ((struct node*) (segs[0] + offset))->next) {
+    count++;
+  }
+  if (count != NUM_NODES - 1 || root->count != NUM_NODES - 1) {
+    printf("ERROR: expected %d nodes, found %d\n", NUM_NODES - 1, count);
+    exit(2);
+  }
+
+  // The heap metadata is recovered along with the data
+  trans = rvm_begin_trans(rvm, 1, (void**) segs);
+  if (rvm_malloc(trans, segs[0], sizeof(struct node)) == NULL) {
+    printf("ERROR: allocation after recovery failed\n");
+    exit(2);
+  }
+  rvm_commit_trans(trans);
+
+  printf("OK\n");
+  exit(0);
+}
+
+int main(int argc, char** argv) {
+  int pid;
+
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(2);
+  }
+  if (pid == 0) {
+    proc1();
+    exit(0);
+  }
+
+  waitpid(pid, NULL, 0);
+
+  proc2();
+
+  return 0;
+}
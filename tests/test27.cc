@@ -0,0 +1,105 @@
+/* Test that rvm::ptr pointers stored in segments survive a restart */
+
+#include "rvm.h"
+#include "rvm_ptr.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <iostream>
+
+#define NUM_NODES 1000
+#define SEG_SIZE (1 << 20)
+
+struct node {
+  rvm::ptr<node> next;
+  int val;
+};
+
+struct root {
+  rvm::ptr<node> head;
+};
+
+/* proc1 builds a list whose nodes alternate between two segments */
+void proc1() {
+  rvm_t rvm = rvm_init("rvm_segments");
+  rvm_destroy(rvm, "testseg27a");
+  rvm_destroy(rvm, "testseg27b");
+  rvm_destroy(rvm, "testseg27root");
+
+  void* segs[3];
+  segs[0] = rvm_map(rvm, "testseg27a", SEG_SIZE);
+  segs[1] = rvm_map(rvm, "testseg27b", SEG_SIZE);
+  segs[2] = rvm_map(rvm, "testseg27root", sizeof(root));
+  root* list = (root*) segs[2];
+
+  trans_t trans = rvm_begin_trans(rvm, 3, segs);
+  rvm_about_to_modify(trans, segs[2], 0, sizeof(root));
+  for (int i = 0; i < NUM_NODES; i++) {
+    void* segbase = segs[i % 2];
+    node* n = (node*) rvm_malloc(trans, segbase, sizeof(node));
+    n->val = i;
+    n->next = list->head;
+    list->head = rvm::ptr<node>(rvm, segbase, n);
+  }
+  rvm_commit_trans(trans);
+
+  abort();
+}
+
+/* proc2 maps the segments in a different order and walks the list */
+void proc2() {
+  rvm_t rvm = rvm_init("rvm_segments");
+
+  // Take up some address space so the segments land somewhere new
+  void* filler = rvm_map(rvm, "testseg27filler", SEG_SIZE);
+  root* list = (root*) rvm_map(rvm, "testseg27root", sizeof(root));
+  void* segb = rvm_map(rvm, "testseg27b", SEG_SIZE);
+
+  // The head lives in the mapped segment, but the next node does not resolve yet
+  if (list->head.get(rvm) == NULL || list->head.get(rvm)->next.get(rvm) != NULL) {
+    std::cout << "ERROR: pointer into unmapped segment resolved" << std::endl;
+    exit(2);
+  }
+
+  rvm_map(rvm, "testseg27a", SEG_SIZE);
+
+  int expected = NUM_NODES - 1;
+  for (node* n = list->head.get(rvm); n != NULL; n = n->next.get(rvm)) {
+    if (n->val != expected) {
+      std::cout << "ERROR: expected node " << expected << " found " << n->val << std::endl;
+      exit(2);
+    }
+    expected--;
+  }
+
+  if (expected != -1) {
+    std::cout << "ERROR: list ended early at node " << expected << std::endl;
+    exit(2);
+  }
+
+  rvm_unmap(rvm, segb);
+  rvm_unmap(rvm, filler);
+  std::cout << "OK" << std::endl;
+}
+
+int main(int argc, char** argv) {
+  int pid;
+
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(2);
+  }
+  if (pid == 0) {
+    proc1();
+    exit(0);
+  }
+
+  waitpid(pid, NULL, 0);
+
+  proc2();
+
+  return 0;
+}
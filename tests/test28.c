@@ -0,0 +1,106 @@
+/*
+ * Test that rvm_map_fixed() maps a segment at the same address after a
+ * restart, so raw pointers stored in it stay valid, and that it fails
+ * when the recorded address range is already taken
+ */
+#include "rvm.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/wait.h>
+
+#define TEST_STRING "hello, world"
+#define OFFSET2 1000
+
+struct header {
+  char* self;    /* Where the segment was mapped */
+  char* message; /* Raw pointer to a string inside the segment */
+};
+
+/* proc1 stores raw pointers into the segment, then exits */
+void proc1() {
+  rvm_t rvm;
+  trans_t trans;
+  char* segs[1];
+  struct header* header;
+
+  rvm = rvm_init("rvm_segments");
+  rvm_destroy(rvm, "testseg28");
+  segs[0] = (char*) rvm_map_fixed(rvm, "testseg28", 10000, NULL);
+  header = (struct header*) segs[0];
+
+  trans = rvm_begin_trans(rvm, 1, (void**) segs);
+  rvm_about_to_modify(trans, segs[0], 0, sizeof(struct header));
+  header->self = segs[0];
+  header->message = segs[0] + OFFSET2;
+  rvm_about_to_modify(trans, segs[0], OFFSET2, 100);
+  sprintf(segs[0] + OFFSET2, TEST_STRING);
+  rvm_commit_trans(trans);
+
+  abort();
+}
+
+/* proc2 maps the segment again and follows the raw pointers */
+void proc2() {
+  char* segs[1];
+  rvm_t rvm;
+  struct header* header;
+
+  rvm = rvm_init("rvm_segments");
+
+  segs[0] = (char*) rvm_map_fixed(rvm, "testseg28", 10000, NULL);
+  header = (struct header*) segs[0];
+  if (segs[0] == (char*) -1 || header->self != segs[0]) {
+    printf("ERROR: segment not mapped at its recorded address\n");
+    exit(2);
+  }
+  if (strcmp(header->message, TEST_STRING)) {
+    printf("ERROR: raw pointer does not point at hello\n");
+    exit(2);
+  }
+
+  // Another segment cannot be placed on top of it
+  errno = 0;
+  if (rvm_map_fixed(rvm, "testseg28b", 10000, segs[0]) != (void*) -1 || errno != EEXIST) {
+    printf("ERROR: overlapping fixed mapping should fail with EEXIST\n");
+    exit(2);
+  }
+
+  // Asking for a different address than the recorded one fails
+  rvm_unmap(rvm, segs[0]);
+  if (rvm_map_fixed(rvm, "testseg28", 10000, segs[0] + 4096 * 16) != (void*) -1) {
+    printf("ERROR: segment mapped away from its recorded address\n");
+    exit(2);
+  }
+
+  // Unmapping and mapping again lands on the same address
+  if (rvm_map_fixed(rvm, "testseg28", 10000, NULL) != header) {
+    printf("ERROR: segment moved after unmap\n");
+    exit(2);
+  }
+
+  printf("OK\n");
+  exit(0);
+}
+
+int main(int argc, char** argv) {
+  int pid;
+
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(2);
+  }
+  if (pid == 0) {
+    proc1();
+    exit(0);
+  }
+
+  waitpid(pid, NULL, 0);
+
+  proc2();
+
+  return 0;
+}
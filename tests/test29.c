@@ -0,0 +1,162 @@
+/*
+ * Test that RVM_OPT_CONTAINER packs segments into one container file,
+ * imports segments that already had their own backing file, and that
+ * truncation, destroy and recovery work on packed segments
+ */
+#include "rvm.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define TEST_STRING "hello, world"
+#define NUM_SEGS 200
+#define SEG_SIZE 1000
+#define OFFSET2 500
+
+int file_exists(const char* name) {
+  struct stat buffer;
+  return stat(name, &buffer) == 0;
+}
+
+int count_segment_files() {
+  DIR* dir = opendir("rvm_segments");
+  struct dirent* entry;
+  int count = 0;
+  while ((entry = readdir(dir)) != NULL) {
+    if (strncmp(entry->d_name, "seg_", 4) == 0) {
+      count++;
+    }
+  }
+  closedir(dir);
+  return count;
+}
+
+/* proc1 writes many small segments into a container, then exits */
+void proc1() {
+  rvm_t rvm;
+  trans_t trans;
+  char* segs[1];
+  char name[32];
+  int i;
+
+  rvm = rvm_init("rvm_segments");
+
+  // One segment gets its own backing file before the container exists
+  segs[0] = (char*) rvm_map(rvm, "legacy", SEG_SIZE);
+  trans = rvm_begin_trans(rvm, 1, (void**) segs);
+  rvm_about_to_modify(trans, segs[0], 0, 100);
+  sprintf(segs[0], TEST_STRING);
+  rvm_commit_trans(trans);
+  rvm_truncate_log(rvm);
+  if (!file_exists("rvm_segments/seg_legacy.rvm")) {
+    printf("ERROR: legacy backing file missing\n");
+    exit(2);
+  }
+
+  if (rvm_set_option(rvm, RVM_OPT_CONTAINER, 1) != 0) {
+    printf("ERROR: could not enable container\n");
+    exit(2);
+  }
+
+  trans = rvm_begin_trans(rvm, 1, (void**) segs);
+  rvm_about_to_modify(trans, segs[0], OFFSET2, 100);
+  sprintf(segs[0] + OFFSET2, TEST_STRING);
+  rvm_commit_trans(trans);
+  rvm_unmap(rvm, segs[0]);
+
+  for (i = 0; i < NUM_SEGS; i++) {
+    sprintf(name, "packed%d", i);
+    segs[0] = (char*) rvm_map(rvm, name, SEG_SIZE);
+    trans = rvm_begin_trans(rvm, 1, (void**) segs);
+    rvm_about_to_modify(trans, segs[0], OFFSET2, 100);
+    sprintf(segs[0] + OFFSET2, "%s", name);
+    rvm_commit_trans(trans);
+    rvm_unmap(rvm, segs[0]);
+  }
+  rvm_truncate_log(rvm);
+
+  if (count_segment_files() != 0) {
+    printf("ERROR: segments not packed into the container\n");
+    exit(2);
+  }
+
+  // Grow one packed segment so it has to move to a bigger extent
+  segs[0] = (char*) rvm_map(rvm, "packed0", SEG_SIZE);
+  segs[0] = (char*) rvm_resize(rvm, segs[0], 100000);
+  trans = rvm_begin_trans(rvm, 1, (void**) segs);
+  rvm_about_to_modify(trans, segs[0], 90000, 100);
+  sprintf(segs[0] + 90000, TEST_STRING);
+  rvm_commit_trans(trans);
+  rvm_truncate_log(rvm);
+
+  // Destroy another one, it should come back empty
+  rvm_destroy(rvm, "packed1");
+
+  abort();
+}
+
+/* proc2 reopens the container and checks every segment */
+void proc2() {
+  char* segs[1];
+  char name[32];
+  rvm_t rvm;
+  int i;
+
+  rvm = rvm_init("rvm_segments");
+
+  segs[0] = (char*) rvm_map(rvm, "legacy", SEG_SIZE);
+  if (strcmp(segs[0], TEST_STRING) || strcmp(segs[0] + OFFSET2, TEST_STRING)) {
+    printf("ERROR: legacy segment not imported\n");
+    exit(2);
+  }
+
+  for (i = 0; i < NUM_SEGS; i++) {
+    sprintf(name, "packed%d", i);
+    segs[0] = (char*) rvm_map(rvm, name, i == 0 ? 100000 : SEG_SIZE);
+    if (i == 1) {
+      if (segs[0][OFFSET2] != 0) {
+        printf("ERROR: destroyed segment still has data\n");
+        exit(2);
+      }
+    } else if (strcmp(segs[0] + OFFSET2, name)) {
+      printf("ERROR: %s lost its data\n", name);
+      exit(2);
+    } else if (i == 0 && strcmp(segs[0] + 90000, TEST_STRING)) {
+      printf("ERROR: data past the old extent lost\n");
+      exit(2);
+    }
+  }
+
+  rvm_truncate_log(rvm);
+  if (count_segment_files() != 0) {
+    printf("ERROR: segment files created in container mode\n");
+    exit(2);
+  }
+
+  printf("OK\n");
+  exit(0);
+}
+
+int main(int argc, char** argv) {
+  int pid;
+
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(2);
+  }
+  if (pid == 0) {
+    proc1();
+    exit(0);
+  }
+
+  waitpid(pid, NULL, 0);
+
+  proc2();
+
+  return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * Test that threads committing to their own segments at the same time,
+ * while another thread truncates the log, lose no updates
+ */
+#include "rvm.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <thread>
+#include <vector>
+#include <atomic>
+
+#define NUM_THREADS 8
+#define NUM_TRANS 500
+#define SEG_SIZE 10000
+
+static std::atomic<int> g_running(0);
+
+static void segment_name(char* name, int i) {
+  sprintf(name, "testseg30_%d", i);
+}
+
+/* Each worker increments a counter in its own segment, aborting every
+ * fourth increment */
+static void worker(rvm_t rvm, char* seg) {
+  for (int i = 0; i < NUM_TRANS; i++) {
+    trans_t trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+    if (trans == (trans_t) -1) {
+      printf("ERROR: failed to begin transaction\n");
+      exit(2);
+    }
+
+    int* counter = (int*) seg;
+    rvm_about_to_modify(trans, seg, 0, sizeof(int));
+    (*counter)++;
+    rvm_about_to_modify(trans, seg, 100, sizeof(int));
+    ((int*) (seg + 100))[0] = i;
+
+    if (i % 4 == 3) {
+      rvm_abort_trans(trans);
+    } else {
+      rvm_commit_trans(trans);
+    }
+  }
+  g_running--;
+}
+
+/* proc1 runs the workers and a truncating thread, then exits */
+void proc1() {
+  rvm_t rvm;
+  char* segs[NUM_THREADS];
+  char name[64];
+
+  rvm = rvm_init("rvm_segments");
+  for (int i = 0; i < NUM_THREADS; i++) {
+    segment_name(name, i);
+    rvm_destroy(rvm, name);
+    segs[i] = (char*) rvm_map(rvm, name, SEG_SIZE);
+  }
+
+  g_running = NUM_THREADS;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < NUM_THREADS; i++) {
+    threads.push_back(std::thread(worker, rvm, segs[i]));
+  }
+  std::thread truncator([rvm]() {
+    while (g_running > 0) {
+      rvm_truncate_log(rvm);
+      usleep(1000);
+    }
+  });
+
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  truncator.join();
+  abort();
+}
+
+/* proc2 maps the segments and checks every committed increment survived */
+void proc2(int truncate) {
+  rvm_t rvm;
+  char* seg;
+  char name[64];
+  int expected = NUM_TRANS - NUM_TRANS / 4;
+
+  rvm = rvm_init("rvm_segments");
+  if (truncate) {
+    rvm_truncate_log(rvm);
+  }
+
+  for (int i = 0; i < NUM_THREADS; i++) {
+    segment_name(name, i);
+    seg = (char*) rvm_map(rvm, name, SEG_SIZE);
+    if (((int*) seg)[0] != expected) {
+      printf("ERROR: segment %d has count %d, expected %d\n", i, ((int*) seg)[0], expected);
+      exit(2);
+    }
+    if (((int*) (seg + 100))[0] != NUM_TRANS - 2) {
+      printf("ERROR: segment %d has last value %d\n", i, ((int*) (seg + 100))[0]);
+      exit(2);
+    }
+    rvm_unmap(rvm, seg);
+  }
+}
+
+int main(int argc, char** argv) {
+  int pid;
+
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(2);
+  }
+  if (pid == 0) {
+    proc1();
+    exit(0);
+  }
+
+  waitpid(pid, NULL, 0);
+
+  proc2(0);
+  proc2(1);
+
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,153 @@
+/*
+ * Test that shared transactions lock byte ranges: disjoint ranges of one
+ * segment are modified in parallel, overlapping ranges wait or fail fast,
+ * and every committed change is recovered
+ */
+#include "rvm.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <thread>
+#include <vector>
+#include <atomic>
+
+#define NUM_THREADS 4
+#define NUM_TRANS 500
+#define SEG_SIZE 10000
+#define SLOT_SIZE 64
+#define SHARED_OFFSET 5000
+
+/* Each worker increments its own slot and, every tenth transaction, a
+ * counter all workers share */
+static void worker(rvm_t rvm, char* seg, int id) {
+  for (int i = 0; i < NUM_TRANS; i++) {
+    trans_t trans = rvm_begin_trans_flags(rvm, 1, (void**) &seg, RVM_TRANS_SHARED);
+    if (trans == (trans_t) -1) {
+      printf("ERROR: failed to begin shared transaction\n");
+      exit(2);
+    }
+
+    int* slot = (int*) (seg + id * SLOT_SIZE);
+    rvm_about_to_modify(trans, seg, id * SLOT_SIZE, sizeof(int));
+    (*slot)++;
+    if (i % 10 == 0) {
+      int* shared = (int*) (seg + SHARED_OFFSET);
+      rvm_about_to_modify(trans, seg, SHARED_OFFSET, sizeof(int));
+      (*shared)++;
+    }
+    rvm_commit_trans(trans);
+  }
+}
+
+/* proc1 checks lock conflicts, runs the workers, then exits */
+void proc1() {
+  rvm_t rvm;
+  char* segs[1];
+
+  rvm = rvm_init("rvm_segments");
+  rvm_destroy(rvm, "testseg31");
+  segs[0] = (char*) rvm_map(rvm, "testseg31", SEG_SIZE);
+
+  trans_t t1 = rvm_begin_trans_flags(rvm, 1, (void**) segs, RVM_TRANS_SHARED);
+  trans_t t2 = rvm_begin_trans_flags(rvm, 1, (void**) segs, RVM_TRANS_SHARED);
+  if (t1 == (trans_t) -1 || t2 == (trans_t) -1) {
+    printf("ERROR: shared transactions on one segment rejected\n");
+    exit(2);
+  }
+  if (rvm_begin_trans(rvm, 1, (void**) segs) != (trans_t) -1) {
+    printf("ERROR: exclusive transaction began on a shared segment\n");
+    exit(2);
+  }
+
+  rvm_about_to_modify(t1, segs[0], 100, 50);
+  if (rvm_try_about_to_modify(t2, segs[0], 120, 10) != -1) {
+    printf("ERROR: overlapping range was granted\n");
+    exit(2);
+  }
+  if (rvm_try_about_to_modify(t2, segs[0], 150, 10) != 0) {
+    printf("ERROR: disjoint range was refused\n");
+    exit(2);
+  }
+  if (rvm_try_about_to_modify(t1, segs[0], 100, 10) != 0) {
+    printf("ERROR: transaction conflicted with itself\n");
+    exit(2);
+  }
+
+  // t2 waits for the range until t1 commits
+  std::atomic<bool> committed(false);
+  std::thread waiter([&]() {
+    rvm_about_to_modify(t2, segs[0], 120, 10);
+    if (!committed) {
+      printf("ERROR: overlapping range granted before commit\n");
+      exit(2);
+    }
+    segs[0][120] = 'b';
+    rvm_commit_trans(t2);
+  });
+  usleep(10000);
+  segs[0][120] = 'a';
+  committed = true;
+  rvm_commit_trans(t1);
+  waiter.join();
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < NUM_THREADS; i++) {
+    threads.push_back(std::thread(worker, rvm, segs[0], i));
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  abort();
+}
+
+/* proc2 maps the segment and checks the committed values */
+void proc2(int truncate) {
+  rvm_t rvm;
+  char* seg;
+
+  rvm = rvm_init("rvm_segments");
+  if (truncate) {
+    rvm_truncate_log(rvm);
+  }
+
+  seg = (char*) rvm_map(rvm, "testseg31", SEG_SIZE);
+  if (seg[120] != 'b') {
+    printf("ERROR: waiting transaction was not logged after the first\n");
+    exit(2);
+  }
+  for (int i = 0; i < NUM_THREADS; i++) {
+    if (((int*) (seg + i * SLOT_SIZE))[0] != NUM_TRANS) {
+      printf("ERROR: slot %d has count %d\n", i, ((int*) (seg + i * SLOT_SIZE))[0]);
+      exit(2);
+    }
+  }
+  if (((int*) (seg + SHARED_OFFSET))[0] != NUM_THREADS * NUM_TRANS / 10) {
+    printf("ERROR: shared counter is %d\n", ((int*) (seg + SHARED_OFFSET))[0]);
+    exit(2);
+  }
+  rvm_unmap(rvm, seg);
+}
+
+int main(int argc, char** argv) {
+  int pid;
+
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(2);
+  }
+  if (pid == 0) {
+    proc1();
+    exit(0);
+  }
+
+  waitpid(pid, NULL, 0);
+
+  proc2(0);
+  proc2(1);
+
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * Test that read-only transactions see the last committed state as of
+ * their start while writers keep modifying, committing and aborting
+ */
+#include "rvm.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include <atomic>
+
+#define SEG_SIZE 10000
+#define NUM_ACCOUNTS 100
+#define TOTAL 1000000
+#define NUM_TRANS 5000
+#define NUM_READERS 3
+
+static std::atomic<bool> g_done(false);
+
+/* Moves money between accounts kept in two segments, aborting some moves */
+static void writer(rvm_t rvm, char** segs) {
+  for (int i = 0; i < NUM_TRANS; i++) {
+    trans_t trans = rvm_begin_trans(rvm, 2, (void**) segs);
+    int from = (i * 7) % NUM_ACCOUNTS;
+    int to = (i * 13) % NUM_ACCOUNTS;
+    int* a = (int*) segs[0];
+    int* b = (int*) segs[1];
+
+    rvm_about_to_modify(trans, segs[0], from * sizeof(int), sizeof(int));
+    a[from] -= i;
+    rvm_about_to_modify(trans, segs[1], to * sizeof(int), sizeof(int));
+    b[to] += i;
+    if (i % 5 == 0) {
+      rvm_abort_trans(trans);
+    } else {
+      rvm_commit_trans(trans);
+    }
+  }
+  g_done = true;
+}
+
+/* Checks that every snapshot sees balanced accounts */
+static void reader(rvm_t rvm, char** segs) {
+  int a[NUM_ACCOUNTS];
+  int b[NUM_ACCOUNTS];
+  while (!g_done) {
+    trans_t trans = rvm_begin_read_trans(rvm);
+    rvm_read(trans, segs[0], 0, a, sizeof(a));
+    usleep(10);
+    rvm_read(trans, segs[1], 0, b, sizeof(b));
+    rvm_commit_trans(trans);
+
+    long sum = 0;
+    for (int i = 0; i < NUM_ACCOUNTS; i++) {
+      sum += a[i] + b[i];
+    }
+    if (sum != TOTAL) {
+      printf("ERROR: snapshot sees a sum of %ld\n", sum);
+      exit(2);
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  rvm_t rvm;
+  char* segs[2];
+  int value;
+
+  rvm = rvm_init("rvm_segments");
+  rvm_destroy(rvm, "testseg32a");
+  rvm_destroy(rvm, "testseg32b");
+  segs[0] = (char*) rvm_map(rvm, "testseg32a", SEG_SIZE);
+  segs[1] = (char*) rvm_map(rvm, "testseg32b", SEG_SIZE);
+
+  if (rvm_begin_read_trans(rvm) != (trans_t) -1) {
+    printf("ERROR: read transaction began without snapshots enabled\n");
+    exit(2);
+  }
+
+  trans_t trans = rvm_begin_trans(rvm, 2, (void**) segs);
+  if (rvm_set_option(rvm, RVM_OPT_SNAPSHOTS, 1) != -1) {
+    printf("ERROR: snapshots enabled while a transaction is open\n");
+    exit(2);
+  }
+  rvm_abort_trans(trans);
+  if (rvm_set_option(rvm, RVM_OPT_SNAPSHOTS, 1) != 0) {
+    printf("ERROR: failed to enable snapshots\n");
+    exit(2);
+  }
+
+  trans = rvm_begin_trans(rvm, 2, (void**) segs);
+  rvm_about_to_modify(trans, segs[0], 0, sizeof(int));
+  ((int*) segs[0])[0] = TOTAL;
+  rvm_commit_trans(trans);
+
+  // A reader does not see uncommitted bytes or commits after its start
+  trans_t early = rvm_begin_read_trans(rvm);
+  trans = rvm_begin_trans(rvm, 2, (void**) segs);
+  rvm_about_to_modify(trans, segs[0], 0, sizeof(int));
+  ((int*) segs[0])[0] = 5;
+  rvm_read(early, segs[0], 0, &value, sizeof(int));
+  if (value != TOTAL) {
+    printf("ERROR: reader saw uncommitted value %d\n", value);
+    exit(2);
+  }
+  rvm_commit_trans(trans);
+  rvm_read(early, segs[0], 0, &value, sizeof(int));
+  if (value != TOTAL) {
+    printf("ERROR: reader saw a later commit %d\n", value);
+    exit(2);
+  }
+
+  trans_t late = rvm_begin_read_trans(rvm);
+  rvm_read(late, segs[0], 0, &value, sizeof(int));
+  if (value != 5) {
+    printf("ERROR: new reader missed the commit, saw %d\n", value);
+    exit(2);
+  }
+  // Segments a reader has read can not be moved until it ends
+  if (rvm_resize(rvm, segs[0], 2 * SEG_SIZE) != (void*) -1) {
+    printf("ERROR: resized a segment being read\n");
+    exit(2);
+  }
+  rvm_commit_trans(early);
+  rvm_abort_trans(late);
+  segs[0] = (char*) rvm_resize(rvm, segs[0], 2 * SEG_SIZE);
+  if (segs[0] == (char*) -1) {
+    printf("ERROR: could not resize a segment after its readers ended\n");
+    exit(2);
+  }
+
+  trans = rvm_begin_trans(rvm, 2, (void**) segs);
+  rvm_about_to_modify(trans, segs[0], 0, sizeof(int));
+  ((int*) segs[0])[0] = TOTAL;
+  rvm_commit_trans(trans);
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < NUM_READERS; i++) {
+    threads.push_back(std::thread(reader, rvm, segs));
+  }
+  threads.push_back(std::thread(writer, rvm, segs));
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * Test that rvm_rollback_to() undoes only the changes declared after a
+ * savepoint and that the rest of the transaction still commits
+ */
+#include "rvm.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#define SEG_SIZE 10000
+#define OFFSET_A 0
+#define OFFSET_B 1000
+#define OFFSET_C 2000
+#define OFFSET_D 3000
+
+static void check(char* seg, int offset, const char* expected, const char* what) {
+  if (strcmp(seg + offset, expected)) {
+    printf("ERROR: %s is \"%s\", expected \"%s\"\n", what, seg + offset, expected);
+    exit(2);
+  }
+}
+
+/* proc1 commits a transaction with partial rollbacks, then exits */
+void proc1() {
+  rvm_t rvm;
+  trans_t trans;
+  char* segs[1];
+  int s0, s1, s2;
+
+  rvm = rvm_init("rvm_segments");
+  rvm_destroy(rvm, "testseg33");
+  segs[0] = (char*) rvm_map(rvm, "testseg33", SEG_SIZE);
+
+  trans = rvm_begin_trans(rvm, 1, (void**) segs);
+  rvm_about_to_modify(trans, segs[0], OFFSET_A, 100);
+  sprintf(segs[0] + OFFSET_A, "first");
+
+  s0 = rvm_savepoint(trans);
+  rvm_about_to_modify(trans, segs[0], OFFSET_A, 100);
+  sprintf(segs[0] + OFFSET_A, "second");
+  rvm_about_to_modify(trans, segs[0], OFFSET_B, 100);
+  sprintf(segs[0] + OFFSET_B, "dropped");
+  rvm_rollback_to(trans, s0);
+  check(segs[0], OFFSET_A, "first", "A after rollback to s0");
+  check(segs[0], OFFSET_B, "", "B after rollback to s0");
+
+  // The savepoint can be rolled back to again
+  rvm_about_to_modify(trans, segs[0], OFFSET_B, 100);
+  sprintf(segs[0] + OFFSET_B, "dropped again");
+  rvm_rollback_to(trans, s0);
+  check(segs[0], OFFSET_B, "", "B after second rollback to s0");
+
+  rvm_about_to_modify(trans, segs[0], OFFSET_C, 100);
+  sprintf(segs[0] + OFFSET_C, "kept");
+  s1 = rvm_savepoint(trans);
+  rvm_about_to_modify(trans, segs[0], OFFSET_D, 100);
+  sprintf(segs[0] + OFFSET_D, "dropped");
+  s2 = rvm_savepoint(trans);
+  if (s1 != s0 + 1 || s2 != s1 + 1) {
+    printf("ERROR: savepoints numbered %d %d %d\n", s0, s1, s2);
+    exit(2);
+  }
+  rvm_about_to_modify(trans, segs[0], OFFSET_D, 100);
+  sprintf(segs[0] + OFFSET_D, "dropped too");
+  rvm_rollback_to(trans, s1);
+  check(segs[0], OFFSET_D, "", "D after rollback to s1");
+  rvm_commit_trans(trans);
+
+  // Aborting after savepoints undoes everything
+  trans = rvm_begin_trans(rvm, 1, (void**) segs);
+  rvm_about_to_modify(trans, segs[0], OFFSET_A, 100);
+  sprintf(segs[0] + OFFSET_A, "aborted");
+  rvm_savepoint(trans);
+  rvm_about_to_modify(trans, segs[0], OFFSET_A, 100);
+  sprintf(segs[0] + OFFSET_A, "aborted too");
+  rvm_abort_trans(trans);
+  check(segs[0], OFFSET_A, "first", "A after abort");
+
+  abort();
+}
+
+/* proc2 maps the segment and checks the committed state */
+void proc2(int truncate) {
+  rvm_t rvm;
+  char* seg;
+
+  rvm = rvm_init("rvm_segments");
+  if (truncate) {
+    rvm_truncate_log(rvm);
+  }
+
+  seg = (char*) rvm_map(rvm, "testseg33", SEG_SIZE);
+  check(seg, OFFSET_A, "first", "recovered A");
+  check(seg, OFFSET_B, "", "recovered B");
+  check(seg, OFFSET_C, "kept", "recovered C");
+  check(seg, OFFSET_D, "", "recovered D");
+  rvm_unmap(rvm, seg);
+}
+
+int main(int argc, char** argv) {
+  int pid;
+
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(2);
+  }
+  if (pid == 0) {
+    proc1();
+    exit(0);
+  }
+
+  waitpid(pid, NULL, 0);
+
+  proc2(0);
+  proc2(1);
+
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,108 @@
+/*
+ * Test that no-restore transactions commit like normal ones and that
+ * aborting one is an error
+ */
+#include "rvm.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#define TEST_STRING1 "hello, world"
+#define TEST_STRING2 "bleg!"
+#define OFFSET2 1000
+
+/* proc1 commits with a no-restore transaction, then exits */
+void proc1() {
+  rvm_t rvm;
+  trans_t trans;
+  char* segs[1];
+
+  rvm = rvm_init("rvm_segments");
+  rvm_destroy(rvm, "testseg34");
+  segs[0] = (char*) rvm_map(rvm, "testseg34", 10000);
+
+  trans = rvm_begin_trans_flags(rvm, 1, (void**) segs, RVM_TRANS_NO_RESTORE);
+  rvm_about_to_modify(trans, segs[0], 0, 100);
+  sprintf(segs[0], TEST_STRING1);
+  rvm_about_to_modify(trans, segs[0], OFFSET2, 100);
+  sprintf(segs[0] + OFFSET2, TEST_STRING1);
+  rvm_about_to_modify(trans, segs[0], OFFSET2, 100);
+  sprintf(segs[0] + OFFSET2, TEST_STRING2);
+  rvm_commit_trans(trans);
+
+  abort();
+}
+
+/* proc2 starts a no-restore transaction and aborts it */
+void proc2() {
+  rvm_t rvm;
+  trans_t trans;
+  char* segs[1];
+
+  rvm = rvm_init("rvm_segments");
+  segs[0] = (char*) rvm_map(rvm, "testseg34", 10000);
+  trans = rvm_begin_trans_flags(rvm, 1, (void**) segs, RVM_TRANS_NO_RESTORE);
+  rvm_about_to_modify(trans, segs[0], 0, 100);
+  rvm_abort_trans(trans);
+  exit(0);
+}
+
+/* proc3 maps the segment and checks the committed values */
+void proc3(int truncate) {
+  char* segs[1];
+  rvm_t rvm;
+
+  rvm = rvm_init("rvm_segments");
+  if (truncate) {
+    rvm_truncate_log(rvm);
+  }
+
+  segs[0] = (char*) rvm_map(rvm, "testseg34", 10000);
+  if (strcmp(segs[0], TEST_STRING1)) {
+    printf("ERROR: first hello not present\n");
+    exit(2);
+  }
+  if (strcmp(segs[0] + OFFSET2, TEST_STRING2)) {
+    printf("ERROR: second value not present\n");
+    exit(2);
+  }
+  rvm_unmap(rvm, segs[0]);
+}
+
+int main(int argc, char** argv) {
+  int pid;
+  int status;
+
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(2);
+  }
+  if (pid == 0) {
+    proc1();
+    exit(0);
+  }
+  waitpid(pid, NULL, 0);
+
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(2);
+  }
+  if (pid == 0) {
+    proc2();
+  }
+  waitpid(pid, &status, 0);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_FAILURE) {
+    printf("ERROR: aborting a no-restore transaction did not fail\n");
+    exit(2);
+  }
+
+  proc3(0);
+  proc3(1);
+
+  printf("OK\n");
+  return 0;
+}
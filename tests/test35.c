@@ -0,0 +1,145 @@
+/*
+ * Test that no-flush commits are visible at once but only durable after
+ * rvm_flush(), a flushing commit or a full log buffer
+ */
+#include "rvm.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#define OFFSET_A 0
+#define OFFSET_B 1000
+#define OFFSET_C 2000
+#define OFFSET_D 3000
+
+static long g_durable = 0;
+
+static void on_durable(rvm_t rvm, long ticket, void* arg) {
+  g_durable = ticket;
+}
+
+static long write_string(rvm_t rvm, char* seg, int offset, const char* str, int flush) {
+  trans_t trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+  rvm_about_to_modify(trans, seg, offset, 100);
+  strcpy(seg + offset, str);
+  if (flush) {
+    rvm_commit_trans(trans);
+    return 0;
+  }
+  return rvm_commit_trans_no_flush(trans);
+}
+
+static void check(char* seg, int offset, const char* expected, const char* what) {
+  if (strcmp(seg + offset, expected)) {
+    printf("ERROR: %s is \"%s\", expected \"%s\"\n", what, seg + offset, expected);
+    exit(2);
+  }
+}
+
+/* proc1 leaves one no-flush commit unflushed, then crashes */
+void proc1() {
+  rvm_t rvm;
+  char* seg;
+  long ticket;
+
+  rvm = rvm_init("rvm_segments");
+  rvm_destroy(rvm, "testseg35");
+  seg = (char*) rvm_map(rvm, "testseg35", 10000);
+  rvm_set_durable_callback(rvm, on_durable, NULL);
+
+  // A flushing commit also writes the no-flush commits before it
+  ticket = write_string(rvm, seg, OFFSET_A, "a", 0);
+  if (rvm_is_durable(rvm, ticket)) {
+    printf("ERROR: no-flush commit durable before a flush\n");
+    exit(2);
+  }
+  write_string(rvm, seg, OFFSET_B, "b", 1);
+  if (!rvm_is_durable(rvm, ticket) || g_durable < ticket) {
+    printf("ERROR: flushing commit did not flush earlier commits\n");
+    exit(2);
+  }
+
+  // rvm_flush() makes buffered commits durable
+  ticket = write_string(rvm, seg, OFFSET_C, "c", 0);
+  rvm_flush(rvm);
+  if (!rvm_is_durable(rvm, ticket) || g_durable != ticket) {
+    printf("ERROR: rvm_flush() did not make the commit durable\n");
+    exit(2);
+  }
+
+  // This one is visible but lost in the crash
+  ticket = write_string(rvm, seg, OFFSET_D, "d", 0);
+  check(seg, OFFSET_D, "d", "unflushed D");
+  abort();
+}
+
+/* proc2 checks a full buffer flushes on its own */
+void proc2() {
+  rvm_t rvm;
+  char* seg;
+  long ticket;
+
+  rvm = rvm_init("rvm_segments");
+  seg = (char*) rvm_map(rvm, "testseg35", 10000);
+  check(seg, OFFSET_A, "a", "recovered A");
+  check(seg, OFFSET_B, "b", "recovered B");
+  check(seg, OFFSET_C, "c", "recovered C");
+  check(seg, OFFSET_D, "", "unflushed D");
+
+  rvm_set_option(rvm, RVM_OPT_LOG_BUFFER_SIZE, 1);
+  ticket = write_string(rvm, seg, OFFSET_D, "d2", 0);
+  if (!rvm_is_durable(rvm, ticket)) {
+    printf("ERROR: full log buffer was not flushed\n");
+    exit(2);
+  }
+  abort();
+}
+
+/* proc3 maps the segment and checks the final values */
+void proc3(int truncate) {
+  rvm_t rvm;
+  char* seg;
+
+  rvm = rvm_init("rvm_segments");
+  if (truncate) {
+    rvm_truncate_log(rvm);
+  }
+  seg = (char*) rvm_map(rvm, "testseg35", 10000);
+  check(seg, OFFSET_A, "a", "recovered A");
+  check(seg, OFFSET_D, "d2", "recovered D");
+  rvm_unmap(rvm, seg);
+}
+
+int main(int argc, char** argv) {
+  int pid;
+
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(2);
+  }
+  if (pid == 0) {
+    proc1();
+    exit(0);
+  }
+  waitpid(pid, NULL, 0);
+
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(2);
+  }
+  if (pid == 0) {
+    proc2();
+    exit(0);
+  }
+  waitpid(pid, NULL, 0);
+
+  proc3(0);
+  proc3(1);
+
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,123 @@
+/*
+ * Test that asynchronous commits complete through polling, waiting,
+ * callbacks and eventfds, and that completed commits are recovered
+ */
+#include "rvm.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+#define NUM_TRANS 1000
+#define SEG_SIZE 10000
+
+static std::atomic<int> g_completed(0);
+
+static void on_commit(rvm_commit_t handle, void* arg) {
+  g_completed++;
+}
+
+/* proc1 pipelines commits without waiting for each one, then crashes
+ * once the last is durable */
+void proc1() {
+  rvm_t rvm;
+  char* seg;
+  std::vector<rvm_commit_t> handles;
+
+  rvm = rvm_init("rvm_segments");
+  rvm_destroy(rvm, "testseg36");
+  seg = (char*) rvm_map(rvm, "testseg36", SEG_SIZE);
+
+  for (int i = 0; i < NUM_TRANS; i++) {
+    trans_t trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+    rvm_about_to_modify(trans, seg, (i % 100) * sizeof(int), sizeof(int));
+    ((int*) seg)[i % 100] = i;
+    rvm_commit_t handle = rvm_commit_trans_async(trans);
+    rvm_commit_set_callback(handle, on_commit, NULL);
+    handles.push_back(handle);
+  }
+
+  // Wait for the last commit through its eventfd
+  struct pollfd pfd;
+  pfd.fd = rvm_commit_eventfd(handles.back());
+  pfd.events = POLLIN;
+  if (pfd.fd < 0 || poll(&pfd, 1, 10000) != 1) {
+    printf("ERROR: eventfd of the last commit never became readable\n");
+    exit(2);
+  }
+  uint64_t value;
+  if (read(pfd.fd, &value, sizeof(uint64_t)) != sizeof(uint64_t) || value != 1) {
+    printf("ERROR: bad eventfd value\n");
+    exit(2);
+  }
+
+  // Commits become durable in order
+  for (rvm_commit_t handle : handles) {
+    if (!rvm_commit_poll(handle)) {
+      printf("ERROR: earlier commit not durable after the last one\n");
+      exit(2);
+    }
+    rvm_commit_wait(handle);
+    rvm_commit_release(handle);
+  }
+  if (g_completed != NUM_TRANS) {
+    printf("ERROR: %d of %d callbacks ran\n", (int) g_completed, NUM_TRANS);
+    exit(2);
+  }
+
+  // A handle for an empty transaction is complete at once
+  trans_t trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+  rvm_commit_t handle = rvm_commit_trans_async(trans);
+  if (!rvm_commit_poll(handle)) {
+    printf("ERROR: empty commit not complete\n");
+    exit(2);
+  }
+  rvm_commit_release(handle);
+
+  abort();
+}
+
+/* proc2 checks the last value written to each slot */
+void proc2(int truncate) {
+  rvm_t rvm;
+  char* seg;
+
+  rvm = rvm_init("rvm_segments");
+  if (truncate) {
+    rvm_truncate_log(rvm);
+  }
+  seg = (char*) rvm_map(rvm, "testseg36", SEG_SIZE);
+  for (int i = 0; i < 100; i++) {
+    if (((int*) seg)[i] != NUM_TRANS - 100 + i) {
+      printf("ERROR: slot %d is %d\n", i, ((int*) seg)[i]);
+      exit(2);
+    }
+  }
+  rvm_unmap(rvm, seg);
+}
+
+int main(int argc, char** argv) {
+  int pid;
+
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(2);
+  }
+  if (pid == 0) {
+    proc1();
+    exit(0);
+  }
+  waitpid(pid, NULL, 0);
+
+  proc2(0);
+  proc2(1);
+
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ * Test that commits, truncation and recovery give the same segment with
+ * every I/O engine, with and without synchronous writes
+ */
+#include "rvm.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#define SEG_SIZE 10000
+#define NUM_WRITES 200
+
+static void fill(char* seg, int round) {
+  int i;
+  for (i = 0; i < SEG_SIZE; i++) {
+    seg[i] = (char) ('a' + (i + round) % 26);
+  }
+}
+
+/* proc1 makes overlapping commits, truncates part way and crashes */
+void proc1(int engine, int sync) {
+  rvm_t rvm;
+  char* seg;
+  trans_t trans;
+  int i;
+
+  rvm = rvm_init("rvm_segments");
+  if (rvm_set_option(rvm, RVM_OPT_IO_ENGINE, engine) != 0) {
+    printf("ERROR: engine %d could not be set\n", engine);
+    exit(2);
+  }
+  rvm_set_option(rvm, RVM_OPT_SYNC, sync);
+  rvm_destroy(rvm, "testseg37");
+  seg = (char*) rvm_map(rvm, "testseg37", SEG_SIZE);
+
+  // Records of one truncation overlap, so later ones must land last
+  for (i = 0; i < NUM_WRITES; i++) {
+    trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+    rvm_about_to_modify(trans, seg, 0, SEG_SIZE);
+    fill(seg, i);
+    rvm_commit_trans(trans);
+    if (i == NUM_WRITES / 2) {
+      rvm_truncate_log(rvm);
+    }
+  }
+
+  // Shrink and grow again, the regrown tail must read back as zeros
+  seg = (char*) rvm_resize(rvm, seg, SEG_SIZE / 2);
+  seg = (char*) rvm_resize(rvm, seg, SEG_SIZE);
+  abort();
+}
+
+/* proc2 checks the recovered segment, before and after truncating */
+void proc2(int truncate) {
+  rvm_t rvm;
+  char* seg;
+  char expected[SEG_SIZE];
+
+  rvm = rvm_init("rvm_segments");
+  if (truncate) {
+    rvm_truncate_log(rvm);
+  }
+  seg = (char*) rvm_map(rvm, "testseg37", SEG_SIZE);
+  fill(expected, NUM_WRITES - 1);
+  memset(expected + SEG_SIZE / 2, 0, SEG_SIZE / 2);
+  if (memcmp(seg, expected, SEG_SIZE)) {
+    printf("ERROR: recovered segment does not match\n");
+    exit(2);
+  }
+  rvm_unmap(rvm, seg);
+}
+
+int run(int engine, int sync) {
+  int pid;
+  int status;
+
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(2);
+  }
+  if (pid == 0) {
+    proc1(engine, sync);
+    exit(0);
+  }
+  waitpid(pid, NULL, 0);
+
+  // Each check runs in its own process so that it recovers from disk
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(2);
+  }
+  if (pid == 0) {
+    proc2(0);
+    proc2(1);
+    exit(0);
+  }
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/* probe checks engine selection, exits 0 if io_uring is available */
+void probe() {
+  rvm_t rvm;
+
+  rvm = rvm_init("rvm_segments");
+  if (rvm_set_option(rvm, RVM_OPT_IO_ENGINE, 42) != -1) {
+    printf("ERROR: invalid engine accepted\n");
+    exit(2);
+  }
+  exit(rvm_set_option(rvm, RVM_OPT_IO_ENGINE, RVM_IO_ENGINE_URING) == 0 ? 0 : 1);
+}
+
+int main(int argc, char** argv) {
+  int pid;
+  int status;
+  int uring;
+
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(2);
+  }
+  if (pid == 0) {
+    probe();
+  }
+  waitpid(pid, &status, 0);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) == 2) {
+    exit(2);
+  }
+  uring = (WEXITSTATUS(status) == 0);
+
+  if (!run(RVM_IO_ENGINE_POSIX, 0) || !run(RVM_IO_ENGINE_POSIX, 1) || !run(RVM_IO_ENGINE_AUTO, 0)) {
+    exit(2);
+  }
+  // io_uring may be missing or disabled in this kernel
+  if (uring && (!run(RVM_IO_ENGINE_URING, 0) || !run(RVM_IO_ENGINE_URING, 1))) {
+    exit(2);
+  }
+
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,138 @@
+/*
+ * Test that a direct, preallocated log recovers like a buffered one and
+ * that both modes can append to the same log
+ */
+#include "rvm.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define SEG_SIZE 20000
+#define LOG_PATH "rvm_segments/redo_log.rvm"
+
+static void write_byte(rvm_t rvm, char* seg, int offset, int size, char value) {
+  trans_t trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+  rvm_about_to_modify(trans, seg, offset, size);
+  memset(seg + offset, value, size);
+  rvm_commit_trans(trans);
+}
+
+static void check(char* seg, int offset, int size, char value, const char* what) {
+  int i;
+  for (i = 0; i < size; i++) {
+    if (seg[offset + i] != value) {
+      printf("ERROR: %s has '%c' at %d, expected '%c'\n", what, seg[offset + i], offset + i, value);
+      exit(2);
+    }
+  }
+}
+
+static long log_size() {
+  struct stat st;
+  if (stat(LOG_PATH, &st) != 0) {
+    return -1;
+  }
+  return (long) st.st_size;
+}
+
+/* proc1 commits small and multi-block transactions to a direct log */
+void proc1() {
+  rvm_t rvm;
+  char* seg;
+
+  rvm = rvm_init("rvm_segments");
+  rvm_destroy(rvm, "testseg38");
+  seg = (char*) rvm_map(rvm, "testseg38", SEG_SIZE);
+  rvm_set_option(rvm, RVM_OPT_DIRECT_LOG, 1);
+
+  write_byte(rvm, seg, 0, 10, 'a');
+  write_byte(rvm, seg, 100, 9000, 'b');
+  write_byte(rvm, seg, 10000, 4000, 'c');
+  if (log_size() % 4096 != 0 || log_size() < 3 * 4096) {
+    printf("ERROR: direct log size %ld is not whole blocks\n", log_size());
+    exit(2);
+  }
+  abort();
+}
+
+/* proc2 recovers, appends without direct I/O, then crashes */
+void proc2() {
+  rvm_t rvm;
+  char* seg;
+
+  rvm = rvm_init("rvm_segments");
+  seg = (char*) rvm_map(rvm, "testseg38", SEG_SIZE);
+  check(seg, 0, 10, 'a', "recovered A");
+  check(seg, 100, 9000, 'b', "recovered B");
+  check(seg, 10000, 4000, 'c', "recovered C");
+
+  write_byte(rvm, seg, 15000, 7, 'd');
+  abort();
+}
+
+/* proc3 recovers, appends with direct I/O after the buffered entry */
+void proc3() {
+  rvm_t rvm;
+  char* seg;
+
+  rvm = rvm_init("rvm_segments");
+  seg = (char*) rvm_map(rvm, "testseg38", SEG_SIZE);
+  check(seg, 15000, 7, 'd', "recovered D");
+
+  rvm_set_option(rvm, RVM_OPT_DIRECT_LOG, 1);
+  write_byte(rvm, seg, 0, 10, 'e');
+  abort();
+}
+
+/* proc4 checks the final values, before and after truncating */
+void proc4(int truncate) {
+  rvm_t rvm;
+  char* seg;
+
+  rvm = rvm_init("rvm_segments");
+  if (truncate) {
+    rvm_truncate_log(rvm);
+  }
+  seg = (char*) rvm_map(rvm, "testseg38", SEG_SIZE);
+  check(seg, 0, 10, 'e', "final A");
+  check(seg, 100, 9000, 'b', "final B");
+  check(seg, 10000, 4000, 'c', "final C");
+  check(seg, 15000, 7, 'd', "final D");
+  rvm_unmap(rvm, seg);
+}
+
+/* Runs proc in a child, which either crashes or exits cleanly */
+void run(void (*proc)(void)) {
+  int status;
+  int pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(2);
+  }
+  if (pid == 0) {
+    proc();
+    exit(0);
+  }
+  waitpid(pid, &status, 0);
+  if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+    exit(2);
+  }
+}
+
+void proc4_no_truncate() {
+  proc4(0);
+}
+
+int main(int argc, char** argv) {
+  run(proc1);
+  run(proc2);
+  run(proc3);
+  run(proc4_no_truncate);
+  proc4(1);
+
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,130 @@
+/*
+ * Test that commits only log the bytes that changed inside the ranges
+ * declared with rvm_about_to_modify()
+ */
+#include "rvm.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define SEG_SIZE 100000
+#define LOG_PATH "rvm_segments/redo_log.rvm"
+
+static long log_size() {
+  struct stat st;
+  if (stat(LOG_PATH, &st) != 0) {
+    return 0;
+  }
+  return (long) st.st_size;
+}
+
+/* proc1 declares whole-segment ranges but changes only a few bytes */
+void proc1() {
+  rvm_t rvm;
+  char* seg;
+  trans_t trans;
+  long before;
+
+  rvm = rvm_init("rvm_segments");
+  rvm_destroy(rvm, "testseg39");
+  seg = (char*) rvm_map(rvm, "testseg39", SEG_SIZE);
+
+  // Three changed runs, two of them close enough to share a record
+  before = log_size();
+  trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+  rvm_about_to_modify(trans, seg, 0, SEG_SIZE);
+  strcpy(seg + 10, "hello");
+  strcpy(seg + 20, "world");
+  strcpy(seg + 90000, "end");
+  rvm_commit_trans(trans);
+  if (log_size() - before > 500) {
+    printf("ERROR: %ld bytes logged for 13 changed bytes\n", log_size() - before);
+    exit(2);
+  }
+
+  // Bytes changed and then restored are not logged at all
+  before = log_size();
+  trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+  rvm_about_to_modify(trans, seg, 0, SEG_SIZE);
+  seg[50000] = 'x';
+  seg[50000] = 0;
+  rvm_commit_trans(trans);
+  if (log_size() != before) {
+    printf("ERROR: unchanged range was logged\n");
+    exit(2);
+  }
+
+  // Overlapping ranges taken after a change still log every change
+  trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+  rvm_about_to_modify(trans, seg, 1000, 100);
+  seg[1050] = 'a';
+  rvm_about_to_modify(trans, seg, 1040, 100);
+  seg[1120] = 'b';
+  rvm_commit_trans(trans);
+
+  trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+  rvm_about_to_modify(trans, seg, 60000, 1000);
+  memset(seg + 60000, 'p', 1000);
+  rvm_commit_trans(trans);
+
+  // Without undo copies the whole range is logged
+  before = log_size();
+  trans = rvm_begin_trans_flags(rvm, 1, (void**) &seg, RVM_TRANS_NO_RESTORE);
+  rvm_about_to_modify(trans, seg, 60000, 1000);
+  seg[60500] = 'n';
+  rvm_commit_trans(trans);
+  if (log_size() - before < 1000) {
+    printf("ERROR: no-restore range was not logged whole\n");
+    exit(2);
+  }
+  abort();
+}
+
+/* proc2 checks the recovered values */
+void proc2(int truncate) {
+  rvm_t rvm;
+  char* seg;
+
+  rvm = rvm_init("rvm_segments");
+  if (truncate) {
+    rvm_truncate_log(rvm);
+  }
+  seg = (char*) rvm_map(rvm, "testseg39", SEG_SIZE);
+  if (strcmp(seg + 10, "hello") || strcmp(seg + 20, "world") || strcmp(seg + 90000, "end")) {
+    printf("ERROR: changed runs not recovered\n");
+    exit(2);
+  }
+  if (seg[1050] != 'a' || seg[1120] != 'b' || seg[60500] != 'n' || seg[60000] != 'p' || seg[50000] != 0) {
+    printf("ERROR: overlapping or no-restore changes not recovered\n");
+    exit(2);
+  }
+  rvm_unmap(rvm, seg);
+}
+
+int main(int argc, char** argv) {
+  int pid;
+  int status;
+
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(2);
+  }
+  if (pid == 0) {
+    proc1();
+    exit(0);
+  }
+  waitpid(pid, &status, 0);
+  if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+    exit(2);
+  }
+
+  proc2(0);
+  proc2(1);
+
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,143 @@
+/*
+ * Test that compressed redo records shrink the log and recover, mixed
+ * with plain records in the same log
+ */
+#include "rvm.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define SEG_SIZE 65536
+#define RANDOM_OFFSET 40000
+#define RANDOM_SIZE 4000
+#define LOG_PATH "rvm_segments/redo_log.rvm"
+
+struct item {
+  int id;
+  int flags;
+  long counter;
+  char name[48];
+};
+
+static long log_size() {
+  struct stat st;
+  if (stat(LOG_PATH, &st) != 0) {
+    return 0;
+  }
+  return (long) st.st_size;
+}
+
+static void fill_items(char* seg, int count, int seed) {
+  struct item* items = (struct item*) seg;
+  int i;
+  for (i = 0; i < count; i++) {
+    memset(&items[i], 0, sizeof(struct item));
+    items[i].id = i;
+    items[i].counter = seed;
+    sprintf(items[i].name, "item-%d", i % 10);
+  }
+}
+
+static void fill_random(char* seg) {
+  int i;
+  srand(40);
+  for (i = 0; i < RANDOM_SIZE; i++) {
+    seg[RANDOM_OFFSET + i] = (char) rand();
+  }
+}
+
+/* proc1 commits compressible and random data, then crashes */
+void proc1() {
+  rvm_t rvm;
+  char* seg;
+  trans_t trans;
+  int count = 500;
+  long before;
+
+  rvm = rvm_init("rvm_segments");
+  rvm_destroy(rvm, "testseg40");
+  seg = (char*) rvm_map(rvm, "testseg40", SEG_SIZE);
+  if (rvm_set_option(rvm, RVM_OPT_COMPRESSION, 99) != -1) {
+    printf("ERROR: invalid codec accepted\n");
+    exit(2);
+  }
+  rvm_set_option(rvm, RVM_OPT_COMPRESSION, RVM_COMPRESSION_LZ);
+
+  before = log_size();
+  trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+  rvm_about_to_modify(trans, seg, 0, count * sizeof(struct item));
+  fill_items(seg, count, 1);
+  rvm_commit_trans(trans);
+  if (log_size() - before > (long) (count * sizeof(struct item)) / 3) {
+    printf("ERROR: %ld bytes logged for %ld compressible bytes\n", log_size() - before,
+           (long) (count * sizeof(struct item)));
+    exit(2);
+  }
+
+  // Random data is logged plain
+  trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+  rvm_about_to_modify(trans, seg, RANDOM_OFFSET, RANDOM_SIZE);
+  fill_random(seg);
+  rvm_commit_trans(trans);
+
+  // Plain records after compressed ones in the same log
+  rvm_set_option(rvm, RVM_OPT_COMPRESSION, RVM_COMPRESSION_NONE);
+  trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+  rvm_about_to_modify(trans, seg, 60000, 100);
+  strcpy(seg + 60000, "plain");
+  rvm_commit_trans(trans);
+  abort();
+}
+
+/* proc2 checks the recovered values */
+void proc2(int truncate) {
+  rvm_t rvm;
+  char* seg;
+  char expected[SEG_SIZE];
+
+  rvm = rvm_init("rvm_segments");
+  if (truncate) {
+    // Unbacked records are rewritten compressed
+    rvm_set_option(rvm, RVM_OPT_COMPRESSION, RVM_COMPRESSION_LZ);
+    rvm_truncate_log(rvm);
+  }
+  seg = (char*) rvm_map(rvm, "testseg40", SEG_SIZE);
+
+  memset(expected, 0, SEG_SIZE);
+  fill_items(expected, 500, 1);
+  fill_random(expected);
+  strcpy(expected + 60000, "plain");
+  if (memcmp(seg, expected, SEG_SIZE)) {
+    printf("ERROR: recovered segment does not match\n");
+    exit(2);
+  }
+  rvm_unmap(rvm, seg);
+}
+
+int main(int argc, char** argv) {
+  int pid;
+  int status;
+
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(2);
+  }
+  if (pid == 0) {
+    proc1();
+    exit(0);
+  }
+  waitpid(pid, &status, 0);
+  if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+    exit(2);
+  }
+
+  proc2(0);
+  proc2(1);
+
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * Test that zero runs are logged as zero ranges and applied to the
+ * backing file as holes
+ */
+#include "rvm.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define SEG_SIZE (2 << 20)
+#define FILL_OFFSET (512 << 10)
+#define FILL_SIZE (1 << 20)
+#define LOG_PATH "rvm_segments/redo_log.rvm"
+#define SEG_PATH "rvm_segments/seg_testseg41.rvm"
+
+static long file_size(const char* path) {
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    return 0;
+  }
+  return (long) st.st_size;
+}
+
+static long file_space(const char* path) {
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    return 0;
+  }
+  return (long) st.st_blocks * 512;
+}
+
+/* proc1 logs mostly-zero ranges, then crashes */
+void proc1() {
+  rvm_t rvm;
+  char* seg;
+  trans_t trans;
+  long before;
+
+  rvm = rvm_init("rvm_segments");
+  rvm_destroy(rvm, "testseg41");
+  seg = (char*) rvm_map(rvm, "testseg41", SEG_SIZE);
+
+  // A whole range without an undo copy is mostly zeros
+  before = file_size(LOG_PATH);
+  trans = rvm_begin_trans_flags(rvm, 1, (void**) &seg, RVM_TRANS_NO_RESTORE);
+  rvm_about_to_modify(trans, seg, 0, SEG_SIZE);
+  strcpy(seg, "head");
+  strcpy(seg + SEG_SIZE - 10, "tail");
+  rvm_commit_trans(trans);
+  if (file_size(LOG_PATH) - before > 4096) {
+    printf("ERROR: %ld bytes logged for a mostly-zero range\n", file_size(LOG_PATH) - before);
+    exit(2);
+  }
+  rvm_truncate_log(rvm);
+  if (file_space(SEG_PATH) >= FILL_SIZE) {
+    printf("ERROR: zero range allocated %ld bytes in the backing file\n", file_space(SEG_PATH));
+    exit(2);
+  }
+
+  trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+  rvm_about_to_modify(trans, seg, FILL_OFFSET, FILL_SIZE);
+  memset(seg + FILL_OFFSET, 'x', FILL_SIZE);
+  rvm_commit_trans(trans);
+  rvm_truncate_log(rvm);
+
+  // Clearing the data again logs almost nothing
+  before = file_size(LOG_PATH);
+  trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+  rvm_about_to_modify(trans, seg, FILL_OFFSET, FILL_SIZE);
+  memset(seg + FILL_OFFSET, 0, FILL_SIZE);
+  seg[FILL_OFFSET + FILL_SIZE / 2] = 'm';
+  rvm_commit_trans(trans);
+  if (file_size(LOG_PATH) - before > 4096) {
+    printf("ERROR: %ld bytes logged for a cleared range\n", file_size(LOG_PATH) - before);
+    exit(2);
+  }
+  abort();
+}
+
+/* proc2 checks the recovered segment, before and after truncating */
+void proc2(int truncate) {
+  rvm_t rvm;
+  char* seg;
+  int i;
+
+  rvm = rvm_init("rvm_segments");
+  if (truncate) {
+    rvm_truncate_log(rvm);
+    if (file_space(SEG_PATH) >= FILL_SIZE) {
+      printf("ERROR: cleared range still takes %ld bytes\n", file_space(SEG_PATH));
+      exit(2);
+    }
+  }
+  seg = (char*) rvm_map(rvm, "testseg41", SEG_SIZE);
+  if (strcmp(seg, "head") || strcmp(seg + SEG_SIZE - 10, "tail")) {
+    printf("ERROR: data around zero ranges not recovered\n");
+    exit(2);
+  }
+  for (i = FILL_OFFSET; i < FILL_OFFSET + FILL_SIZE; i++) {
+    if (seg[i] != (i == FILL_OFFSET + FILL_SIZE / 2 ? 'm' : 0)) {
+      printf("ERROR: byte %d not cleared\n", i);
+      exit(2);
+    }
+  }
+  rvm_unmap(rvm, seg);
+}
+
+int main(int argc, char** argv) {
+  int pid;
+  int status;
+
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(2);
+  }
+  if (pid == 0) {
+    proc1();
+    exit(0);
+  }
+  waitpid(pid, &status, 0);
+  if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+    exit(2);
+  }
+
+  proc2(0);
+  proc2(1);
+
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,192 @@
+/*
+ * Test logical records for counters, bit flags and append regions: they
+ * are replayed at recovery, rolled back with savepoints and folded into
+ * the backing file on truncation
+ */
+#include "rvm.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define SEG_SIZE 4096
+#define COUNTER0 0
+#define COUNTER1 8
+#define COUNTER2 16
+#define FLAGS 24
+#define REGION 64
+#define CAPACITY 200
+#define ENTRY_SIZE 16
+#define LOG_PATH "rvm_segments/redo_log.rvm"
+
+// Entries are zero padded, so they compare equal byte for byte
+static void make_entry(char* entry, int i) {
+  memset(entry, 0, ENTRY_SIZE);
+  snprintf(entry, ENTRY_SIZE, "entry-%02d", i);
+}
+
+static long file_size(const char* path) {
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    return 0;
+  }
+  return (long) st.st_size;
+}
+
+/* proc1 makes logical updates, then crashes */
+void proc1() {
+  rvm_t rvm;
+  char* seg;
+  trans_t trans;
+  char entry[ENTRY_SIZE];
+  long before;
+  long long value;
+  int i;
+  int sp;
+
+  rvm = rvm_init("rvm_segments");
+  rvm_destroy(rvm, "testseg42");
+  seg = (char*) rvm_map(rvm, "testseg42", SEG_SIZE);
+
+  // Repeated additions to a counter are logged as one record
+  before = file_size(LOG_PATH);
+  trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+  for (i = 0; i < 1000; i++) {
+    rvm_add_int64(trans, seg, COUNTER0, 1);
+  }
+  rvm_commit_trans(trans);
+  if (file_size(LOG_PATH) - before > 128) {
+    printf("ERROR: %ld bytes logged for one counter\n", file_size(LOG_PATH) - before);
+    exit(2);
+  }
+
+  for (i = 0; i < 10; i++) {
+    trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+    rvm_add_int64(trans, seg, COUNTER1, -5);
+    rvm_set_bit(trans, seg, FLAGS + i / 8, i % 8, 1);
+    make_entry(entry, i);
+    if (rvm_append(trans, seg, REGION, CAPACITY, entry, ENTRY_SIZE) != REGION + 8 + i * ENTRY_SIZE) {
+      printf("ERROR: append %d at the wrong offset\n", i);
+      exit(2);
+    }
+    rvm_commit_trans(trans);
+  }
+
+  // Logical records after a savepoint are dropped when rolling back to it
+  trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+  rvm_add_int64(trans, seg, COUNTER0, 7);
+  rvm_set_bit(trans, seg, FLAGS, 0, 0);
+  sp = rvm_savepoint(trans);
+  rvm_add_int64(trans, seg, COUNTER0, 100);
+  rvm_set_bit(trans, seg, FLAGS, 1, 0);
+  rvm_append(trans, seg, REGION, CAPACITY, "gone", 4);
+  rvm_rollback_to(trans, sp);
+  rvm_commit_trans(trans);
+
+  // A counter also changed directly is logged as bytes
+  trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+  rvm_about_to_modify(trans, seg, COUNTER2, 8);
+  value = 5;
+  memcpy(seg + COUNTER2, &value, 8);
+  rvm_add_int64(trans, seg, COUNTER2, 3);
+  rvm_commit_trans(trans);
+
+  // Fill the append region
+  trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+  for (i = 10; i < 13; i++) {
+    make_entry(entry, i);
+    if ((rvm_append(trans, seg, REGION, CAPACITY, entry, ENTRY_SIZE) == -1) != (i == 12)) {
+      printf("ERROR: append %d to a region with %d bytes\n", i, CAPACITY);
+      exit(2);
+    }
+  }
+  rvm_commit_trans(trans);
+
+  // Aborted logical updates are not logged
+  trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+  rvm_add_int64(trans, seg, COUNTER1, 1000);
+  rvm_abort_trans(trans);
+  abort();
+}
+
+/* proc2 checks the recovered segment, before and after truncating */
+void proc2(int truncate) {
+  rvm_t rvm;
+  char* seg;
+  char entry[ENTRY_SIZE];
+  long long value;
+  unsigned long long used;
+  int i;
+
+  rvm = rvm_init("rvm_segments");
+  if (truncate) {
+    rvm_truncate_log(rvm);
+    if (file_size(LOG_PATH) > 0) {
+      printf("ERROR: %ld bytes left in the log\n", file_size(LOG_PATH));
+      exit(2);
+    }
+  }
+  seg = (char*) rvm_map(rvm, "testseg42", SEG_SIZE);
+
+  memcpy(&value, seg + COUNTER0, 8);
+  if (value != 1007) {
+    printf("ERROR: counter0 is %lld\n", value);
+    exit(2);
+  }
+  memcpy(&value, seg + COUNTER1, 8);
+  if (value != -50) {
+    printf("ERROR: counter1 is %lld\n", value);
+    exit(2);
+  }
+  memcpy(&value, seg + COUNTER2, 8);
+  if (value != 8) {
+    printf("ERROR: counter2 is %lld\n", value);
+    exit(2);
+  }
+  if ((unsigned char) seg[FLAGS] != 0xfe || seg[FLAGS + 1] != 0x03) {
+    printf("ERROR: flags are %02x %02x\n", (unsigned char) seg[FLAGS], (unsigned char) seg[FLAGS + 1]);
+    exit(2);
+  }
+
+  memcpy(&used, seg + REGION, 8);
+  if (used != 12 * ENTRY_SIZE) {
+    printf("ERROR: append region holds %llu bytes\n", used);
+    exit(2);
+  }
+  for (i = 0; i < 12; i++) {
+    make_entry(entry, i);
+    if (memcmp(seg + REGION + 8 + i * ENTRY_SIZE, entry, ENTRY_SIZE)) {
+      printf("ERROR: append entry %d not recovered\n", i);
+      exit(2);
+    }
+  }
+  rvm_unmap(rvm, seg);
+}
+
+int main(int argc, char** argv) {
+  int pid;
+  int status;
+
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(2);
+  }
+  if (pid == 0) {
+    proc1();
+    exit(0);
+  }
+  waitpid(pid, &status, 0);
+  if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+    exit(2);
+  }
+
+  proc2(0);
+  proc2(1);
+  proc2(0);
+
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,144 @@
+/*
+ * Test single-shot atomic writes: they are recovered after a crash, are
+ * rejected while a transaction owns the segment and keep snapshot reads
+ * consistent
+ */
+#include "rvm.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#define SEG_SIZE 4096
+
+/* proc1 makes atomic writes, then crashes */
+void proc1() {
+  rvm_t rvm;
+  char* seg;
+  trans_t trans;
+  rvm_write_t writes[3];
+  int i;
+
+  rvm = rvm_init("rvm_segments");
+  rvm_destroy(rvm, "testseg43");
+  seg = (char*) rvm_map(rvm, "testseg43", SEG_SIZE);
+
+  for (i = 0; i < 100; i++) {
+    if (rvm_atomic_write(rvm, seg, i * 4, &i, sizeof(int)) != 0) {
+      printf("ERROR: atomic write %d failed\n", i);
+      exit(2);
+    }
+  }
+
+  writes[0].offset = 1000;
+  writes[0].src = "first";
+  writes[0].size = 6;
+  writes[1].offset = 2000;
+  writes[1].src = "second";
+  writes[1].size = 7;
+  writes[2].offset = SEG_SIZE - 6;
+  writes[2].src = "third";
+  writes[2].size = 6;
+  if (rvm_atomic_writev(rvm, seg, writes, 3) != 0) {
+    printf("ERROR: vector atomic write failed\n");
+    exit(2);
+  }
+
+  // Writes outside the segment are rejected as a whole
+  writes[2].offset = SEG_SIZE - 2;
+  writes[0].src = "wrong";
+  if (rvm_atomic_writev(rvm, seg, writes, 3) != -1 || strcmp(seg + 1000, "first")) {
+    printf("ERROR: vector atomic write outside of segment accepted\n");
+    exit(2);
+  }
+
+  // A segment owned by a transaction can not be written
+  trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+  if (rvm_atomic_write(rvm, seg, 3000, "owned", 6) != -1) {
+    printf("ERROR: atomic write to an owned segment accepted\n");
+    exit(2);
+  }
+  rvm_abort_trans(trans);
+
+  // Shared transactions only exclude the ranges they lock
+  trans = rvm_begin_trans_flags(rvm, 1, (void**) &seg, RVM_TRANS_SHARED);
+  rvm_about_to_modify(trans, seg, 3000, 10);
+  strcpy(seg + 3000, "shared");
+  if (rvm_atomic_write(rvm, seg, 3100, "beside", 7) != 0) {
+    printf("ERROR: atomic write beside a shared transaction failed\n");
+    exit(2);
+  }
+  rvm_commit_trans(trans);
+  abort();
+}
+
+/* proc2 checks the recovered segment */
+void proc2() {
+  rvm_t rvm;
+  char* seg;
+  int i;
+
+  rvm = rvm_init("rvm_segments");
+  seg = (char*) rvm_map(rvm, "testseg43", SEG_SIZE);
+  for (i = 0; i < 100; i++) {
+    if (((int*) seg)[i] != i) {
+      printf("ERROR: atomic write %d not recovered\n", i);
+      exit(2);
+    }
+  }
+  if (strcmp(seg + 1000, "first") || strcmp(seg + 2000, "second") || strcmp(seg + SEG_SIZE - 6, "third")) {
+    printf("ERROR: vector atomic write not recovered\n");
+    exit(2);
+  }
+  if (strcmp(seg + 3000, "shared") || strcmp(seg + 3100, "beside")) {
+    printf("ERROR: writes next to a shared transaction not recovered\n");
+    exit(2);
+  }
+  rvm_unmap(rvm, seg);
+}
+
+/* proc3 checks that snapshot readers do not see later atomic writes */
+void proc3() {
+  rvm_t rvm;
+  char* seg;
+  trans_t reader;
+  char buf[8];
+
+  rvm = rvm_init("rvm_segments");
+  rvm_set_option(rvm, RVM_OPT_SNAPSHOTS, 1);
+  seg = (char*) rvm_map(rvm, "testseg43", SEG_SIZE);
+  reader = rvm_begin_read_trans(rvm);
+  rvm_atomic_write(rvm, seg, 1000, "fourth", 7);
+  rvm_read(reader, seg, 1000, buf, 6);
+  if (strcmp(buf, "first") || strcmp(seg + 1000, "fourth")) {
+    printf("ERROR: snapshot read sees an atomic write made after it\n");
+    exit(2);
+  }
+  rvm_commit_trans(reader);
+}
+
+int main(int argc, char** argv) {
+  int pid;
+  int status;
+
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(2);
+  }
+  if (pid == 0) {
+    proc1();
+    exit(0);
+  }
+  waitpid(pid, &status, 0);
+  if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+    exit(2);
+  }
+
+  proc2();
+  proc3();
+
+  printf("OK\n");
+  return 0;
+}
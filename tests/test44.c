@@ -0,0 +1,159 @@
+/*
+ * Test batched calls: rvm_about_to_modify_v() with unsorted, overlapping
+ * ranges over two segments, and rvm_map_many() recovering segments from
+ * backing files and the log with each I/O engine
+ */
+#include "rvm.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#define NUM_SEGS 4
+#define SEG_SIZE 8192
+
+static const char* names[NUM_SEGS] = { "testseg44a", "testseg44b", "testseg44c", "testseg44d" };
+static const int sizes[NUM_SEGS] = { SEG_SIZE, SEG_SIZE, SEG_SIZE, SEG_SIZE };
+
+/* proc1 fills the segments, truncating the log halfway, then crashes */
+void proc1() {
+  rvm_t rvm;
+  char* segs[NUM_SEGS];
+  rvm_range_t ranges[5];
+  trans_t trans;
+  int i;
+
+  rvm = rvm_init("rvm_segments");
+  for (i = 0; i < NUM_SEGS; i++) {
+    rvm_destroy(rvm, names[i]);
+  }
+  if (rvm_map_many(rvm, NUM_SEGS, names, sizes, (void**) segs) != 0) {
+    printf("ERROR: rvm_map_many() failed\n");
+    exit(2);
+  }
+
+  // Mapping a segment twice fails and maps nothing
+  if (rvm_map_many(rvm, 1, names, sizes, (void**) segs) != -1) {
+    printf("ERROR: segment mapped twice\n");
+    exit(2);
+  }
+
+  trans = rvm_begin_trans(rvm, NUM_SEGS, (void**) segs);
+  for (i = 0; i < NUM_SEGS; i++) {
+    rvm_about_to_modify(trans, segs[i], 0, 64);
+    sprintf(segs[i], "backing %d", i);
+  }
+  rvm_commit_trans(trans);
+  rvm_truncate_log(rvm);
+
+  ranges[0].segbase = segs[1];
+  ranges[0].offset = 200;
+  ranges[0].size = 100;
+  ranges[1].segbase = segs[0];
+  ranges[1].offset = 150;
+  ranges[1].size = 100;
+  ranges[2].segbase = segs[1];
+  ranges[2].offset = 100;
+  ranges[2].size = 100;
+  ranges[3].segbase = segs[0];
+  ranges[3].offset = 100;
+  ranges[3].size = 100;
+  ranges[4].segbase = segs[1];
+  ranges[4].offset = 1000;
+  ranges[4].size = 10;
+
+  // Aborting restores every range
+  trans = rvm_begin_trans(rvm, NUM_SEGS, (void**) segs);
+  rvm_about_to_modify_v(trans, ranges, 5);
+  memset(segs[0] + 100, 'x', 150);
+  memset(segs[1] + 100, 'x', 200);
+  memset(segs[1] + 1000, 'x', 10);
+  rvm_abort_trans(trans);
+  for (i = 0; i < SEG_SIZE; i++) {
+    if (segs[0][i] == 'x' || segs[1][i] == 'x') {
+      printf("ERROR: byte %d not restored by abort\n", i);
+      exit(2);
+    }
+  }
+
+  trans = rvm_begin_trans(rvm, NUM_SEGS, (void**) segs);
+  rvm_about_to_modify_v(trans, ranges, 5);
+  memset(segs[0] + 100, 'y', 150);
+  memset(segs[1] + 100, 'y', 200);
+  memset(segs[1] + 1000, 'y', 10);
+  rvm_commit_trans(trans);
+
+  trans = rvm_begin_trans(rvm, NUM_SEGS, (void**) segs);
+  for (i = 0; i < NUM_SEGS; i++) {
+    rvm_about_to_modify(trans, segs[i], SEG_SIZE - 64, 64);
+    sprintf(segs[i] + SEG_SIZE - 64, "log %d", i);
+  }
+  rvm_commit_trans(trans);
+  abort();
+}
+
+/* proc2 maps the segments together and checks them */
+void proc2(int engine) {
+  rvm_t rvm;
+  char* segs[NUM_SEGS];
+  char buf[32];
+  int i;
+
+  rvm = rvm_init("rvm_segments");
+  if (rvm_set_option(rvm, RVM_OPT_IO_ENGINE, engine) != 0) {
+    return;
+  }
+  if (rvm_map_many(rvm, NUM_SEGS, names, sizes, (void**) segs) != 0) {
+    printf("ERROR: rvm_map_many() failed\n");
+    exit(2);
+  }
+  for (i = 0; i < NUM_SEGS; i++) {
+    sprintf(buf, "backing %d", i);
+    if (strcmp(segs[i], buf)) {
+      printf("ERROR: backing file of segment %d not read\n", i);
+      exit(2);
+    }
+    sprintf(buf, "log %d", i);
+    if (strcmp(segs[i] + SEG_SIZE - 64, buf)) {
+      printf("ERROR: log of segment %d not replayed\n", i);
+      exit(2);
+    }
+  }
+  for (i = 0; i < SEG_SIZE; i++) {
+    int in0 = (i >= 100 && i < 250);
+    int in1 = (i >= 100 && i < 300) || (i >= 1000 && i < 1010);
+    if ((segs[0][i] == 'y') != in0 || (segs[1][i] == 'y') != in1) {
+      printf("ERROR: byte %d of the batched ranges not recovered\n", i);
+      exit(2);
+    }
+  }
+  for (i = 0; i < NUM_SEGS; i++) {
+    rvm_unmap(rvm, segs[i]);
+  }
+}
+
+int main(int argc, char** argv) {
+  int pid;
+  int status;
+
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(2);
+  }
+  if (pid == 0) {
+    proc1();
+    exit(0);
+  }
+  waitpid(pid, &status, 0);
+  if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+    exit(2);
+  }
+
+  proc2(RVM_IO_ENGINE_POSIX);
+  proc2(RVM_IO_ENGINE_URING);
+
+  printf("OK\n");
+  return 0;
+}
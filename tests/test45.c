@@ -0,0 +1,94 @@
+/*
+ * Test that rvm_get_stats() counts commits, aborts, log writes and
+ * truncations, and reports ordered latency percentiles
+ */
+#include "rvm.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SEG_SIZE 4096
+#define NUM_COMMITS 200
+
+static void check_latency(const char* name, const rvm_latency_t* latency, unsigned long long count) {
+  if (latency->count != count) {
+    printf("ERROR: %llu %s latencies recorded, expected %llu\n", latency->count, name, count);
+    exit(2);
+  }
+  if (count > 0 && !(latency->min_ns <= latency->p50_ns && latency->p50_ns <= latency->p90_ns &&
+                     latency->p90_ns <= latency->p99_ns && latency->p99_ns <= latency->p999_ns &&
+                     latency->p999_ns <= latency->max_ns && latency->min_ns <= latency->mean_ns &&
+                     latency->mean_ns <= latency->max_ns && latency->max_ns > 0)) {
+    printf("ERROR: %s latencies out of order\n", name);
+    exit(2);
+  }
+}
+
+int main(int argc, char** argv) {
+  rvm_t rvm;
+  char* seg;
+  trans_t trans;
+  rvm_stats_t stats;
+  int i;
+
+  rvm = rvm_init("rvm_segments");
+  rvm_destroy(rvm, "testseg45");
+  seg = (char*) rvm_map(rvm, "testseg45", SEG_SIZE);
+
+  for (i = 0; i < NUM_COMMITS; i++) {
+    trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+    rvm_about_to_modify(trans, seg, i, 8);
+    rvm_about_to_modify(trans, seg, i, 8);
+    memset(seg + i, 'a' + i % 26, 8);
+    rvm_commit_trans(trans);
+  }
+  trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+  rvm_about_to_modify(trans, seg, 1000, 100);
+  rvm_abort_trans(trans);
+  rvm_atomic_write(rvm, seg, 2000, "atomic", 7);
+
+  rvm_get_stats(rvm, &stats);
+  if (stats.commits != NUM_COMMITS + 1 || stats.aborts != 1) {
+    printf("ERROR: %llu commits and %llu aborts counted\n", stats.commits, stats.aborts);
+    exit(2);
+  }
+  if (stats.about_to_modify_calls != 2 * NUM_COMMITS + 1 || stats.undo_bytes != 8 * NUM_COMMITS + 100) {
+    printf("ERROR: %llu about_to_modify calls with %llu undo bytes counted\n",
+           stats.about_to_modify_calls, stats.undo_bytes);
+    exit(2);
+  }
+  if (stats.redo_bytes == 0 || stats.redo_bytes > 8 * NUM_COMMITS + 7 ||
+      stats.log_bytes_written <= stats.redo_bytes) {
+    printf("ERROR: %llu redo bytes and %llu log bytes counted\n", stats.redo_bytes, stats.log_bytes_written);
+    exit(2);
+  }
+  if (stats.resident_log_bytes < stats.redo_bytes || stats.truncations != 0) {
+    printf("ERROR: %llu resident log bytes counted\n", stats.resident_log_bytes);
+    exit(2);
+  }
+  check_latency("commit", &stats.commit_latency, NUM_COMMITS + 1);
+  check_latency("map", &stats.map_latency, 1);
+  check_latency("recovery", &stats.recovery_latency, 1);
+  check_latency("truncate", &stats.truncate_latency, 0);
+
+  rvm_truncate_log(rvm);
+  rvm_get_stats(rvm, &stats);
+  if (stats.truncations != 1 || stats.records_applied == 0 || stats.resident_log_bytes != 0) {
+    printf("ERROR: %llu truncations applied %llu records and left %llu resident bytes\n",
+           stats.truncations, stats.records_applied, stats.resident_log_bytes);
+    exit(2);
+  }
+  check_latency("truncate", &stats.truncate_latency, 1);
+
+  rvm_set_option(rvm, RVM_OPT_SYNC, 1);
+  rvm_atomic_write(rvm, seg, 2000, "synced", 7);
+  rvm_get_stats(rvm, &stats);
+  if (stats.syncs != 1) {
+    printf("ERROR: %llu syncs counted\n", stats.syncs);
+    exit(2);
+  }
+
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,103 @@
+/*
+ * Test that RVM_OPT_TRACE records commit, truncate and map spans and that
+ * rvm_trace_dump() writes them as Chrome trace JSON
+ */
+#include "rvm.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SEG_SIZE 4096
+#define TRACE_FILE "rvm_segments/trace46.json"
+
+static void commit_one(rvm_t rvm, char* seg, int i) {
+  trans_t trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+  rvm_about_to_modify(trans, seg, i, 8);
+  memset(seg + i, 'a' + i % 26, 8);
+  rvm_commit_trans(trans);
+}
+
+static void check_span(const char* json, const char* name) {
+  char pattern[64];
+  snprintf(pattern, sizeof(pattern), "\"name\":\"%s\"", name);
+  if (strstr(json, pattern) == NULL) {
+    printf("ERROR: no %s span in the trace\n", name);
+    exit(2);
+  }
+}
+
+int main(int argc, char** argv) {
+  rvm_t rvm;
+  char* seg;
+  char* seg2;
+  char json[1 << 16];
+  FILE* file;
+  size_t length;
+  int count;
+  int i;
+
+  rvm = rvm_init("rvm_segments");
+  rvm_destroy(rvm, "testseg46a");
+  rvm_destroy(rvm, "testseg46b");
+  seg = (char*) rvm_map(rvm, "testseg46a", SEG_SIZE);
+
+  // Tracing is off until a capacity is set
+  commit_one(rvm, seg, 0);
+  if (rvm_trace_dump(rvm, TRACE_FILE) != 0) {
+    printf("ERROR: spans recorded with tracing off\n");
+    exit(2);
+  }
+  if (rvm_set_option(rvm, RVM_OPT_TRACE, -1) != -1) {
+    printf("ERROR: negative trace capacity accepted\n");
+    exit(2);
+  }
+
+  rvm_set_option(rvm, RVM_OPT_TRACE, 1000);
+  commit_one(rvm, seg, 8);
+  rvm_truncate_log(rvm);
+  seg2 = (char*) rvm_map(rvm, "testseg46b", SEG_SIZE);
+  count = rvm_trace_dump(rvm, TRACE_FILE);
+  if (count <= 0) {
+    printf("ERROR: %d spans written\n", count);
+    exit(2);
+  }
+
+  file = fopen(TRACE_FILE, "r");
+  length = fread(json, 1, sizeof(json) - 1, file);
+  fclose(file);
+  json[length] = '\0';
+  if (strncmp(json, "{\"traceEvents\":[", 16) != 0 || strstr(json, "\"ph\":\"X\"") == NULL) {
+    printf("ERROR: trace is not in Chrome trace format\n");
+    exit(2);
+  }
+  check_span(json, "commit");
+  check_span(json, "commit_diff");
+  check_span(json, "commit_flush");
+  check_span(json, "log_write");
+  check_span(json, "truncate");
+  check_span(json, "apply");
+  check_span(json, "map");
+  check_span(json, "map_read");
+  check_span(json, "map_replay");
+
+  // The ring keeps only the newest spans
+  rvm_set_option(rvm, RVM_OPT_TRACE, 4);
+  for (i = 0; i < 10; i++) {
+    commit_one(rvm, seg, i);
+  }
+  if ((count = rvm_trace_dump(rvm, TRACE_FILE)) != 4) {
+    printf("ERROR: %d spans kept by a ring of 4\n", count);
+    exit(2);
+  }
+
+  rvm_set_option(rvm, RVM_OPT_TRACE, 0);
+  commit_one(rvm, seg2, 0);
+  if ((count = rvm_trace_dump(rvm, TRACE_FILE)) != 0) {
+    printf("ERROR: %d spans kept after tracing was turned off\n", count);
+    exit(2);
+  }
+
+  printf("OK\n");
+  return 0;
+}
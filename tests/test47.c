@@ -0,0 +1,175 @@
+/*
+ * Test that a recorded workload trace replays the same calls on another
+ * instance, at the recorded pace unless RVM_REPLAY_MAX_SPEED is given
+ */
+#include "rvm.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SEG_SIZE 4096
+#define NUM_COMMITS 10
+#define TRACE_FILE "rvm_segments/trace47.rvm"
+#define GARBAGE_FILE "rvm_segments/garbage47.rvm"
+#define PAUSE_US 100000
+
+// The map, each transaction's calls, the calls of make_other_calls(),
+// the truncation and the unmap
+#define NUM_OTHER_CALLS 14
+#define NUM_CALLS (1 + 4 * NUM_COMMITS + 3 + 3 + NUM_OTHER_CALLS + 1 + 1)
+
+static double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void check_stats(rvm_t rvm, unsigned long long commits, unsigned long long aborts) {
+  rvm_stats_t stats;
+  rvm_get_stats(rvm, &stats);
+  if (stats.commits != commits || stats.aborts != aborts) {
+    printf("ERROR: replay made %llu commits and %llu aborts\n", stats.commits, stats.aborts);
+    exit(2);
+  }
+}
+
+/* Makes one of each other call the replay issues, plus a savepoint, which
+ * it can not */
+static void make_other_calls(rvm_t rvm, char* seg) {
+  const char* names[1] = { "testseg47b" };
+  int sizes[1] = { SEG_SIZE };
+  void* bases[2];
+  rvm_range_t ranges[2];
+  rvm_commit_t handle;
+  trans_t trans;
+
+  if (rvm_map_many(rvm, 1, names, sizes, &bases[1]) != 0) {
+    printf("ERROR: rvm_map_many failed\n");
+    exit(2);
+  }
+  rvm_set_option(rvm, RVM_OPT_LOG_BUFFER_SIZE, 65536);
+  bases[0] = seg;
+  trans = rvm_begin_trans_flags(rvm, 2, bases, RVM_TRANS_SHARED);
+  rvm_try_about_to_modify(trans, seg, 100, 8);
+  ranges[0].segbase = seg;
+  ranges[0].offset = 200;
+  ranges[0].size = 8;
+  ranges[1].segbase = bases[1];
+  ranges[1].offset = 0;
+  ranges[1].size = 16;
+  rvm_about_to_modify_v(trans, ranges, 2);
+  rvm_add_int64(trans, seg, 512, 5);
+  rvm_set_bit(trans, seg, 520, 3, 1);
+  rvm_append(trans, seg, 600, 64, "abc", 3);
+  rvm_savepoint(trans);
+  handle = rvm_commit_trans_async(trans);
+  rvm_commit_wait(handle);
+  rvm_commit_release(handle);
+  rvm_flush(rvm);
+  rvm_atomic_write(rvm, seg, 300, "xyz", 3);
+  bases[1] = rvm_resize(rvm, bases[1], 2 * SEG_SIZE);
+  rvm_unmap(rvm, bases[1]);
+  rvm_destroy(rvm, "testseg47b");
+}
+
+/* Whether the trace names the call it could not record as one to replay */
+static int trace_has_unsupported(const char* call) {
+  char buf[65536];
+  FILE* file = fopen(TRACE_FILE, "rb");
+  size_t size = fread(buf, 1, sizeof(buf), file);
+  size_t length = strlen(call);
+  size_t i;
+
+  fclose(file);
+  for (i = 0; i + length <= size; i++) {
+    if (memcmp(buf + i, call, length) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  rvm_t rvm;
+  rvm_t replay;
+  char* seg;
+  trans_t trans;
+  FILE* file;
+  double start;
+  int calls;
+  int i;
+
+  rvm = rvm_init("rvm_segments");
+  rvm_destroy(rvm, "testseg47");
+  rvm_destroy(rvm, "testseg47b");
+  seg = (char*) rvm_map(rvm, "testseg47", SEG_SIZE);
+
+  // The segment mapped before the recording starts is part of the trace
+  if (rvm_record_stop(rvm) != -1 || rvm_record_start(rvm, TRACE_FILE) != 0) {
+    printf("ERROR: recording did not start\n");
+    exit(2);
+  }
+  for (i = 0; i < NUM_COMMITS; i++) {
+    trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+    rvm_about_to_modify(trans, seg, i * 16, 8);
+    rvm_about_to_modify(trans, seg, 2048 + i * 16, 8);
+    memset(seg + i * 16, 'a' + i, 8);
+    memset(seg + 2048 + i * 16, 'a' + i, 8);
+    rvm_commit_trans(trans);
+  }
+  trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+  rvm_about_to_modify(trans, seg, 1000, 100);
+  rvm_abort_trans(trans);
+
+  usleep(PAUSE_US);
+  trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+  rvm_about_to_modify(trans, seg, 3000, 16);
+  rvm_commit_trans_no_flush(trans);
+  make_other_calls(rvm, seg);
+  rvm_truncate_log(rvm);
+  rvm_unmap(rvm, seg);
+  if (rvm_record_stop(rvm) != 0) {
+    printf("ERROR: recording did not stop\n");
+    exit(2);
+  }
+
+  if (!trace_has_unsupported("rvm_savepoint")) {
+    printf("ERROR: savepoint missing from the trace\n");
+    exit(2);
+  }
+
+  replay = rvm_init("rvm_segments/replay47");
+  rvm_destroy(replay, "testseg47");
+  rvm_destroy(replay, "testseg47b");
+  if ((calls = rvm_replay(replay, TRACE_FILE, RVM_REPLAY_MAX_SPEED)) != NUM_CALLS) {
+    printf("ERROR: %d of %d calls replayed\n", calls, NUM_CALLS);
+    exit(2);
+  }
+  // make_other_calls() adds an asynchronous commit and an atomic write
+  check_stats(replay, NUM_COMMITS + 3, 1);
+
+  // At the recorded pace the replay waits out the pause
+  start = now_seconds();
+  if ((calls = rvm_replay(replay, TRACE_FILE, 0)) != NUM_CALLS) {
+    printf("ERROR: %d of %d calls replayed at the recorded pace\n", calls, NUM_CALLS);
+    exit(2);
+  }
+  if (now_seconds() - start < PAUSE_US / 1e6) {
+    printf("ERROR: replay took %.3f seconds\n", now_seconds() - start);
+    exit(2);
+  }
+  check_stats(replay, 2 * (NUM_COMMITS + 3), 2);
+
+  file = fopen(GARBAGE_FILE, "w");
+  fprintf(file, "not a workload trace");
+  fclose(file);
+  if (rvm_replay(replay, GARBAGE_FILE, 0) != -1 || rvm_replay(replay, "rvm_segments/missing47.rvm", 0) != -1) {
+    printf("ERROR: replayed a file that is not a trace\n");
+    exit(2);
+  }
+
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * Test that commits and atomic writes whose log write fails are not
+ * reported durable, and that the next successful flush writes them in
+ * commit order
+ */
+#include "rvm.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define SEG_SIZE 8192
+
+static long g_durable = 0;
+
+static void on_durable(rvm_t rvm, long ticket, void* arg) {
+  g_durable = ticket;
+}
+
+static trans_t write_range(rvm_t rvm, char* seg, int offset, int size, char c) {
+  trans_t trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+  rvm_about_to_modify(trans, seg, offset, size);
+  memset(seg + offset, c, size);
+  return trans;
+}
+
+static void set_file_limit(rlim_t limit) {
+  struct rlimit rl;
+  getrlimit(RLIMIT_FSIZE, &rl);
+  rl.rlim_cur = limit;
+  setrlimit(RLIMIT_FSIZE, &rl);
+}
+
+/* proc1 commits while the log can not grow, then flushes and crashes */
+void proc1() {
+  rvm_t rvm;
+  char* seg;
+  rvm_commit_t handle;
+  long ticket;
+  long durable;
+
+  // Writes past the limit fail with EFBIG instead of killing the process
+  signal(SIGXFSZ, SIG_IGN);
+  rvm = rvm_init("rvm_segments");
+  rvm_destroy(rvm, "testseg48");
+  seg = (char*) rvm_map(rvm, "testseg48", SEG_SIZE);
+  rvm_set_durable_callback(rvm, on_durable, NULL);
+  if (rvm_commit_trans(write_range(rvm, seg, 0, 100, 'A')) != 0) {
+    printf("ERROR: commit failed\n");
+    exit(2);
+  }
+  rvm_truncate_log(rvm);
+  durable = g_durable;
+
+  set_file_limit(64);
+  if (rvm_commit_trans(write_range(rvm, seg, 1000, 4000, 'B')) != -1) {
+    printf("ERROR: commit with a failed log write succeeded\n");
+    exit(2);
+  }
+  ticket = rvm_commit_trans_no_flush(write_range(rvm, seg, 6000, 100, 'C'));
+  if (rvm_flush(rvm) != -1 || rvm_is_durable(rvm, ticket)) {
+    printf("ERROR: flush with a failed log write succeeded\n");
+    exit(2);
+  }
+  if (rvm_atomic_write(rvm, seg, 7000, "E", 1) != -1) {
+    printf("ERROR: atomic write with a failed log write succeeded\n");
+    exit(2);
+  }
+  handle = rvm_commit_trans_async(write_range(rvm, seg, 1000, 100, 'D'));
+  if (rvm_commit_wait(handle) != -1 || rvm_commit_poll(handle) != -1) {
+    printf("ERROR: asynchronous commit with a failed log write reported durable\n");
+    exit(2);
+  }
+  if (g_durable != durable) {
+    printf("ERROR: durable callback ran for ticket %ld after failed writes\n", g_durable);
+    exit(2);
+  }
+
+  set_file_limit(RLIM_INFINITY);
+  if (rvm_flush(rvm) != 0 || !rvm_is_durable(rvm, ticket) || rvm_commit_poll(handle) != 1 ||
+      g_durable <= ticket) {
+    printf("ERROR: retried log write not durable\n");
+    exit(2);
+  }
+  rvm_commit_release(handle);
+  abort();
+}
+
+/* proc2 checks that recovery applies B, C, E and D in commit order */
+void proc2() {
+  rvm_t rvm;
+  char* seg;
+  int i;
+
+  rvm = rvm_init("rvm_segments");
+  seg = (char*) rvm_map(rvm, "testseg48", SEG_SIZE);
+  for (i = 0; i < SEG_SIZE; i++) {
+    char expected = 0;
+    if (i < 100) {
+      expected = 'A';
+    } else if (i >= 1000 && i < 1100) {
+      expected = 'D';
+    } else if (i >= 1100 && i < 5000) {
+      expected = 'B';
+    } else if (i >= 6000 && i < 6100) {
+      expected = 'C';
+    } else if (i == 7000) {
+      expected = 'E';
+    }
+    if (seg[i] != expected) {
+      printf("ERROR: byte %d is %d after recovery, expected %d\n", i, seg[i], expected);
+      exit(2);
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  int pid;
+  int status;
+
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(2);
+  }
+  if (pid == 0) {
+    proc1();
+    exit(0);
+  }
+  waitpid(pid, &status, 0);
+  if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+    exit(2);
+  }
+
+  proc2();
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * Test that atomic writes over the same ranges, given in opposite orders
+ * by two threads, do not deadlock and each land as a whole
+ */
+#include "rvm.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SEG_SIZE 4096
+#define NUM_WRITES 2000
+#define RANGE_SIZE 64
+
+static rvm_t rvm;
+static char* seg;
+
+/* Both threads write the same two ranges; the second thread gives them
+ * in reverse order */
+static void* writer(void* arg) {
+  int reverse = *(int*) arg;
+  char a[RANGE_SIZE];
+  char b[RANGE_SIZE];
+  rvm_write_t writes[2];
+  int i;
+
+  memset(a, reverse ? 'x' : 'a', RANGE_SIZE);
+  memset(b, reverse ? 'y' : 'b', RANGE_SIZE);
+  for (i = 0; i < NUM_WRITES; i++) {
+    writes[reverse ? 1 : 0].offset = 0;
+    writes[reverse ? 1 : 0].size = RANGE_SIZE;
+    writes[reverse ? 1 : 0].src = a;
+    writes[reverse ? 0 : 1].offset = 1024;
+    writes[reverse ? 0 : 1].size = RANGE_SIZE;
+    writes[reverse ? 0 : 1].src = b;
+    if (rvm_atomic_writev(rvm, seg, writes, 2) != 0) {
+      printf("ERROR: atomic write %d failed\n", i);
+      exit(2);
+    }
+  }
+  return NULL;
+}
+
+int main(int argc, char** argv) {
+  pthread_t threads[2];
+  int reverse[2] = { 0, 1 };
+  int i;
+
+  rvm = rvm_init("rvm_segments");
+  rvm_destroy(rvm, "testseg49");
+  seg = (char*) rvm_map(rvm, "testseg49", SEG_SIZE);
+
+  for (i = 0; i < 2; i++) {
+    pthread_create(&threads[i], NULL, writer, &reverse[i]);
+  }
+  for (i = 0; i < 2; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  // The last write of one thread wins both ranges
+  for (i = 0; i < RANGE_SIZE; i++) {
+    if (!((seg[i] == 'a' && seg[1024 + i] == 'b') || (seg[i] == 'x' && seg[1024 + i] == 'y'))) {
+      printf("ERROR: bytes %d are %c and %c, from different writes\n", i, seg[i], seg[1024 + i]);
+      exit(2);
+    }
+  }
+
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * Test that a crash during truncation, after the backing files are written
+ * and before the log is rewritten, does not replay logical records twice
+ */
+#include "rvm.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#define SEG_SIZE 4096
+#define COUNTER 0
+#define FLAGS 8
+#define REGION 64
+#define CAPACITY 200
+#define ENTRY_SIZE 16
+#define NUM_TRANS 5
+
+static int log_renames_left = -1;
+
+/* Replaces the C library's rename() for the library too. Once armed, the
+ * process crashes instead of making the given rename of the log. */
+int rename(const char* oldpath, const char* newpath) {
+  size_t length = strlen(newpath);
+  if (log_renames_left >= 0 && length >= 12 && strcmp(newpath + length - 12, "redo_log.rvm") == 0) {
+    if (log_renames_left-- == 0) {
+      abort();
+    }
+  }
+  return renameat(AT_FDCWD, oldpath, AT_FDCWD, newpath);
+}
+
+/* proc1 makes logical and plain updates, then crashes while truncating */
+void proc1() {
+  rvm_t rvm;
+  char* segs[2];
+  trans_t trans;
+  char entry[ENTRY_SIZE];
+  int i;
+
+  rvm = rvm_init("rvm_segments");
+  rvm_destroy(rvm, "testseg50");
+  rvm_destroy(rvm, "testseg50b");
+  segs[0] = (char*) rvm_map(rvm, "testseg50", SEG_SIZE);
+  segs[1] = (char*) rvm_map(rvm, "testseg50b", SEG_SIZE);
+
+  for (i = 0; i < NUM_TRANS; i++) {
+    trans = rvm_begin_trans(rvm, 2, (void**) segs);
+    rvm_add_int64(trans, segs[0], COUNTER, 3);
+    rvm_set_bit(trans, segs[0], FLAGS, i, 1);
+    memset(entry, 'a' + i, ENTRY_SIZE);
+    rvm_append(trans, segs[0], REGION, CAPACITY, entry, ENTRY_SIZE);
+    rvm_about_to_modify(trans, segs[1], i * 100, 100);
+    memset(segs[1] + i * 100, 'a' + i, 100);
+    rvm_commit_trans(trans);
+  }
+
+  // The truncation first replaces the log with the folded records, then
+  // writes the backing files, then replaces the log again
+  log_renames_left = 1;
+  rvm_truncate_log(rvm);
+  printf("ERROR: truncation did not crash\n");
+  exit(2);
+}
+
+static void check_segments(char** segs, const char* when) {
+  long long counter;
+  unsigned long long used;
+  int i;
+
+  memcpy(&counter, segs[0] + COUNTER, sizeof(counter));
+  memcpy(&used, segs[0] + REGION, sizeof(used));
+  if (counter != 3 * NUM_TRANS || used != NUM_TRANS * ENTRY_SIZE ||
+      (unsigned char) segs[0][FLAGS] != (1 << NUM_TRANS) - 1) {
+    printf("ERROR: counter %lld, %llu bytes appended and flags %x %s\n", counter, used,
+           (unsigned char) segs[0][FLAGS], when);
+    exit(2);
+  }
+  for (i = 0; i < NUM_TRANS * ENTRY_SIZE; i++) {
+    if (segs[0][REGION + 8 + i] != 'a' + i / ENTRY_SIZE) {
+      printf("ERROR: appended byte %d is %c %s\n", i, segs[0][REGION + 8 + i], when);
+      exit(2);
+    }
+  }
+  for (i = 0; i < SEG_SIZE; i++) {
+    char expected = (i < NUM_TRANS * 100) ? 'a' + i / 100 : 0;
+    if (segs[1][i] != expected) {
+      printf("ERROR: byte %d is %d %s\n", i, segs[1][i], when);
+      exit(2);
+    }
+  }
+}
+
+/* proc2 checks that every update is applied exactly once */
+void proc2() {
+  rvm_t rvm;
+  char* segs[2];
+
+  rvm = rvm_init("rvm_segments");
+  segs[0] = (char*) rvm_map(rvm, "testseg50", SEG_SIZE);
+  segs[1] = (char*) rvm_map(rvm, "testseg50b", SEG_SIZE);
+  check_segments(segs, "after recovery");
+
+  // Truncating again applies the recovered log once more
+  rvm_truncate_log(rvm);
+  rvm_unmap(rvm, segs[0]);
+  rvm_unmap(rvm, segs[1]);
+  segs[0] = (char*) rvm_map(rvm, "testseg50", SEG_SIZE);
+  segs[1] = (char*) rvm_map(rvm, "testseg50b", SEG_SIZE);
+  check_segments(segs, "after truncation");
+}
+
+int main(int argc, char** argv) {
+  int pid;
+  int status;
+
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(2);
+  }
+  if (pid == 0) {
+    proc1();
+    exit(0);
+  }
+  waitpid(pid, &status, 0);
+  if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+    exit(2);
+  }
+
+  proc2();
+  printf("OK\n");
+  return 0;
+}
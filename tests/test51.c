@@ -0,0 +1,110 @@
+/*
+ * Test that shared transactions locking the same two ranges in opposite
+ * orders do not deadlock: the second one to wait gets -1, aborts and
+ * retries, within one segment and across two segments
+ */
+#include "rvm.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SEG_SIZE 4096
+#define NUM_ROUNDS 200
+#define FIRST 0
+#define SECOND 1024
+
+static rvm_t rvm;
+static char* segs[2];
+static pthread_barrier_t barrier;
+static int deadlocks[2];
+
+/* Even rounds use two ranges of the first segment, odd rounds one range
+ * of each segment */
+static void* worker(void* arg) {
+  int reverse = *(int*) arg;
+  int round;
+  int retry;
+  trans_t trans;
+  char* bases[2];
+  int offsets[2];
+  int i;
+
+  for (round = 0; round < NUM_ROUNDS; round++) {
+    bases[0] = segs[0];
+    bases[1] = segs[round % 2];
+    offsets[0] = FIRST;
+    offsets[1] = SECOND;
+    if (reverse) {
+      bases[0] = segs[round % 2];
+      bases[1] = segs[0];
+      offsets[0] = SECOND;
+      offsets[1] = FIRST;
+    }
+
+    for (retry = 0;; retry++) {
+      trans = rvm_begin_trans_flags(rvm, 2, (void**) segs, RVM_TRANS_SHARED);
+      if (rvm_about_to_modify(trans, bases[0], offsets[0], sizeof(int)) != 0) {
+        printf("ERROR: first range of round %d not locked\n", round);
+        exit(2);
+      }
+      // Both threads hold their first range before asking for the second
+      if (retry == 0) {
+        pthread_barrier_wait(&barrier);
+      }
+      if (rvm_about_to_modify(trans, bases[1], offsets[1], sizeof(int)) == 0) {
+        break;
+      }
+      deadlocks[reverse]++;
+      rvm_abort_trans(trans);
+    }
+
+    for (i = 0; i < 2; i++) {
+      (*(int*) (bases[i] + offsets[i]))++;
+    }
+    if (rvm_commit_trans(trans) != 0) {
+      printf("ERROR: commit of round %d failed\n", round);
+      exit(2);
+    }
+    // The retrying thread must finish before the next round takes ranges
+    pthread_barrier_wait(&barrier);
+  }
+  return NULL;
+}
+
+int main(int argc, char** argv) {
+  pthread_t threads[2];
+  int reverse[2] = { 0, 1 };
+  int i;
+
+  rvm = rvm_init("rvm_segments");
+  rvm_destroy(rvm, "testseg51");
+  rvm_destroy(rvm, "testseg51b");
+  segs[0] = (char*) rvm_map(rvm, "testseg51", SEG_SIZE);
+  segs[1] = (char*) rvm_map(rvm, "testseg51b", SEG_SIZE);
+  pthread_barrier_init(&barrier, NULL, 2);
+
+  for (i = 0; i < 2; i++) {
+    pthread_create(&threads[i], NULL, worker, &reverse[i]);
+  }
+  for (i = 0; i < 2; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  // One of the two threads closes the cycle in every round, and again
+  // whenever its retry takes its first range back before the other wakes
+  if (deadlocks[0] + deadlocks[1] < NUM_ROUNDS) {
+    printf("ERROR: %d deadlocks reported in %d rounds\n", deadlocks[0] + deadlocks[1], NUM_ROUNDS);
+    exit(2);
+  }
+  if (*(int*) (segs[0] + FIRST) != NUM_ROUNDS * 2 ||
+      *(int*) (segs[0] + SECOND) != NUM_ROUNDS ||
+      *(int*) (segs[1] + SECOND) != NUM_ROUNDS) {
+    printf("ERROR: counters are %d, %d and %d\n", *(int*) (segs[0] + FIRST), *(int*) (segs[0] + SECOND),
+           *(int*) (segs[1] + SECOND));
+    exit(2);
+  }
+
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,113 @@
+/*
+ * Test group commit: threads committing to their own segments with synced
+ * log writes all get durable commits, share log syncs, and every commit
+ * is recovered after a crash
+ */
+#include "rvm.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#define SEG_SIZE 4096
+#define NUM_THREADS 8
+#define NUM_TRANS 200
+
+static rvm_t rvm;
+static char* segs[NUM_THREADS];
+
+/* Each commit writes its number to the next int of the thread's segment */
+static void* committer(void* arg) {
+  char* seg = segs[*(int*) arg];
+  trans_t trans;
+  int i;
+
+  for (i = 0; i < NUM_TRANS; i++) {
+    trans = rvm_begin_trans(rvm, 1, (void**) &seg);
+    rvm_about_to_modify(trans, seg, i * sizeof(int), sizeof(int));
+    ((int*) seg)[i] = i + 1;
+    if (rvm_commit_trans(trans) != 0) {
+      printf("ERROR: commit %d failed\n", i);
+      exit(2);
+    }
+  }
+  return NULL;
+}
+
+/* proc1 commits from all threads at once, then crashes */
+void proc1() {
+  pthread_t threads[NUM_THREADS];
+  int ids[NUM_THREADS];
+  char name[32];
+  rvm_stats_t stats;
+  int i;
+
+  rvm = rvm_init("rvm_segments");
+  rvm_set_option(rvm, RVM_OPT_SYNC, 1);
+  for (i = 0; i < NUM_THREADS; i++) {
+    sprintf(name, "testseg52_%d", i);
+    rvm_destroy(rvm, name);
+    segs[i] = (char*) rvm_map(rvm, name, SEG_SIZE);
+    ids[i] = i;
+  }
+
+  for (i = 0; i < NUM_THREADS; i++) {
+    pthread_create(&threads[i], NULL, committer, &ids[i]);
+  }
+  for (i = 0; i < NUM_THREADS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  // A log write covers every commit buffered before it, so no commit
+  // needs more than one sync of its own
+  rvm_get_stats(rvm, &stats);
+  if (stats.syncs > stats.commits) {
+    printf("ERROR: %llu log syncs for %llu commits\n", stats.syncs, stats.commits);
+    exit(2);
+  }
+  abort();
+}
+
+/* proc2 checks that every commit was recovered */
+void proc2() {
+  char name[32];
+  int i;
+  int j;
+
+  rvm = rvm_init("rvm_segments");
+  for (i = 0; i < NUM_THREADS; i++) {
+    sprintf(name, "testseg52_%d", i);
+    segs[i] = (char*) rvm_map(rvm, name, SEG_SIZE);
+    for (j = 0; j < NUM_TRANS; j++) {
+      if (((int*) segs[i])[j] != j + 1) {
+        printf("ERROR: commit %d of thread %d not recovered\n", j, i);
+        exit(2);
+      }
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  int pid;
+  int status;
+
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(2);
+  }
+  if (pid == 0) {
+    proc1();
+    exit(0);
+  }
+  waitpid(pid, &status, 0);
+  if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+    exit(2);
+  }
+
+  proc2();
+  printf("OK\n");
+  return 0;
+}